@@ -33,6 +33,8 @@ class ModeChannelBan : public ListModeBase
 		: ListModeBase(NULL, "ban", 'b', "End of channel ban list", 367, 368, true, "maxbans")
 	{
 	}
+
+	ModeAction OnModeChange(User* source, User* dest, Channel* channel, std::string& parameter, bool adding);
 };
 
 /** Channel mode +k
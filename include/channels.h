@@ -37,9 +37,20 @@
 class CoreExport Channel : public Extensible
 {
  public:
-	/** A map of Memberships on a channel keyed by User pointers
+	/** A map of Memberships on a channel keyed by User pointers.
+	 * The entries are stored in a vector so walking the member list for fan-out
+	 * is a sequential scan instead of chasing tree nodes, and found through a hash
+	 * table so joins and parts take constant time even on very large channels.
+	 * The Membership objects themselves live in a memory pool and never move, only
+	 * the entries pointing to them do, so iterators are invalidated when a member
+	 * joins or leaves but Membership pointers are not. Members are not in any
+	 * particular order.
 	 */
- 	typedef std::map<User*, insp::aligned_storage<Membership> > MemberMap;
+	typedef insp::dense_map<User*, Membership*> MemberMap;
+
+	/** A list of the Memberships of the local users on a channel
+	 */
+	typedef insp::intrusive_list<Membership, Channel> LocalMemberList;
 
  private:
 	/** Set default modes for the channel on creation
@@ -52,15 +63,111 @@ class CoreExport Channel : public Extensible
 	 */
 	std::bitset<ModeParser::MODEID_MAX> modes;
 
+	/** Memberships of the local users on the channel, maintained by AddUser() and DelUser().
+	 * Sending a line to the channel only needs to visit these, no matter how many remote
+	 * users are on the channel.
+	 */
+	LocalMemberList localusers;
+
 	/** Remove the given membership from the channel's internal map of
 	 * memberships and destroy the Membership object.
 	 * This function does not remove the channel from User::chanlist.
-	 * Since the parameter is an iterator to the target, the complexity
-	 * of this function is constant.
+	 * Invalidates all MemberMap iterators of this channel.
 	 * @param membiter The MemberMap iterator to remove, must be valid
 	 */
 	void DelUser(const MemberMap::iterator& membiter);
 
+	/** Write a line to all local members of the channel. The line is only
+	 * allocated once and is shared between the send queues of all recipients.
+	 * @param message The complete line to send, without CR/LF
+	 */
+	void WriteToLocalMembers(const std::string& message);
+
+	/** A ban list entry split up into its components ahead of time
+	 */
+	struct CompiledBan
+	{
+		/** The ban mask as it appears in the list, passed to OnCheckBan
+		 */
+		std::string mask;
+
+		/** The nick!ident part of the mask
+		 */
+		std::string nickident;
+
+		/** The host part of the mask
+		 */
+		std::string host;
+
+		/** True if host is a valid CIDR mask, in which case it is parsed into cidr
+		 */
+		bool iscidr;
+		irc::sockets::cidr_mask cidr;
+	};
+
+	/** Precompiled form of the ban list of the channel, see RebuildBanIndex()
+	 */
+	struct BanIndex
+	{
+		typedef TR1NS::unordered_multimap<std::string, size_t, irc::insensitive, irc::StrHashComp> HostMap;
+
+		/** All bans that the core knows how to match
+		 */
+		std::vector<CompiledBan> bans;
+
+		/** Indices of bans with a literal (non-wildcard, non-CIDR) host, keyed by host
+		 */
+		HostMap literal;
+
+		/** Indices of bans with a CIDR mask or a wildcard host
+		 */
+		std::vector<size_t> other;
+
+		/** Extbans and other masks that can only be matched by modules via OnCheckBan
+		 */
+		std::vector<std::string> modonly;
+
+		/** Value of banserial when the index was built
+		 */
+		unsigned int serial;
+
+		BanIndex() : serial(0) { }
+	};
+
+	/** Precompiled ban list, rebuilt on demand when banserial changes
+	 */
+	BanIndex banindex;
+
+	/** Incremented every time the ban list changes, invalidating banindex and
+	 * the cached ban match results in Memberships
+	 */
+	unsigned int banserial;
+
+	/** Rebuild banindex from the current ban list if it is out of date
+	 */
+	void RebuildBanIndex();
+
+	/** Match a user against a precompiled ban entry without calling any module hooks
+	 * @param user User to match
+	 * @param nickident nick!ident of the user
+	 * @param ban Ban to match against
+	 * @return True if the ban matches the user
+	 */
+	static bool MatchCompiledBan(User* user, const std::string& nickident, const CompiledBan& ban);
+
+	/** Match a user against the bans in banindex that the core can handle
+	 * @param user User to match
+	 * @return True if any of the bans matches the user
+	 */
+	bool MatchBanIndex(User* user);
+
+	/** Check whether any entry of the ban list matches the user.
+	 * Uses the cached result in the Membership of the user if there is one.
+	 * @param user User to check
+	 * @return True if the user matches a ban
+	 */
+	bool MatchBanList(User* user);
+
  public:
 	/** Creates a channel record and initialises it with default values
 	 * @param name The name of the channel
@@ -69,6 +176,11 @@ class CoreExport Channel : public Extensible
 	 */
 	Channel(const std::string &name, time_t ts);
 
+	/** Channel objects are allocated from a memory pool
+	 */
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+
 	/** Checks whether the channel should be destroyed, and if yes, begins
 	 * the teardown procedure.
 	 *
@@ -177,6 +289,11 @@ class CoreExport Channel : public Extensible
 	 */
 	const MemberMap& GetUsers() const { return userlist; }
 
+	/** Get the Memberships of the local users on the channel
+	 * @return List of the Memberships of all local users on the channel, in no particular order
+	 */
+	const LocalMemberList& GetLocalUsers() const { return localusers; }
+
 	/** Returns true if the user given is on the given channel.
 	 * @param user The user to look for
 	 * @return True if the user is on this channel
@@ -187,7 +304,8 @@ class CoreExport Channel : public Extensible
 
 	/** Make src kick user from this channel with the given reason.
 	 * @param src The source of the kick
-	 * @param victimiter Iterator to the user being kicked, must be valid
+	 * @param victimiter Iterator to the user being kicked, must be valid. It is not used
+	 * after the OnUserKick hooks were called as they may invalidate it.
 	 * @param reason The reason for the kick
 	 */
 	void KickUser(User* src, const MemberMap::iterator& victimiter, const std::string& reason);
@@ -336,6 +454,12 @@ class CoreExport Channel : public Extensible
 	 */
 	ModResult GetExtBanStatus(User *u, char type);
 
+	/** Discard all cached ban match results. Called by the ban mode
+	 * whenever an entry is added to or removed from the ban list, and
+	 * for every channel when a module is loaded or unloaded.
+	 */
+	void InvalidateBanCache() { banserial++; }
+
 	/** Write a NOTICE to all local users on the channel
 	 * @param text Text to send
 	 */
@@ -39,10 +39,44 @@ class CoreExport CommandParser
 	 */
 	void ProcessCommand(LocalUser* user, std::string& cmd);
 
+	/** Process a command from a user using the given vector for the parameters.
+	 * @param user The user to parse the command for
+	 * @param cmd The command string to process
+	 * @param command_p Vector to store the parameters of the command in
+	 */
+	void ProcessCommand(LocalUser* user, std::string& cmd, std::vector<std::string>& command_p);
+
 	/** Command list, a hash_map of command names to Command*
 	 */
 	CommandMap cmdlist;
 
+	/** Parameters of the command being processed. Reused for every command so the
+	 * parameters can be stored without allocating memory once the strings are large enough.
+	 */
+	std::vector<std::string> parambuf;
+
+	/** True if parambuf is in use, i.e. a command is being processed at the moment
+	 */
+	bool parambufinuse;
+
+	/** Parameters passed to the handler by LoopCall(), reused like parambuf
+	 */
+	std::vector<std::string> loopbuf;
+
+	/** True if loopbuf is in use
+	 */
+	bool loopbufinuse;
+
+	/** Number of lines from local users processed by the parser, not counting commands
+	 * processed while handling another one
+	 */
+	unsigned long linecount;
+
+	/** Number of commands and LoopCall() calls during which parambuf or loopbuf, or one of
+	 * the strings in them, had to grow
+	 */
+	unsigned long paramgrowths;
+
  public:
 	/** Default constructor.
 	 */
@@ -53,6 +87,21 @@ class CoreExport CommandParser
 	 */
 	const CommandMap& GetCommands() const { return cmdlist; }
 
+	/** Get the number of lines processed by the parser
+	 * @return Number of lines received from local users and processed
+	 */
+	unsigned long GetLineCount() const { return linecount; }
+
+	/** Get the number of commands during which the reused parameter buffers of the parser had to
+	 * grow. The buffers are used for the commands of local users and for the per-target parameters
+	 * built by LoopCall(); a command counts once however many of its parameter strings grew.
+	 * Once the buffers are large enough for the commands clients send this stops increasing.
+	 * This is not a count of memory allocations: splitting the target list and checking it for
+	 * duplicates in LoopCall() and the command handlers themselves still allocate memory.
+	 * @return Number of commands and LoopCall() calls which grew a parameter buffer
+	 */
+	unsigned long GetParameterGrowths() const { return paramgrowths; }
+
 	/** Calls the handler for a given command.
 	 * @param commandname The command to find. This should be in uppercase.
 	 * @param parameters Parameter list
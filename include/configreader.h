@@ -353,6 +353,21 @@ class CoreExport ServerConfig
 	 */
 	bool CCOnConnect;
 
+	/** Number of threads in the pool of worker threads (see ThreadPool).
+	 * Changes take effect when the server is restarted.
+	 */
+	unsigned int WorkerThreads;
+
+	/** The maximum number of events the socket engine handles per call to
+	 * epoll_wait(), 0 for no limit other than the number of fds.
+	 */
+	unsigned int MaxEvents;
+
+	/** Size of the sendq of a socket without an IO hook from which it is written by a
+	 * worker thread instead of the main thread, 0 to always write on the main thread
+	 */
+	unsigned long OffloadSendQ;
+
 	/** The soft limit value assigned to the irc server.
 	 * The IRC server will not allow more than this
 	 * number of local users.
@@ -498,7 +513,8 @@ class CoreExport ServerConfig
 };
 
 /** The background thread for config reading, so that reading from executable includes
- * does not block.
+ * does not block. It has a thread of its own instead of using the ThreadPool so a slow
+ * read does not hold up other tasks.
  */
 class CoreExport ConfigReaderThread : public Thread
 {
@@ -516,7 +532,7 @@ class CoreExport ConfigReaderThread : public Thread
 		delete Config;
 	}
 
-	void Run();
+	void Run() CXX11_OVERRIDE;
 	/** Run in the main thread to apply the configuration */
 	void Finish();
 	bool IsDone() { return done; }
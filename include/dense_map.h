@@ -0,0 +1,226 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+namespace insp
+{
+
+/** Hashes pointers for dense_map. Objects are aligned so the lowest bits of a pointer
+ * carry little information, mix the higher bits into them.
+ */
+struct pointer_hash
+{
+	size_t operator()(const void* ptr) const
+	{
+		size_t h = reinterpret_cast<size_t>(ptr);
+		h ^= (h >> 16);
+		h *= 0x45d9f3b;
+		h ^= (h >> 16);
+		return h;
+	}
+};
+
+/** A map storing its elements without gaps in a vector, in no particular order,
+ * with an open addressed hash table of positions in the vector for lookups.
+ * Walking the elements is a sequential scan while insertion, lookup and erasure
+ * take constant time on average regardless of the number of elements.
+ * Inserting or erasing an element invalidates all iterators; erase() returns
+ * an iterator to the element that took the place of the erased one.
+ * @tparam Key Type of the keys
+ * @tparam T Type of the mapped values
+ * @tparam Hash Functor returning the hash of a key
+ */
+template <typename Key, typename T, typename Hash = pointer_hash>
+class dense_map
+{
+ public:
+	typedef Key key_type;
+	typedef T mapped_type;
+	typedef std::pair<Key, T> value_type;
+
+ private:
+	typedef std::vector<value_type> storage_type;
+
+	/** Elements of the map
+	 */
+	storage_type vect;
+
+	/** Hash table, each slot is either 0 if it is free or the position of an element in vect plus one.
+	 * The size of the table is always a power of two and at least twice the number of elements.
+	 */
+	std::vector<size_t> slots;
+
+	/** Minimum size of a non-empty hash table
+	 */
+	enum { MIN_SLOTS = 8 };
+
+	size_t GetHomeSlot(const key_type& x) const
+	{
+		return Hash()(x) & (slots.size() - 1);
+	}
+
+	/** Find the slot holding a key or the free slot where it would be inserted
+	 * @param x Key to look for, the hash table must not be empty
+	 * @return Slot index
+	 */
+	size_t FindSlot(const key_type& x) const
+	{
+		const size_t mask = slots.size() - 1;
+		size_t slot = GetHomeSlot(x);
+		while ((slots[slot]) && (!(vect[slots[slot] - 1].first == x)))
+			slot = (slot + 1) & mask;
+		return slot;
+	}
+
+	/** Rebuild the hash table with the given number of slots
+	 * @param n New size of the table, must be a power of two larger than the number of elements or 0 if the map is empty
+	 */
+	void Rehash(size_t n)
+	{
+		std::vector<size_t>(n).swap(slots);
+		for (size_t i = 0; i < vect.size(); ++i)
+			slots[FindSlot(vect[i].first)] = i + 1;
+	}
+
+	/** Free a slot by moving back the elements after it which would be unreachable otherwise
+	 * @param slot Slot to free
+	 */
+	void FreeSlot(size_t slot)
+	{
+		const size_t mask = slots.size() - 1;
+		size_t next = slot;
+		while (true)
+		{
+			next = (next + 1) & mask;
+			if (!slots[next])
+				break;
+
+			// The element in the next slot can fill the gap unless its home slot lies cyclically in (slot, next]
+			const size_t home = GetHomeSlot(vect[slots[next] - 1].first);
+			if (((next - home) & mask) >= ((next - slot) & mask))
+			{
+				slots[slot] = slots[next];
+				slot = next;
+			}
+		}
+		slots[slot] = 0;
+	}
+
+ public:
+	typedef typename storage_type::iterator iterator;
+	typedef typename storage_type::const_iterator const_iterator;
+	typedef typename storage_type::size_type size_type;
+
+	size_type size() const { return vect.size(); }
+	bool empty() const { return vect.empty(); }
+
+	iterator begin() { return vect.begin(); }
+	iterator end() { return vect.end(); }
+	const_iterator begin() const { return vect.begin(); }
+	const_iterator end() const { return vect.end(); }
+
+	void clear()
+	{
+		vect.clear();
+		slots.clear();
+	}
+
+	iterator find(const key_type& x)
+	{
+		if (vect.empty())
+			return vect.end();
+
+		const size_t slot = FindSlot(x);
+		return (slots[slot] ? vect.begin() + (slots[slot] - 1) : vect.end());
+	}
+
+	const_iterator find(const key_type& x) const
+	{
+		// Same as above but this time we return a const_iterator
+		if (vect.empty())
+			return vect.end();
+
+		const size_t slot = FindSlot(x);
+		return (slots[slot] ? vect.begin() + (slots[slot] - 1) : vect.end());
+	}
+
+	size_type count(const key_type& x) const
+	{
+		return (find(x) != vect.end());
+	}
+
+	std::pair<iterator, bool> insert(const value_type& x)
+	{
+		if ((vect.size() + 1) * 2 > slots.size())
+			Rehash(std::max<size_t>(slots.size() * 2, MIN_SLOTS));
+
+		const size_t slot = FindSlot(x.first);
+		if (slots[slot])
+			return std::make_pair(vect.begin() + (slots[slot] - 1), false);
+
+		vect.push_back(x);
+		slots[slot] = vect.size();
+		return std::make_pair(vect.end() - 1, true);
+	}
+
+	/** Erase an element
+	 * @param it Element to erase, must be valid
+	 * @return Iterator to the element which was moved to the place of the erased one,
+	 * or end() if the erased element was the last one
+	 */
+	iterator erase(iterator it)
+	{
+		const size_t pos = it - vect.begin();
+		FreeSlot(FindSlot(it->first));
+
+		// Fill the gap with the last element
+		if (pos != vect.size() - 1)
+		{
+			slots[FindSlot(vect.back().first)] = pos + 1;
+			*it = vect.back();
+		}
+		vect.pop_back();
+
+		// Don't keep a large table around after most elements are gone
+		if (vect.empty())
+			slots.clear();
+		else if ((slots.size() > MIN_SLOTS) && (vect.size() * 8 < slots.size()))
+			Rehash(std::max<size_t>(slots.size() / 4, MIN_SLOTS));
+
+		return vect.begin() + pos;
+	}
+
+	size_type erase(const key_type& x)
+	{
+		iterator it = find(x);
+		if (it == vect.end())
+			return 0;
+		erase(it);
+		return 1;
+	}
+
+	void swap(dense_map& other)
+	{
+		vect.swap(other.vect);
+		slots.swap(other.slots);
+	}
+};
+
+} // namespace insp
@@ -261,6 +261,43 @@ namespace irc
 		bool GetToken(long &token);
 	};
 
+	/** irc::linetokenizer splits a line into tokens following the same rules as
+	 * irc::tokenstream, but it reads the tokens directly from the line instead of
+	 * working on a copy of it and assigns them to the strings passed by the caller.
+	 * When the same strings are used to tokenize many lines, e.g. a parameter list
+	 * reused for every line read from a connection, their buffers are reused and
+	 * tokenizing does not allocate memory once they are large enough.
+	 * The line must not be modified or destroyed while the linetokenizer is in use.
+	 */
+	class CoreExport linetokenizer
+	{
+		/** The line being tokenized
+		 */
+		const std::string& line;
+
+		/** Position of the next token in the line
+		 */
+		std::string::size_type pos;
+
+	 public:
+		/** Create a linetokenizer for a line
+		 * @param source The line to tokenize, must outlive the linetokenizer
+		 */
+		linetokenizer(const std::string& source);
+
+		/** Fetch the next token from the line
+		 * @param token The next token available, or an empty string if none remain
+		 * @return True if a token was retrieved, false if there are no tokens left
+		 */
+		bool GetToken(std::string& token);
+
+		/** Fetch all remaining tokens from the line
+		 * @param tokens Vector to store the tokens in. It is resized to the number of tokens,
+		 * the strings already in it are overwritten.
+		 */
+		void GetTokens(std::vector<std::string>& tokens);
+	};
+
 	/** The portparser class seperates out a port range into integers.
 	 * A port range may be specified in the input string in the form
 	 * "6660,6661,6662-6669,7020". The end of the stream is indicated by
@@ -46,10 +46,12 @@
 
 #include "intrusive_list.h"
 #include "flat_map.h"
+#include "dense_map.h"
 #include "compat.h"
 #include "aligned_storage.h"
 #include "typedefs.h"
 #include "stdalgo.h"
+#include "mempool.h"
 
 CoreExport extern InspIRCd* ServerInstance;
 
@@ -165,6 +167,62 @@ class serverstats
 	}
 };
 
+/** A password check whose result is delivered later, see InspIRCd::PassCompare(PassCompareRequest*).
+ * Hashing a password with a slow algorithm such as bcrypt can take a long time so the check may
+ * be done on a worker thread. The user the check is for can be gone when the result arrives,
+ * so the request only stores identifiers (e.g. the UUID) and looks the objects up in OnResult().
+ */
+class CoreExport PassCompareRequest : public classbase
+{
+ public:
+	/** Module which receives the result, NULL for the core. The module is not unloaded
+	 * before the result of a check done on a worker thread has been delivered.
+	 */
+	Module* const creator;
+
+	/** UUID of the user the check is for
+	 */
+	const std::string uuid;
+
+	/** The password from the config file
+	 */
+	const std::string password;
+
+	/** The password entered by the user
+	 */
+	const std::string input;
+
+	/** The hash type from the config file
+	 */
+	const std::string hashtype;
+
+	/** Constructor
+	 * @param Creator The module which receives the result, NULL for the core
+	 * @param user The user the check is for
+	 * @param Password The password from the config file
+	 * @param Input The password entered by the user
+	 * @param HashType The hash type from the config file
+	 */
+	PassCompareRequest(Module* Creator, User* user, const std::string& Password, const std::string& Input, const std::string& HashType)
+		: creator(Creator), uuid(user->uuid), password(Password), input(Input), hashtype(HashType)
+	{
+	}
+
+	/** Called on the main thread when the result of the check is known
+	 * @param match True if the passwords match, false if they do not
+	 */
+	virtual void OnResult(bool match) = 0;
+
+	/** Deliver the result of the check and delete the request
+	 * @param match True if the passwords match, false if they do not
+	 */
+	void Deliver(bool match)
+	{
+		OnResult(match);
+		delete this;
+	}
+};
+
 DEFINE_HANDLER1(IsNickHandler, bool, const std::string&);
 DEFINE_HANDLER2(GenRandomHandler, void, char*, size_t);
 DEFINE_HANDLER1(IsIdentHandler, bool, const std::string&);
@@ -257,7 +315,7 @@ class CoreExport InspIRCd
 	 */
 	ThreadEngine Threads;
 
-	/** The thread/class used to read config files in REHASH and on startup
+	/** The thread/class used to read config files in REHASH, NULL if no rehash is running
 	 */
 	ConfigReaderThread* ConfigThread;
 
@@ -494,6 +552,13 @@ class CoreExport InspIRCd
 	 */
 	bool PassCompare(Extensible* ex, const std::string& data, const std::string& input, const std::string& hashtype);
 
+	/** Compare a password to a string from the config file without blocking the main loop
+	 * if the hash type is slow to compute. The result is delivered to the request, which may
+	 * happen before this method returns.
+	 * @param request The password check, ownership is taken
+	 */
+	void PassCompare(PassCompareRequest* request);
+
 	/** Returns the full version string of this ircd
 	 * @return The version string
 	 */
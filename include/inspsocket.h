@@ -26,6 +26,7 @@
 #include "timer.h"
 
 class IOHook;
+class IOHookMiddle;
 
 /**
  * States which a socket may be in
@@ -96,6 +97,22 @@ class CoreExport SocketTimeout : public Timer
 	virtual bool Tick(time_t now);
 };
 
+/** An immutable, reference counted buffer which can be queued on the send queue of any
+ * number of sockets at the same time while only being allocated and stored once.
+ */
+class CoreExport SharedBuffer : public refcountbase
+{
+ public:
+	/** The contents of the buffer
+	 */
+	const std::string data;
+
+	/** Create a new shared buffer
+	 * @param str Contents of the buffer
+	 */
+	SharedBuffer(const std::string& str) : data(str) { }
+};
+
 /**
  * StreamSocket is a class that wraps a TCP socket and handles send
  * and receive queues, including passing them to IO hooks
@@ -108,9 +125,60 @@ class CoreExport StreamSocket : public EventHandler
 	class SendQueue
 	{
 	 public:
-		/** One element of the queue, a continuous buffer
+		/** One element of the queue, a continuous buffer.
+		 * An element either owns its data or refers to a SharedBuffer; in the latter case
+		 * copying the element only copies the reference, not the data.
 		 */
-		typedef std::string Element;
+		class Element
+		{
+		 public:
+			typedef std::string::size_type size_type;
+
+			/** Create an element owning a copy of the given data
+			 * @param str Data to copy
+			 */
+			Element(const std::string& str) : owned(str), offset(0) { }
+
+			/** Create an element owning a copy of the given data
+			 * @param str Data to copy
+			 * @param len Length of the data
+			 */
+			Element(const char* str, size_type len) : owned(str, len), offset(0) { }
+
+			/** Create an element referring to a shared buffer
+			 * @param buf Buffer to refer to, must not be NULL
+			 */
+			Element(SharedBuffer* buf) : shared(buf), offset(0) { }
+
+			/** Get a pointer to the unsent data of the element
+			 * @return Pointer to the first byte of the unsent data
+			 */
+			const char* data() const { return (shared ? shared->data.data() : owned.data()) + offset; }
+
+			/** Get the length of the unsent data of the element
+			 * @return Length of the unsent data in bytes
+			 */
+			size_type length() const { return (shared ? shared->data.length() : owned.length()) - offset; }
+
+		 private:
+			/** Create an empty element, used by SendQueue to construct elements in place
+			 */
+			Element() : offset(0) { }
+
+			/** Data owned by this element, empty if the element refers to a shared buffer
+			 */
+			std::string owned;
+
+			/** Shared buffer this element refers to, or NULL if the element owns its data
+			 */
+			reference<SharedBuffer> shared;
+
+			/** Number of bytes at the beginning of the data that have been sent already
+			 */
+			size_type offset;
+
+			friend class SendQueue;
+		};
 
 		/** Sequence container of buffers in the queue
 		 */
@@ -168,7 +236,7 @@ class CoreExport StreamSocket : public EventHandler
 		void erase_front(Element::size_type n)
 		{
 			nbytes -= n;
-			data.front().erase(0, n);
+			data.front().offset += n;
 		}
 
 		/** Insert a new buffer at the beginning of the queue
@@ -180,6 +248,16 @@ class CoreExport StreamSocket : public EventHandler
 			nbytes += newdata.length();
 		}
 
+		/** Insert a new buffer at the beginning of the queue
+		 * @param newdata Data to copy into the new buffer
+		 */
+		void push_front(const std::string& newdata)
+		{
+			data.push_front(Element());
+			data.front().owned = newdata;
+			nbytes += newdata.length();
+		}
+
 		/** Insert a new buffer at the end of the queue
 		 * @param newdata Data to add
 		 */
@@ -189,6 +267,16 @@ class CoreExport StreamSocket : public EventHandler
 			nbytes += newdata.length();
 		}
 
+		/** Insert a new buffer at the end of the queue
+		 * @param newdata Data to copy into the new buffer
+		 */
+		void push_back(const std::string& newdata)
+		{
+			data.push_back(Element());
+			data.back().owned = newdata;
+			nbytes += newdata.length();
+		}
+
 		/** Clear the queue
 		 */
 		void clear()
@@ -204,8 +292,17 @@ class CoreExport StreamSocket : public EventHandler
 			other.clear();
 		}
 
+		/** Exchange the contents of this queue with another one without copying the buffers
+		 * @param other Queue to exchange the contents with
+		 */
+		void swap(SendQueue& other)
+		{
+			data.swap(other.data);
+			std::swap(nbytes, other.nbytes);
+		}
+
 	 private:
-	 	/** Private send queue. Note that individual strings may be shared.
+	 	/** Private send queue. Note that individual elements may refer to shared buffers.
 		 */
 		Container data;
 
@@ -222,6 +319,20 @@ class CoreExport StreamSocket : public EventHandler
 	 */
 	SendQueue sendq;
 
+	/** Writes the front of the sendq on a worker thread, defined in inspsocket.cpp
+	 */
+	class WriteTask;
+
+	/** The write in progress on a worker thread, or NULL. Data queued while it is
+	 * in progress stays in the sendq until the write has been finished.
+	 */
+	WriteTask* writetask;
+
+	/** Hand the sendq to a worker thread to be written if that is enabled and worth it
+	 * @return True if the write was started, false if the sendq should be written directly
+	 */
+	bool StartWriteTask();
+
 	/** Error - if nonempty, the socket is dead, and this is the reason. */
 	std::string error;
 
@@ -234,12 +345,6 @@ class CoreExport StreamSocket : public EventHandler
 	 */
 	void DoRead();
 
-	/** Send as much data contained in a SendQueue object as possible.
-	 * All data which successfully sent will be removed from the SendQueue.
-	 * @param sq SendQueue to flush
-	 */
-	void FlushSendQ(SendQueue& sq);
-
 	/** Read incoming data into a receive queue.
 	 * @param rq Receive queue to put incoming data into
 	 * @return < 0 on error or close, 0 if no new data is ready (but the socket is still connected), > 0 if data was read from the socket and put into the recvq
@@ -256,18 +361,42 @@ class CoreExport StreamSocket : public EventHandler
 	 */
 	int HookChainRead(IOHook* hook, std::string& rq);
 
+	/** Offset of the first byte in recvq that was not yet consumed by GetNextLine().
+	 * Consumed data is only removed from the recvq when more data is read from the
+	 * socket, so extracting lines is linear in the size of the data regardless of
+	 * how many lines arrive in a single read.
+	 */
+	std::string::size_type recvqpos;
+
  protected:
 	std::string recvq;
  public:
-	StreamSocket() : iohook(NULL) { }
+	StreamSocket() : iohook(NULL), writetask(NULL), recvqpos(0) { }
+	~StreamSocket();
 	IOHook* GetIOHook() const;
 	void AddIOHook(IOHook* hook);
+
+	/** Insert a hook at the front of the hook chain of a socket that is already in use.
+	 * Data in the sendq is sent without passing through the new hook. Data in the recvq
+	 * that was not yet consumed by GetNextLine() is passed to the new hook as if it was
+	 * just read from the socket.
+	 * @param hook Hook to insert
+	 */
+	void InsertIOHook(IOHookMiddle* hook);
 	void DelIOHook();
 
 	/** Flush the send queue
 	 */
 	void DoWrite();
 
+	/** Send as much data contained in a SendQueue object as possible.
+	 * All data which successfully sent will be removed from the SendQueue.
+	 * IOHooks whose data does not need to be transformed any more, e.g. because
+	 * the kernel encrypts it, can use this to write their sendq directly.
+	 * @param sq SendQueue to flush
+	 */
+	void FlushSendQ(SendQueue& sq);
+
 	/** Called by the socket engine on a read event
 	 */
 	void OnEventHandlerRead() CXX11_OVERRIDE;
@@ -295,12 +424,32 @@ class CoreExport StreamSocket : public EventHandler
 	/** Send the given data out the socket, either now or when writes unblock
 	 */
 	void WriteData(const std::string& data);
+
+	/** Queue a shared buffer to be sent out the socket without copying its contents,
+	 * either now or when writes unblock
+	 * @param data Buffer to send, must not be NULL
+	 */
+	void WriteData(SharedBuffer* data);
 	/** Convenience function: read a line from the socket
 	 * @param line The line read
 	 * @param delim The line delimiter
 	 * @return true if a line was read
 	 */
 	bool GetNextLine(std::string& line, char delim = '\n');
+
+	/** Read a line from the socket without copying it out of the recvq
+	 * @param data Set to the first character of the line. Only valid until more data is
+	 * read from the socket or the recvq is modified in any other way.
+	 * @param length Set to the length of the line, not including the delimiter
+	 * @param delim The line delimiter
+	 * @return true if a line was read
+	 */
+	bool GetNextLine(const char*& data, size_t& length, char delim = '\n');
+
+	/** Get the number of bytes in the recvq that were not yet consumed by GetNextLine()
+	 * @return Number of bytes waiting to be processed
+	 */
+	size_t GetRecvQSize() const { return recvq.size() - recvqpos; }
 	/** Useful for implementing sendq exceeded */
 	size_t getSendQSize() const;
 
@@ -29,7 +29,7 @@ uint64_t ConvToUInt64(const std::string& in);
  * All prefix modes a member has is tracked by this object. Moreover, Memberships are Extensibles
  * meaning modules can add arbitrary data to them using extensions (see m_delaymsg for an example).
  */
-class CoreExport Membership : public Extensible, public insp::intrusive_list_node<Membership>
+class CoreExport Membership : public Extensible, public insp::intrusive_list_node<Membership>, public insp::intrusive_list_node<Membership, Channel>
 {
  public:
 	/** Type of the Membership id
@@ -54,6 +54,17 @@ class CoreExport Membership : public Extensible, public insp::intrusive_list_nod
 	 */
 	Id id;
 
+	/** Value of Channel::banserial when banmatch was last computed. If it differs from the
+	 * current value of Channel::banserial the cached result is stale. Only the core should
+	 * read or write this field.
+	 */
+	unsigned int banserial;
+
+	/** Cached result of matching the user against the non-extban entries of the ban list
+	 * of the channel, see Channel::IsBanned(). Only valid if banserial is up to date.
+	 */
+	bool banmatch;
+
 	/** Converts a string to a Membership::Id
 	 * @param str The string to convert
 	 * @return Raw value of type Membership::Id
@@ -68,7 +79,12 @@ class CoreExport Membership : public Extensible, public insp::intrusive_list_nod
 	 * Call Channel::JoinUser() or ForceJoin() to make a user join a channel instead of constructing
 	 * Membership objects directly.
 	 */
-	Membership(User* u, Channel* c) : user(u), chan(c) {}
+	Membership(User* u, Channel* c) : user(u), chan(c), banserial(0), banmatch(false) {}
+
+	/** Membership objects are allocated from a memory pool
+	 */
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 
 	/** Check if this member has a given prefix mode set
 	 * @param pm Prefix mode to check
@@ -0,0 +1,210 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace insp
+{
+	class MemoryPool;
+}
+
+/** A pool of fixed size memory blocks used for objects that are created and
+ * destroyed often, such as users, channels and memberships.
+ * Blocks are carved out of large slabs and recycled through a free list per slab,
+ * so allocating and freeing them is cheap and objects of the same type are kept
+ * close to each other. New objects are placed in slabs that are already in use
+ * before empty ones, and slabs that become empty are returned to the system
+ * allocator once more than SLAB_RESERVE of them are left, so the memory used after
+ * a netsplit or a reconnect wave goes back down with the number of objects.
+ * Requests for any other size than the block size of the pool (e.g. for an
+ * instance of a derived class) are passed to the global operator new.
+ */
+class CoreExport insp::MemoryPool
+{
+	/** A block on the free list of a slab
+	 */
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	/** A slab and the bookkeeping of its blocks
+	 */
+	struct Slab
+	{
+		/** Memory of the blocks
+		 */
+		char* mem;
+
+		/** Free blocks of this slab
+		 */
+		FreeBlock* freelist;
+
+		/** Number of blocks of this slab in use
+		 */
+		size_t used;
+
+		/** Neighbours in the list of slabs with free blocks
+		 */
+		Slab* prev;
+		Slab* next;
+	};
+
+	/** Name of the pool, shown in /STATS z
+	 */
+	const char* const name;
+
+	/** Size of the objects in the pool
+	 */
+	const size_t objsize;
+
+	/** Size of a block, objsize rounded up to the required alignment
+	 */
+	const size_t blocksize;
+
+	/** Number of blocks in a slab
+	 */
+	const size_t slabblocks;
+
+	/** Slabs with both used and free blocks
+	 */
+	Slab* available;
+
+	/** Slabs with no blocks in use, at most SLAB_RESERVE of them
+	 */
+	std::vector<Slab*> emptyslabs;
+
+	/** All slabs allocated by the pool, sorted by address to find the slab of a block
+	 */
+	std::vector<Slab*> slabs;
+
+	/** Number of slabs returned to the system allocator since the pool was created
+	 */
+	unsigned long releases;
+
+	/** Number of blocks currently in use
+	 */
+	size_t inuse;
+
+	/** Highest value of inuse so far
+	 */
+	size_t peak;
+
+	/** Number of allocations served by the pool since it was created
+	 */
+	unsigned long allocations;
+
+	/** Allocate a new slab
+	 * @return The new slab, all of its blocks are free
+	 */
+	Slab* Grow();
+
+	/** Order slabs by the address of their memory
+	 */
+	static bool SlabLess(const Slab* a, const Slab* b);
+
+	/** Find the slab a block belongs to
+	 * @param ptr Block to find the slab of
+	 * @return Iterator to the slab in the slab list
+	 */
+	std::vector<Slab*>::iterator FindSlab(void* ptr);
+
+	/** Add a slab to the front of the list of slabs with free blocks
+	 * @param slab Slab to add
+	 */
+	void Link(Slab* slab);
+
+	/** Remove a slab from the list of slabs with free blocks
+	 * @param slab Slab to remove
+	 */
+	void Unlink(Slab* slab);
+
+ public:
+	/** The number of bytes in a slab
+	 */
+	static const size_t SLAB_SIZE = 64 * 1024;
+
+	/** The number of empty slabs kept for reuse instead of being returned to the system allocator
+	 */
+	static const size_t SLAB_RESERVE = 2;
+
+	/** Constructor
+	 * @param poolname Name of the pool, shown in /STATS z
+	 * @param size Size of the objects in the pool
+	 */
+	MemoryPool(const char* poolname, size_t size);
+
+	/** Destructor. Does not free the slabs as objects allocated from the pool
+	 * may outlive it during shutdown.
+	 */
+	~MemoryPool();
+
+	/** Allocate memory for an object
+	 * @param size Size of the object
+	 * @return Pointer to the allocated memory, never NULL
+	 */
+	void* Allocate(size_t size);
+
+	/** Free memory previously returned by Allocate()
+	 * @param ptr Pointer to the memory to free, can be NULL
+	 * @param size Size passed to Allocate() when the memory was allocated
+	 */
+	void Deallocate(void* ptr, size_t size);
+
+	/** Get the name of the pool
+	 * @return Name of the pool
+	 */
+	const char* GetName() const { return name; }
+
+	/** Get the size of a block in the pool
+	 * @return Block size in bytes
+	 */
+	size_t GetBlockSize() const { return blocksize; }
+
+	/** Get the number of blocks in use
+	 * @return Number of blocks in use
+	 */
+	size_t GetInUse() const { return inuse; }
+
+	/** Get the highest number of blocks that were in use at the same time
+	 * @return Peak number of blocks in use
+	 */
+	size_t GetPeak() const { return peak; }
+
+	/** Get the number of allocated slabs
+	 * @return Number of slabs
+	 */
+	size_t GetSlabCount() const { return slabs.size(); }
+
+	/** Get the number of slabs returned to the system allocator
+	 * @return Number of slabs released since the pool was created
+	 */
+	unsigned long GetReleases() const { return releases; }
+
+	/** Get the number of allocations served by the pool
+	 * @return Number of allocations since the pool was created
+	 */
+	unsigned long GetAllocations() const { return allocations; }
+
+	/** Get all memory pools
+	 * @return A list of all memory pools that exist
+	 */
+	static const std::vector<MemoryPool*>& GetPools();
+};
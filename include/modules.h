@@ -241,7 +241,7 @@ enum Implementation
 	I_OnChangeLocalUserGECOS, I_OnUserRegister, I_OnChannelPreDelete, I_OnChannelDelete,
 	I_OnPostOper, I_OnSyncNetwork, I_OnSetAway, I_OnPostCommand, I_OnPostJoin,
 	I_OnBuildNeighborList, I_OnGarbageCollect, I_OnSetConnectClass,
-	I_OnText, I_OnPassCompare, I_OnNamesListItem, I_OnNumeric,
+	I_OnText, I_OnPassCompare, I_OnPassCompareAsync, I_OnNamesListItem, I_OnNumeric,
 	I_OnPreRehash, I_OnModuleRehash, I_OnSendWhoLine, I_OnChangeIdent, I_OnSetUserIP,
 	I_END
 };
@@ -930,6 +930,14 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	virtual ModResult OnPassCompare(Extensible* ex, const std::string &password, const std::string &input, const std::string& hashtype);
 
+	/** Called when a password check is to be made without blocking the main loop, see InspIRCd::PassCompare(PassCompareRequest*).
+	 * Modules which can compute the hash in the background take the request and call PassCompareRequest::Deliver() once
+	 * the result is known. If no module takes the request it is checked synchronously using OnPassCompare.
+	 * @param request The password check
+	 * @return MOD_RES_ALLOW if the module took ownership of the request, MOD_RES_PASSTHRU otherwise
+	 */
+	virtual ModResult OnPassCompareAsync(PassCompareRequest* request);
+
 	/** Called after a user has fully connected and all modules have executed OnUserConnect
 	 * This event is informational only. You should not change any user information in this
 	 * event. To do so, use the OnUserConnect method to change the state of local users.
@@ -1051,6 +1059,11 @@ class CoreExport ModuleManager : public fakederef<ModuleManager>
 	 */
 	void UnregisterModes(Module* mod, ModeType modetype);
 
+	/** Discard the cached ban match results of all channels. Called when a module is
+	 * loaded or unloaded as the cached results include those of OnCheckBan handlers.
+	 */
+	void InvalidateBanCaches();
+
  public:
 	typedef std::map<std::string, Module*> ModuleMap;
 
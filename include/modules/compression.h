@@ -0,0 +1,67 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "iohook.h"
+
+namespace Compression
+{
+	class Provider;
+}
+
+/** Provides stream compression for sockets. The provider is registered as an IOHook
+ * named "compression/<method>". If it is used as the hook of a bind or link block then
+ * all data is compressed in both directions. Otherwise compression can be turned on
+ * separately for each direction of a connection that is already in use.
+ */
+class Compression::Provider : public IOHookProvider
+{
+ public:
+	/** Name of the compression method, e.g. "zlib"
+	 */
+	const std::string method;
+
+	/** Constructor
+	 * @param mod Module that owns the provider
+	 * @param Method Name of the compression method
+	 */
+	Provider(Module* mod, const std::string& Method)
+		: IOHookProvider(mod, "compression/" + Method, IOHookProvider::IOH_UNKNOWN, true)
+		, method(Method)
+	{
+	}
+
+	/** Compress all data written to a socket from now on.
+	 * Data already queued for sending is sent uncompressed.
+	 * @param sock Socket to compress the outgoing data of
+	 */
+	virtual void StartCompress(StreamSocket* sock) = 0;
+
+	/** Decompress all data read from a socket from now on, including the data
+	 * that was read but not yet consumed by GetNextLine().
+	 * @param sock Socket to decompress the incoming data of
+	 */
+	virtual void StartDecompress(StreamSocket* sock) = 0;
+
+	/** Get compression statistics of a socket
+	 * @param sock Socket to get the statistics of
+	 * @return Number of bytes before and after compression and the CPU time spent,
+	 * empty if the socket is not using this provider
+	 */
+	virtual std::string GetStats(StreamSocket* sock) = 0;
+};
@@ -69,4 +69,66 @@ class HashProvider : public DataProvider
 	{
 		return (!block_size);
 	}
+
+	/** Check whether computing a hash takes long enough that it should not be done on the main thread.
+	 * If this returns true Compare() must be thread safe.
+	 * @return True if the algorithm is deliberately slow (e.g. bcrypt), false otherwise
+	 */
+	virtual bool IsSlow() const
+	{
+		return false;
+	}
+
+	/** Compare a password to a hash without blocking the main loop. If the algorithm is slow the
+	 * comparison is done on a worker thread, otherwise the result is delivered before this returns.
+	 * @param input The password entered by the user
+	 * @param hash The hash from the config file
+	 * @param request The request to deliver the result to
+	 */
+	void CompareAsync(const std::string& input, const std::string& hash, PassCompareRequest* request);
+};
+
+/** Compares a password to a hash on a worker thread
+ */
+class HashCompareTask : public ThreadPool::Task
+{
+	HashProvider* const provider;
+	const std::string input;
+	const std::string hash;
+	PassCompareRequest* const request;
+	bool match;
+
+ public:
+	HashCompareTask(HashProvider* Provider, const std::string& Input, const std::string& Hash, PassCompareRequest* Request)
+		: ThreadPool::Task(Provider->creator), provider(Provider), input(Input), hash(Hash), request(Request), match(false)
+	{
+	}
+
+	bool UsesModule(Module* mod) const CXX11_OVERRIDE
+	{
+		// Finish() runs the code of the module which made the request
+		return ((creator == mod) || (request->creator == mod));
+	}
+
+	void Run() CXX11_OVERRIDE
+	{
+		match = provider->Compare(input, hash);
+	}
+
+	void Finish() CXX11_OVERRIDE
+	{
+		request->Deliver(match);
+	}
 };
+
+inline void HashProvider::CompareAsync(const std::string& input, const std::string& hash, PassCompareRequest* request)
+{
+	if (!IsSlow())
+	{
+		request->Deliver(Compare(input, hash));
+		return;
+	}
+
+	// Modules are only unloaded after their tasks were finished so the provider outlives the task
+	ServerInstance->Threads.GetPool().Submit(new HashCompareTask(this, input, hash, request));
+}
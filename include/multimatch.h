@@ -0,0 +1,153 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace insp
+{
+	class MultiMatcher;
+}
+
+/** Finds which strings of a set occur in a text with a single pass over the text,
+ * no matter how many strings the set has (Aho-Corasick).
+ * Strings are compared case insensitively using national_case_insensitive_map.
+ * Every string is added with an id chosen by the caller, Find() returns the ids of
+ * all strings that were found. The automaton is built on the first Find() after
+ * the set was changed, so adding or removing many strings in a row is cheap.
+ */
+class CoreExport insp::MultiMatcher
+{
+ public:
+	typedef std::vector<size_t> IdList;
+
+ private:
+	/** An edge of the automaton
+	 */
+	struct Edge
+	{
+		unsigned char chr;
+		unsigned int target;
+
+		bool operator<(const Edge& other) const { return chr < other.chr; }
+	};
+
+	/** A state of the automaton
+	 */
+	struct State
+	{
+		/** Edges of this state are edges[firstedge] to edges[lastedge - 1], sorted by chr
+		 */
+		unsigned int firstedge;
+		unsigned int lastedge;
+
+		/** State reached by the longest proper suffix of this state that is also a state
+		 */
+		unsigned int fail;
+
+		/** Nearest state on the fail chain that ends a string, 0 if none
+		 */
+		unsigned int output;
+
+		/** Ids of the strings ending in this state are ids[firstid] to ids[lastid - 1]
+		 */
+		unsigned int firstid;
+		unsigned int lastid;
+	};
+
+	/** Strings in the set and their ids
+	 */
+	std::vector<std::pair<std::string, size_t> > strings;
+
+	std::vector<State> states;
+	std::vector<Edge> edges;
+	std::vector<size_t> ids;
+
+	/** Transitions of the root state for every character
+	 */
+	unsigned int roottable[256];
+
+	/** Case map the automaton was built with
+	 */
+	const unsigned char* casemap;
+
+	/** Number of the current Find() call, used to report every string at most once
+	 */
+	unsigned int generation;
+
+	/** Value of generation when the output of a state was last reported
+	 */
+	std::vector<unsigned int> reported;
+
+	/** True if the set changed since the automaton was built
+	 */
+	bool dirty;
+
+	/** Build the automaton from the strings
+	 */
+	void Compile();
+
+	/** Find the state reached from a state other than the root through an edge
+	 * @param state State to start from
+	 * @param chr Folded character
+	 * @return Target of the edge, 0 if there is no such edge
+	 */
+	unsigned int GetEdge(unsigned int state, unsigned char chr) const;
+
+ public:
+	MultiMatcher();
+
+	/** Add a string to the set
+	 * @param str String to add, empty strings are ignored
+	 * @param id Id returned by Find() if the string occurs in a text. Several strings may have the same id.
+	 */
+	void Add(const std::string& str, size_t id);
+
+	/** Remove all strings from the set
+	 */
+	void Clear();
+
+	/** Check whether the set has no strings
+	 * @return True if the set is empty
+	 */
+	bool empty() const { return strings.empty(); }
+
+	/** Find all strings of the set which occur in a text
+	 * @param text Text to search
+	 * @param result Ids of the strings found are appended to this in ascending order, every id at most once
+	 * @return True if at least one string was found
+	 */
+	bool Find(const std::string& text, IdList& result);
+
+	/** Get a string that is part of every text a glob pattern (as used by InspIRCd::Match()) matches
+	 * @param mask Glob pattern
+	 * @return The longest run of characters between two wildcards
+	 */
+	static std::string GetGlobLiteral(const std::string& mask);
+
+	/** Get a string that is part of every text a regular expression matches.
+	 * The parser only knows the syntax shared by the regex engines, anything it does
+	 * not understand ends the current run of literal characters, so it errs on the side of
+	 * returning a shorter or empty string.
+	 * @param pattern Regular expression
+	 * @return The longest run of literal characters every match must contain, or an
+	 * empty string if there is none (e.g. because of an alternation at the top level)
+	 */
+	static std::string GetRegexLiteral(const std::string& pattern);
+};
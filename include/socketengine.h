@@ -232,7 +232,11 @@ class CoreExport SocketEngine
 		/** Constructor, initializes member vars except indata and outdata because those are set to 0
 		 * in CheckFlush() the first time Update() or GetBandwidth() is called.
 		 */
-		Statistics() : lastempty(0), TotalEvents(0), ReadEvents(0), WriteEvents(0), ErrorEvents(0) { }
+		Statistics() : lastempty(0), TotalEvents(0), ReadEvents(0), WriteEvents(0), ErrorEvents(0)
+		{
+			for (size_t i = 0; i < HistogramSize; i++)
+				EventCountHistogram[i] = 0;
+		}
 
 		/** Update counters for network data received.
 		 * This should be called after every read-type syscall.
@@ -248,6 +252,12 @@ class CoreExport SocketEngine
 		 */
 		void UpdateWriteCounters(int len_out);
 
+		/** Update the event count histogram.
+		 * This should be called after every wait for events by the socket engine.
+		 * @param count Number of events returned by the wait, negative on error.
+		 */
+		void UpdateDispatchCounters(int count);
+
 		/** Get data transfer statistics.
 		 * @param kbitpersec_in Filled with incoming traffic in this second in kbit/s.
 		 * @param kbitpersec_out Filled with outgoing traffic in this second in kbit/s.
@@ -259,6 +269,15 @@ class CoreExport SocketEngine
 		unsigned long ReadEvents;
 		unsigned long WriteEvents;
 		unsigned long ErrorEvents;
+
+		/** Number of buckets in EventCountHistogram */
+		static const size_t HistogramSize = 12;
+
+		/** Number of waits for events grouped by the number of events they returned.
+		 * Bucket 0 counts waits that returned no events, bucket n counts waits that
+		 * returned 2^(n-1) to 2^n - 1 events; the last bucket also counts everything above that.
+		 */
+		unsigned long EventCountHistogram[HistogramSize];
 	};
 
  private:
@@ -288,6 +307,12 @@ class CoreExport SocketEngine
 
 	static void OnSetEvent(EventHandler* eh, int old_mask, int new_mask);
 
+	/** Get the number of milliseconds the socket engine may wait for events.
+	 * @return 0 if there are trial reads or writes pending, otherwise the time until
+	 * the start of the next second when timers are due to be checked.
+	 */
+	static int GetDispatchTimeout();
+
 	/** Add an event handler to the base socket engine. AddFd(EventHandler*, int) should call this.
 	 */
 	static bool AddFdRef(EventHandler* eh);
@@ -556,6 +581,12 @@ public:
 	 */
 	static const Statistics& GetStats() { return stats; }
 
+	/** Count data which was written to a socket without calling the socket engine,
+	 * e.g. by a worker thread. Must be called on the main thread.
+	 * @param len_out Number of bytes written
+	 */
+	static void AddWrittenBytes(int len_out) { stats.UpdateWriteCounters(len_out); }
+
 	/** Should we ignore the error in errno?
 	 * Checks EAGAIN and WSAEWOULDBLOCK
 	 */
@@ -31,6 +31,12 @@ class TestSuite
 	bool DoCommaSepStreamTests();
 	bool DoSpaceSepStreamTests();
 	bool DoGenerateUIDTests();
+	bool DoTimerTests();
+	bool DoXLineTests();
+	bool DoMemberListTests();
+	bool DoLineTokenizerTests();
+	bool DoMultiMatchTests();
+	bool DoBenchmarks();
 };
 
 #endif
@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <deque>
 #include <vector>
 #include <string>
 #include <map>
@@ -60,6 +61,8 @@ class CoreExport Thread
 	{
 	}
 
+	virtual ~Thread() { }
+
 	/** Override this method to put your actual
 	 * threaded code here.
 	 */
@@ -171,3 +174,118 @@ class CoreExport SocketThread : public Thread
 	 */
 	virtual void OnNotify() = 0;
 };
+
+/** A fixed number of worker threads which run short tasks for the main thread, such as hashing
+ * a password. When a worker has run a task the main thread is woken up through the notification
+ * socket of the SocketThread and finishes the task, so the core and modules can offload work
+ * without starting and polling a thread of their own.
+ * Get the pool with ThreadEngine::GetPool(), the number of workers is set by \<performance:workerthreads>.
+ * Work which may take long, such as reading the config, should have a thread of its own instead
+ * of tying up a worker.
+ */
+class CoreExport ThreadPool : public SocketThread
+{
+ public:
+	/** A unit of work for the pool
+	 */
+	class CoreExport Task
+	{
+	 public:
+		/** Module whose code is run by the task, NULL for the core. The module is not
+		 * unloaded before all of its tasks have been run and finished.
+		 */
+		Module* const creator;
+
+		Task(Module* Creator) : creator(Creator) { }
+		virtual ~Task() { }
+
+		/** Check whether the task runs code or uses objects of a module. Override this if
+		 * the task calls into modules other than its creator, e.g. to deliver its result.
+		 * @param mod Module to check
+		 * @return True if the module must not be unloaded before the task has been finished
+		 */
+		virtual bool UsesModule(Module* mod) const
+		{
+			return (creator == mod);
+		}
+
+		/** Do the work. Called on a worker thread, so it must only use data owned
+		 * by the task and code which is thread safe.
+		 */
+		virtual void Run() = 0;
+
+		/** Called on the main thread after Run() has returned. The task is deleted afterwards.
+		 */
+		virtual void Finish() = 0;
+	};
+
+ private:
+	/** A worker thread other than the thread of the pool itself
+	 */
+	class Worker : public Thread
+	{
+		ThreadPool* const pool;
+
+	 public:
+		Worker(ThreadPool* Pool) : pool(Pool) { }
+		void Run() CXX11_OVERRIDE { pool->Work(); }
+	};
+
+	/** Workers started in addition to the thread of the pool
+	 */
+	std::vector<Worker*> workers;
+
+	/** Tasks not yet picked up by a worker, protected by the queue lock
+	 */
+	std::deque<Task*> pending;
+
+	/** Tasks which were run but not yet finished, protected by the queue lock
+	 */
+	std::vector<Task*> done;
+
+	/** Tasks being run by workers, protected by the queue lock
+	 */
+	std::vector<Task*> running;
+
+	/** Signalled by a worker after it has run a task, used by Flush() to wait for the workers
+	 */
+	ThreadQueueData finished;
+
+	/** Run tasks until the pool is stopped
+	 */
+	void Work();
+
+	/** Check whether a module is used by tasks which are queued or being run.
+	 * You MUST hold the queue lock when you call this.
+	 * @param mod Module to check
+	 * @return True if a task using the module was not run yet
+	 */
+	bool HasTasks(Module* mod) const;
+
+ public:
+	ThreadPool();
+
+	/** Start the worker threads
+	 * @param threadcount Number of worker threads to start, at least 1
+	 */
+	void Start(unsigned int threadcount);
+
+	/** Stop the worker threads. Tasks which were not finished yet are deleted without
+	 * being finished, the task being run by a worker is waited for.
+	 */
+	void Stop();
+
+	/** Add a task to the queue of the pool. The pool takes ownership of the task.
+	 * @param task Task to run
+	 */
+	void Submit(Task* task);
+
+	/** Wait until all tasks using a module have been run and finish them.
+	 * Other tasks are left alone.
+	 * @param mod Module whose tasks to wait for
+	 */
+	void Flush(Module* mod);
+
+	void Run() CXX11_OVERRIDE;
+	void OnNotify() CXX11_OVERRIDE;
+};
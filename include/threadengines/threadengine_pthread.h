@@ -23,6 +23,8 @@
 #include <pthread.h>
 #include "typedefs.h"
 
+class ThreadPool;
+
 /** The ThreadEngine class has the responsibility of initialising
  * Thread derived classes. It does this by creating operating system
  * level threads which are then associated with the class transparently.
@@ -35,7 +37,13 @@
  */
 class CoreExport ThreadEngine
 {
+	/** Pool of worker threads for short tasks, NULL until the first task is submitted
+	 */
+	ThreadPool* pool;
+
  public:
+	ThreadEngine() : pool(NULL) { }
+
 	/** Per-thread state, present in each Thread object, managed by the ThreadEngine
 	 */
 	struct ThreadState
@@ -62,6 +70,21 @@ class CoreExport ThreadEngine
 	 * @param thread The thread to stop.
 	 */
 	void Stop(Thread* thread);
+
+	/** Get the pool of worker threads, starting it if it is not running yet.
+	 * @return The pool of worker threads
+	 */
+	ThreadPool& GetPool();
+
+	/** Wait until all tasks using a module submitted to the pool of worker threads have been run
+	 * and finish them. Does nothing if the pool was never started.
+	 * @param mod Module whose tasks to wait for
+	 */
+	void FlushPool(Module* mod);
+
+	/** Stop the pool of worker threads, deleting the tasks which were not finished yet.
+	 */
+	void StopPool();
 };
 
 /** The Mutex class represents a mutex, which can be used to keep threads
@@ -24,6 +24,7 @@
 #include "base.h"
 
 class Thread;
+class ThreadPool;
 
 /** The ThreadEngine class has the responsibility of initialising
  * Thread derived classes. It does this by creating operating system
@@ -37,7 +38,13 @@ class Thread;
  */
 class CoreExport ThreadEngine
 {
+	/** Pool of worker threads for short tasks, NULL until the first task is submitted
+	 */
+	ThreadPool* pool;
+
  public:
+	ThreadEngine() : pool(NULL) { }
+
 	/** Per-thread state, present in each Thread object, managed by the ThreadEngine
 	 */
 	struct ThreadState
@@ -66,6 +73,21 @@ class CoreExport ThreadEngine
 	 * @param thread The thread to stop.
 	 */
 	void Stop(Thread* thread);
+
+	/** Get the pool of worker threads, starting it if it is not running yet.
+	 * @return The pool of worker threads
+	 */
+	ThreadPool& GetPool();
+
+	/** Wait until all tasks using a module submitted to the pool of worker threads have been run
+	 * and finish them. Does nothing if the pool was never started.
+	 * @param mod Module whose tasks to wait for
+	 */
+	void FlushPool(Module* mod);
+
+	/** Stop the pool of worker threads, deleting the tasks which were not finished yet.
+	 */
+	void StopPool();
 };
 
 /** The Mutex class represents a mutex, which can be used to keep threads
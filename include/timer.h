@@ -33,12 +33,17 @@ class Module;
  * your object (which you have to override) will be called
  * at the given time.
  */
-class CoreExport Timer
+class CoreExport Timer : public insp::intrusive_list_node<Timer>
 {
 	/** The triggering time
 	 */
 	time_t trigger;
 
+	/** The timing wheel slot this timer is scheduled in or NULL if it is not scheduled.
+	 * Managed by TimerManager.
+	 */
+	insp::intrusive_list_tail<Timer>* slot;
+
 	/** Number of seconds between triggers
 	 */
 	unsigned int secs;
@@ -109,21 +114,74 @@ class CoreExport Timer
 	{
 		repeat = false;
 	}
+
+	friend class TimerManager;
 };
 
 /** This class manages sets of Timers, and triggers them at their defined times.
  * This will ensure timers are not missed, as well as removing timers that have
  * expired and allowing the addition of new ones.
+ *
+ * Timers are kept in a hierarchical timing wheel: level 0 has one slot for each of the
+ * next WHEEL_SIZE seconds, every further level has slots covering WHEEL_SIZE times as
+ * many seconds as the slots of the previous level. When the wheel reaches the start of a
+ * slot on a higher level, the timers in that slot are redistributed into lower levels.
+ * Adding and removing a timer is O(1), no matter how many timers are pending.
  */
 class CoreExport TimerManager
 {
-	typedef std::multimap<time_t, Timer*> TimerMap;
+	/** Number of bits of the trigger time used to index the slots of one level
+	 */
+	static const unsigned int WHEEL_BITS = 6;
+
+	/** Number of slots on one level of the wheel
+	 */
+	static const unsigned int WHEEL_SIZE = 1 << WHEEL_BITS;
 
-	/** A list of all pending timers
+	/** Number of levels in the wheel, timers further in the future than what the
+	 * wheel can hold are kept in the overflow list
 	 */
-	TimerMap Timers;
+	static const unsigned int WHEEL_LEVELS = 4;
+
+	typedef insp::intrusive_list_tail<Timer> TimerList;
+
+	/** Slots of the wheel, indexed by level then by slot number
+	 */
+	TimerList wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+	/** Timers that are too far in the future to be put in the wheel
+	 */
+	TimerList overflow;
+
+	/** The time up to which all due timers have been ticked
+	 */
+	time_t current;
+
+	/** Put a timer into the slot that corresponds to the given time
+	 * @param t Timer to schedule
+	 * @param when Time at which the timer should tick, must not be less than current
+	 */
+	void Schedule(Timer* t, time_t when);
+
+	/** Remove all timers from a slot and schedule them again relative to the current time
+	 * @param list Slot to redistribute
+	 */
+	void Cascade(TimerList& list);
+
+	/** Reschedule every pending timer relative to a new time, used when the clock
+	 * jumped too far for the wheel to be advanced one second at a time
+	 * @param TIME the current system time
+	 */
+	void Rebase(time_t TIME);
+
+	/** Tick all timers in the level 0 slot of the current time
+	 * @param TIME the current system time
+	 */
+	void Expire(time_t TIME);
 
  public:
+	TimerManager();
+
 	/** Tick all pending Timers
 	 * @param TIME the current system time
 	 */
@@ -36,6 +36,7 @@ class LocalUser;
 class Membership;
 class Module;
 class OperInfo;
+class PassCompareRequest;
 class ProtocolServer;
 class RemoteUser;
 class Server;
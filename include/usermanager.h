@@ -87,11 +87,6 @@ class CoreExport UserManager : public fakederef<UserManager>
 	 */
 	unsigned int unregistered_count;
 
-	/** Perform background user events for all local users such as PING checks, registration timeouts,
-	 * penalty management and recvq processing for users who have data in their recvq due to throttling.
-	 */
-	void DoBackgroundUserStuff();
-
 	/** Returns true when all modules have done pre-registration checks on a user
 	 * @param user The user to verify
 	 * @return True if all modules have finished checking this user
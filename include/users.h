@@ -404,6 +404,7 @@ class CoreExport User : public Extensible
 
 	/** This clears any cached results that are used for GetFullRealHost() etc.
 	 * The results of these calls are cached as generating them can be generally expensive.
+	 * The cached ban match results of the user on all channels are discarded as well.
 	 */
 	void InvalidateCache();
 
@@ -732,6 +733,13 @@ class CoreExport User : public Extensible
 
 class CoreExport UserIOHandler : public StreamSocket
 {
+	/** Check whether data of the given length can be added to the write buffer.
+	 * If adding the data would exceed the sendq of the user, the user is removed.
+	 * @param len Length of the data to add
+	 * @return True if the data may be added, false if it must be dropped
+	 */
+	bool CheckSendQ(size_t len);
+
  public:
 	LocalUser* const user;
 	UserIOHandler(LocalUser* me) : user(me) {}
@@ -744,16 +752,56 @@ class CoreExport UserIOHandler : public StreamSocket
 	 * @param data The data to add to the write buffer
 	 */
 	void AddWriteBuf(const std::string &data);
+
+	/** Adds a shared buffer to the user's write buffer without copying its contents.
+	 * The same sendq limits apply as for AddWriteBuf(const std::string&).
+	 * @param data The buffer to add to the write buffer
+	 */
+	void AddWriteBuf(SharedBuffer* data);
 };
 
 typedef unsigned int already_sent_t;
 
+/** Performs the time based checks of a local user: registration and ping timeouts, and
+ * resuming the processing of commands held back by fake lag or a full sendq.
+ * The timer is only scheduled for when the next check is due, so idle users are not
+ * visited every second.
+ */
+class CoreExport LocalUserTimer : public Timer
+{
+	/** User the timer is checking
+	 */
+	LocalUser* const user;
+
+ public:
+	/** Construct the timer. This doesn't schedule the timer.
+	 * @param me User to check
+	 */
+	LocalUserTimer(LocalUser* me);
+
+	/** Called by the TimerManager when the next check of the user is due
+	 * @param currtime Time now
+	 * @return Always false, we reschedule ourselves instead
+	 */
+	bool Tick(time_t currtime) CXX11_OVERRIDE;
+
+	/** Make sure the timer ticks no later than the given time
+	 * @param when Time at which the user should be checked at the latest
+	 */
+	void Wakeup(time_t when);
+};
+
 class CoreExport LocalUser : public User, public insp::intrusive_list_node<LocalUser>
 {
  public:
 	LocalUser(int fd, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server);
 	CullResult cull() CXX11_OVERRIDE;
 
+	/** LocalUser objects are allocated from a memory pool
+	 */
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
+
 	UserIOHandler eh;
 
 	/** Stats counter for bytes inbound
@@ -782,6 +830,35 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 	 */
 	reference<ConnectClass> MyClass;
 
+	/** Result of comparing the password of the user to the password of a connect class
+	 */
+	struct ClassPassword
+	{
+		/** The password and hash type from the connect class
+		 */
+		std::string password;
+		std::string hashtype;
+
+		/** The password of the user that was checked
+		 */
+		std::string input;
+
+		/** 1 if the passwords match, 0 if they do not, -1 while the check is still running
+		 */
+		int result;
+	};
+
+	/** Connect class passwords checked while the user is registering, so SetClass() doesn't
+	 * have to hash the password again when it is called after the result has arrived.
+	 */
+	std::vector<ClassPassword> classpasswords;
+
+	/** Check the password of the user against the password of a connect class
+	 * @param c Connect class requiring a password
+	 * @return 1 if the passwords match, 0 if they do not, -1 if the result is not known yet
+	 */
+	int CheckClassPassword(ConnectClass* c);
+
 	/** Get the connect class which this user belongs to.
 	 * @return A pointer to this user's connect class.
 	 */
@@ -814,6 +891,10 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 	 */
 	unsigned int exempt:1;
 
+	/** True if the last SetClass() could not choose a class because a password check is still running
+	 */
+	unsigned int classpending:1;
+
 	/** Used by PING checking code
 	 */
 	time_t nping;
@@ -827,6 +908,15 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 	 */
 	unsigned int CommandFloodPenalty;
 
+	/** Time at which the decay of CommandFloodPenalty was last applied.
+	 * The penalty is decayed when the user sends data instead of once every second.
+	 */
+	time_t lastpenaltydecay;
+
+	/** Timer performing the registration timeout, ping and fake lag checks of this user
+	 */
+	LocalUserTimer usertimer;
+
 	already_sent_t already_sent;
 
 	/** Check if the user matches a G or K line, and disconnect them if they do.
@@ -853,6 +943,19 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 	void Write(const std::string& text) CXX11_OVERRIDE;
 	void Write(const char*, ...) CXX11_OVERRIDE CUSTOM_PRINTF(2, 3);
 
+	/** Prepare a line for being sent to many local users with WriteShared().
+	 * The text is cropped to the maximum line length and CR/LF is appended, the
+	 * resulting buffer is only allocated once no matter how many users it is sent to.
+	 * @param text Text to prepare
+	 * @return Buffer containing the line, ready to be passed to WriteShared()
+	 */
+	static reference<SharedBuffer> PrepareSharedLine(const std::string& text);
+
+	/** Write a line prepared by PrepareSharedLine() to this user without copying it.
+	 * @param line Line to send
+	 */
+	void WriteShared(SharedBuffer* line);
+
 	/** Send a NOTICE message from the local server to the user.
 	 * The message will be sent even if the user is connected to a remote server.
 	 * @param text Text to send
@@ -892,12 +995,17 @@ class CoreExport LocalUser : public User, public insp::intrusive_list_node<Local
 	void OverruleNick();
 };
 
-class RemoteUser : public User
+class CoreExport RemoteUser : public User
 {
  public:
 	RemoteUser(const std::string& uid, Server* srv) : User(uid, srv, USERTYPE_REMOTE)
 	{
 	}
+
+	/** RemoteUser objects are allocated from a memory pool
+	 */
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr, size_t size);
 };
 
 class CoreExport FakeUser : public User
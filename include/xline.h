@@ -115,6 +115,16 @@ class CoreExport XLine : public classbase
 	 */
 	virtual void OnAdd() { }
 
+	/** Returns the mask this line matches the real host and IP address of users
+	 * against, used by the XLineManager to index lines of this type. A line that
+	 * returns a mask must never match a user unless the mask contains wildcards,
+	 * is a CIDR range the IP of the user is in or is equal to the real host or IP
+	 * of the user. The default implementation returns NULL, meaning the line has
+	 * to be checked against every user.
+	 * @return The host or IP mask of the line or NULL if there is no such mask
+	 */
+	virtual const std::string* GetIndexMask() { return NULL; }
+
 	/** The time the line was added.
 	 */
 	time_t set_time;
@@ -178,6 +188,8 @@ class CoreExport KLine : public XLine
 
 	virtual const std::string& Displayable();
 
+	virtual const std::string* GetIndexMask() { return &hostmask; }
+
 	virtual bool IsBurstable();
 
 	/** Ident mask (ident part only)
@@ -224,6 +236,8 @@ class CoreExport GLine : public XLine
 
 	virtual const std::string& Displayable();
 
+	virtual const std::string* GetIndexMask() { return &hostmask; }
+
 	/** Ident mask (ident part only)
 	 */
 	std::string identmask;
@@ -268,6 +282,8 @@ class CoreExport ELine : public XLine
 
 	virtual const std::string& Displayable();
 
+	virtual const std::string* GetIndexMask() { return &hostmask; }
+
 	/** Ident mask (ident part only)
 	 */
 	std::string identmask;
@@ -309,6 +325,8 @@ class CoreExport ZLine : public XLine
 
 	virtual const std::string& Displayable();
 
+	virtual const std::string* GetIndexMask() { return &ipaddr; }
+
 	/** IP mask (no ident part)
 	 */
 	std::string ipaddr;
@@ -391,6 +409,129 @@ class CoreExport XLineFactory
 	virtual ~XLineFactory() { }
 };
 
+/** Lookup index for the lines of one type, see XLine::GetIndexMask().
+ * Lines with a CIDR mask are kept in a hash per prefix length, lines with a
+ * mask that has no wildcards are kept in a hash keyed by the mask and all other
+ * lines are kept in a list which is always checked in its entirety.
+ */
+class CoreExport XLineIndex
+{
+	/** Hashes a CIDR mask, for use in the CIDR map
+	 */
+	struct CIDRHash
+	{
+		size_t operator()(const irc::sockets::cidr_mask& mask) const;
+	};
+
+	typedef TR1NS::unordered_multimap<irc::sockets::cidr_mask, XLine*, CIDRHash> CIDRMap;
+	typedef TR1NS::unordered_multimap<std::string, XLine*, irc::insensitive, irc::StrHashComp> ExactMap;
+
+	/** Lines with a CIDR mask, keyed by the mask
+	 */
+	CIDRMap cidrs;
+
+	/** Number of lines in cidrs for each IPv4 and IPv6 prefix length, so lookups only
+	 * have to try prefix lengths that are actually in use
+	 */
+	unsigned int cidrlengths[2][129];
+
+	/** Lines with a mask that has no wildcards, keyed by the mask
+	 */
+	ExactMap exact;
+
+	/** Lines with a wildcard mask and lines without an index mask
+	 */
+	std::vector<XLine*> unindexed;
+
+	/** Add all lines with a CIDR mask matching an address to a list
+	 * @param sa The address to look up
+	 * @param out The list to add the lines to
+	 */
+	void FindCIDR(const irc::sockets::sockaddrs& sa, std::vector<XLine*>& out);
+
+ public:
+	XLineIndex();
+
+	/** Parse the mask of a line as a CIDR range if it would be matched as one by InspIRCd::MatchCIDR()
+	 * @param mask The mask to parse
+	 * @param out The parsed range, if any
+	 * @return True if the mask is a valid IPv4 or IPv6 CIDR range
+	 */
+	static bool ParseCIDR(const std::string& mask, irc::sockets::cidr_mask& out);
+
+	/** Add a line to the index
+	 * @param line The line to add
+	 */
+	void Add(XLine* line);
+
+	/** Remove a line from the index
+	 * @param line The line to remove
+	 */
+	void Remove(XLine* line);
+
+	/** Find all lines that may match a user. Every line that matches the user is in the
+	 * result but the result may also contain lines that do not match.
+	 * @param user The user to find candidate lines for
+	 * @param out The list to add the lines to, may contain duplicates
+	 */
+	void Find(User* user, std::vector<XLine*>& out);
+};
+
+/** Local users indexed by IP address and real host, used by XLineManager::ApplyLines() to
+ * find the users a line with an index mask can apply to. Users are added when they connect,
+ * removed when they quit and indexed again when their IP address or real host changes.
+ */
+class CoreExport XLineUserIndex
+{
+	typedef std::multimap<irc::sockets::cidr_mask, LocalUser*> AddrMap;
+	typedef std::multimap<std::string, LocalUser*, irc::insensitive_swo> HostMap;
+
+	/** The entries of one user, so they can be removed after the IP address or host changed
+	 */
+	struct Entry
+	{
+		std::vector<AddrMap::iterator> addrs;
+		std::vector<HostMap::iterator> hosts;
+	};
+
+	/** Users keyed by IP address and, if the real host is an address, by the real host
+	 */
+	AddrMap addrs;
+
+	/** Users keyed by real host and IP address
+	 */
+	HostMap hosts;
+
+	/** Entries of all indexed users
+	 */
+	TR1NS::unordered_map<LocalUser*, Entry> entries;
+
+ public:
+	/** Add a user to the index
+	 * @param user The user to add
+	 */
+	void Add(LocalUser* user);
+
+	/** Remove a user from the index
+	 * @param user The user to remove
+	 */
+	void Remove(LocalUser* user);
+
+	/** Index a user again after their IP address or real host changed. Does nothing if
+	 * the user is not in the index.
+	 * @param user The user to update
+	 */
+	void Update(LocalUser* user);
+
+	/** Find all local users that a line may match
+	 * @param line The line to find users for
+	 * @param out The list to add the users to, may contain duplicates
+	 * @return True if the users were found, false if the line cannot be indexed and
+	 * has to be checked against every user
+	 */
+	bool Find(XLine* line, std::vector<LocalUser*>& out) const;
+};
+
 /** XLineManager is a class used to manage glines, klines, elines, zlines and qlines,
  * or any other line created by a module. It also manages XLineFactory classes which
  * can generate a specialized XLine for use by another module.
@@ -413,6 +554,36 @@ class CoreExport XLineManager
 	 */
 	XLineContainer lookup_lines;
 
+	/** Lookup indexes of all lines, keyed by line type
+	 */
+	std::map<std::string, XLineIndex> line_index;
+
+	/** Local users indexed by IP address and real host
+	 */
+	XLineUserIndex user_index;
+
+	/** Calls ApplyLines() to continue applying pending lines after
+	 * ApplyLines() ran out of budget
+	 */
+	class ApplyTimer : public Timer
+	{
+		XLineManager* const manager;
+
+	 public:
+		ApplyTimer(XLineManager* xlm) : Timer(1), manager(xlm) { }
+		bool Tick(time_t) CXX11_OVERRIDE;
+	};
+
+	/** Timer continuing to apply pending lines, only scheduled while there are lines
+	 * left over by ApplyLines()
+	 */
+	ApplyTimer applytimer;
+
+	/** The maximum number of XLine::Matches() calls ApplyLines() makes before leaving the
+	 * remaining pending lines for the next run
+	 */
+	static const unsigned long APPLY_BUDGET = 1000000;
+
  public:
 
 	/** Constructor
@@ -511,10 +682,28 @@ class CoreExport XLineManager
 
 	/** Apply any new lines that are pending to be applied.
 	 * This will only apply lines in the pending_lines list, to save on
-	 * CPU time.
+	 * CPU time. Lines that can be indexed (see XLine::GetIndexMask()) are
+	 * only matched against the local users they can apply to. If the lines
+	 * would take too long to apply in one go the rest of them is applied
+	 * during the next few seconds.
 	 */
 	void ApplyLines();
 
+	/** Add a local user to the index of users used by ApplyLines()
+	 * @param user The user to add
+	 */
+	void AddLocalUser(LocalUser* user) { user_index.Add(user); }
+
+	/** Remove a local user from the index of users used by ApplyLines()
+	 * @param user The user to remove
+	 */
+	void DelLocalUser(LocalUser* user) { user_index.Remove(user); }
+
+	/** Index a local user again after their IP address or real host changed
+	 * @param user The user to update
+	 */
+	void UpdateLocalUser(LocalUser* user) { user_index.Update(user); }
+
 	/** Handle /STATS for a given type.
 	 * NOTE: Any items in the list for this particular line type which have expired
 	 * will be expired and removed before the list is displayed.
@@ -0,0 +1,35 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main() {
+	struct io_uring_params params = { };
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = 2;
+	int fd = syscall(__NR_io_uring_setup, 1, &params);
+	if (fd < 0 || !(params.features & IORING_FEAT_NODROP))
+		return 1;
+
+	// The socket engine probes the supported operations when it starts
+	struct io_uring_probe probe = { };
+	syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, &probe, 0);
+	close(fd);
+	return 0;
+}
@@ -32,10 +32,33 @@ namespace
 	ChanModeReference inviteonlymode(NULL, "inviteonly");
 	ChanModeReference keymode(NULL, "key");
 	ChanModeReference limitmode(NULL, "limit");
+
+	insp::MemoryPool channelpool("Channel", sizeof(Channel));
+	insp::MemoryPool memberpool("Membership", sizeof(Membership));
+}
+
+void* Membership::operator new(size_t size)
+{
+	return memberpool.Allocate(size);
+}
+
+void Membership::operator delete(void* ptr, size_t size)
+{
+	memberpool.Deallocate(ptr, size);
+}
+
+void* Channel::operator new(size_t size)
+{
+	return channelpool.Allocate(size);
+}
+
+void Channel::operator delete(void* ptr, size_t size)
+{
+	channelpool.Deallocate(ptr, size);
 }
 
 Channel::Channel(const std::string &cname, time_t ts)
-	: name(cname), age(ts), topicset(0)
+	: banserial(1), name(cname), age(ts), topicset(0)
 {
 	if (!ServerInstance->chanlist.insert(std::make_pair(cname, this)).second)
 		throw CoreException("Cannot create duplicate channel " + cname);
@@ -66,11 +89,14 @@ void Channel::SetTopic(User* u, const std::string& ntopic, time_t topicts, const
 
 Membership* Channel::AddUser(User* user)
 {
-	std::pair<MemberMap::iterator, bool> ret = userlist.insert(std::make_pair(user, insp::aligned_storage<Membership>()));
+	std::pair<MemberMap::iterator, bool> ret = userlist.insert(std::make_pair(user, static_cast<Membership*>(NULL)));
 	if (!ret.second)
 		return NULL;
 
-	Membership* memb = new(ret.first->second) Membership(user, this);
+	Membership* memb = new Membership(user, this);
+	ret.first->second = memb;
+	if (IS_LOCAL(user))
+		localusers.push_front(memb);
 	return memb;
 }
 
@@ -104,9 +130,11 @@ void Channel::CheckDestroy()
 void Channel::DelUser(const MemberMap::iterator& membiter)
 {
 	Membership* memb = membiter->second;
-	memb->cull();
-	memb->~Membership();
 	userlist.erase(membiter);
+	if (IS_LOCAL(memb->user))
+		localusers.erase(memb);
+	memb->cull();
+	delete memb;
 
 	// If this channel became empty then it should be removed
 	CheckDestroy();
@@ -348,16 +376,147 @@ bool Channel::IsBanned(User* user)
 	if (result != MOD_RES_PASSTHRU)
 		return (result == MOD_RES_DENY);
 
+	return MatchBanList(user);
+}
+
+void Channel::RebuildBanIndex()
+{
+	if (banindex.serial == banserial)
+		return;
+
+	banindex.bans.clear();
+	banindex.literal.clear();
+	banindex.other.clear();
+	banindex.modonly.clear();
+	banindex.serial = banserial;
+
 	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
 	const ListModeBase::ModeList* bans = banlm->GetList(this);
-	if (bans)
+	if (!bans)
+		return;
+
+	for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); ++it)
+	{
+		const std::string& mask = it->mask;
+		std::string::size_type at = mask.find('@');
+
+		// Same rules as in CheckBan(): these can only ever be matched by a module
+		if ((mask.length() <= 2) || (mask[1] == ':') || (at == std::string::npos))
+		{
+			banindex.modonly.push_back(mask);
+			continue;
+		}
+
+		banindex.bans.push_back(CompiledBan());
+		CompiledBan& compiled = banindex.bans.back();
+		compiled.mask = mask;
+		compiled.nickident.assign(mask, 0, at);
+		compiled.host.assign(mask, at + 1, std::string::npos);
+
+		// Mirror the validity checks in irc::sockets::MatchCIDR()
+		const std::string host(compiled.host, compiled.host.rfind('@') + 1);
+		const std::string::size_type per_pos = host.rfind('/');
+		compiled.iscidr = ((per_pos != std::string::npos) && (per_pos != host.length()-1)
+			&& (host.find_first_not_of("0123456789", per_pos+1) == std::string::npos)
+			&& (host.find_first_not_of("0123456789abcdefABCDEF.:") >= per_pos));
+		if (compiled.iscidr)
+			compiled.cidr = irc::sockets::cidr_mask(host);
+
+		const size_t index = banindex.bans.size() - 1;
+		if ((!compiled.iscidr) && (compiled.host.find_first_of("*?") == std::string::npos))
+			banindex.literal.insert(std::make_pair(compiled.host, index));
+		else
+			banindex.other.push_back(index);
+	}
+}
+
+bool Channel::MatchCompiledBan(User* user, const std::string& nickident, const CompiledBan& compiled)
+{
+	if (!InspIRCd::Match(nickident, compiled.nickident, NULL))
+		return false;
+
+	if (InspIRCd::Match(user->GetRealHost(), compiled.host, NULL) || InspIRCd::Match(user->GetDisplayedHost(), compiled.host, NULL) ||
+		InspIRCd::Match(user->GetIPString(), compiled.host, NULL))
+		return true;
+
+	return ((compiled.iscidr) && (irc::sockets::cidr_mask(user->client_sa, compiled.cidr.length) == compiled.cidr));
+}
+
+bool Channel::MatchBanIndex(User* user)
+{
+	const std::string nickident = user->nick + "!" + user->ident;
+
+	if (!ServerInstance->Modules->EventHandlers[I_OnCheckBan].empty())
+	{
+		// A module may match (or refuse to match) any mask, so every entry has to be offered to it
+		for (std::vector<CompiledBan>::const_iterator i = banindex.bans.begin(); i != banindex.bans.end(); ++i)
+		{
+			ModResult result;
+			FIRST_MOD_RESULT(OnCheckBan, result, (user, this, i->mask));
+			if (result != MOD_RES_PASSTHRU)
+			{
+				if (result == MOD_RES_DENY)
+					return true;
+			}
+			else if (MatchCompiledBan(user, nickident, *i))
+				return true;
+		}
+		return false;
+	}
+
+	// Bans with a literal host can only match if the host is one of the hosts or the IP of the user
+	const std::string* hosts[] = { &user->GetRealHost(), &user->GetDisplayedHost(), &user->GetIPString() };
+	for (size_t h = 0; h < sizeof(hosts) / sizeof(hosts[0]); h++)
 	{
-		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); it++)
+		std::pair<BanIndex::HostMap::const_iterator, BanIndex::HostMap::const_iterator> range = banindex.literal.equal_range(*hosts[h]);
+		for (BanIndex::HostMap::const_iterator i = range.first; i != range.second; ++i)
 		{
-			if (CheckBan(user, it->mask))
+			if (InspIRCd::Match(nickident, banindex.bans[i->second].nickident, NULL))
 				return true;
 		}
 	}
+
+	for (std::vector<size_t>::const_iterator i = banindex.other.begin(); i != banindex.other.end(); ++i)
+	{
+		if (MatchCompiledBan(user, nickident, banindex.bans[*i]))
+			return true;
+	}
+	return false;
+}
+
+bool Channel::MatchBanList(User* user)
+{
+	RebuildBanIndex();
+
+	// Everything the core matches on only changes when the ban list changes or when the
+	// nick, ident, host or IP of the user changes, so the result can be cached per member
+	Membership* memb = GetUser(user);
+	bool matched;
+	if ((memb) && (memb->banserial == banserial))
+	{
+		matched = memb->banmatch;
+	}
+	else
+	{
+		matched = MatchBanIndex(user);
+		if (memb)
+		{
+			memb->banserial = banserial;
+			memb->banmatch = matched;
+		}
+	}
+
+	if (matched)
+		return true;
+
+	// Extbans can depend on any state (accounts, other channels, oper status, ...), never cache them
+	for (std::vector<std::string>::const_iterator i = banindex.modonly.begin(); i != banindex.modonly.end(); ++i)
+	{
+		ModResult result;
+		FIRST_MOD_RESULT(OnCheckBan, result, (user, this, *i));
+		if (result == MOD_RES_DENY)
+			return true;
+	}
 	return false;
 }
 
@@ -396,16 +555,8 @@ ModResult Channel::GetExtBanStatus(User *user, char type)
 	if (rv != MOD_RES_PASSTHRU)
 		return rv;
 
-	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
-	const ListModeBase::ModeList* bans = banlm->GetList(this);
-	if (bans)
-	{
-		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); ++it)
-		{
-			if (CheckBan(user, it->mask))
-				return MOD_RES_DENY;
-		}
-	}
+	if (MatchBanList(user))
+		return MOD_RES_DENY;
 	return MOD_RES_PASSTHRU;
 }
 
@@ -428,8 +579,9 @@ bool Channel::PartUser(User* user, std::string& reason)
 
 	// Remove this channel from the user's chanlist
 	user->chans.erase(memb);
-	// Remove the Membership from this channel's userlist and destroy it
-	this->DelUser(membiter);
+	// Remove the Membership from this channel's userlist and destroy it. The hooks may have
+	// changed the userlist which invalidates membiter, so look the user up again.
+	this->DelUser(user);
 
 	return true;
 }
@@ -444,7 +596,8 @@ void Channel::KickUser(User* src, const MemberMap::iterator& victimiter, const s
 	WriteAllExcept(src, false, 0, except_list, "KICK %s %s :%s", name.c_str(), victim->nick.c_str(), reason.c_str());
 
 	victim->chans.erase(memb);
-	this->DelUser(victimiter);
+	// The hooks may have changed the userlist which invalidates victimiter
+	this->DelUser(victim);
 }
 
 void Channel::WriteChannel(User* user, const char* text, ...)
@@ -457,12 +610,7 @@ void Channel::WriteChannel(User* user, const char* text, ...)
 void Channel::WriteChannel(User* user, const std::string &text)
 {
 	const std::string message = ":" + user->GetFullHost() + " " + text;
-
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
-	{
-		if (IS_LOCAL(i->first))
-			i->first->Write(message);
-	}
+	WriteToLocalMembers(message);
 }
 
 void Channel::WriteChannelWithServ(const std::string& ServName, const char* text, ...)
@@ -475,11 +623,20 @@ void Channel::WriteChannelWithServ(const std::string& ServName, const char* text
 void Channel::WriteChannelWithServ(const std::string& ServName, const std::string &text)
 {
 	const std::string message = ":" + (ServName.empty() ? ServerInstance->Config->ServerName : ServName) + " " + text;
+	WriteToLocalMembers(message);
+}
+
+void Channel::WriteToLocalMembers(const std::string& message)
+{
+	// The line is built once and shared between the sendqs of all local members
+	if (localusers.empty())
+		return;
 
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
+	reference<SharedBuffer> line = LocalUser::PrepareSharedLine(message);
+	for (LocalMemberList::const_iterator i = localusers.begin(); i != localusers.end(); ++i)
 	{
-		if (IS_LOCAL(i->first))
-			i->first->Write(message);
+		LocalUser* const localuser = static_cast<LocalUser*>((*i)->user);
+		localuser->WriteShared(line);
 	}
 }
 
@@ -515,15 +672,20 @@ void Channel::RawWriteAllExcept(User* user, bool serversource, char status, CULi
 		if (mh)
 			minrank = mh->GetPrefixRank();
 	}
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
+	reference<SharedBuffer> line;
+	for (LocalMemberList::const_iterator i = localusers.begin(); i != localusers.end(); ++i)
 	{
-		if (IS_LOCAL(i->first) && (except_list.find(i->first) == except_list.end()))
+		Membership* const memb = *i;
+		LocalUser* const localuser = static_cast<LocalUser*>(memb->user);
+		if (except_list.find(localuser) == except_list.end())
 		{
 			/* User doesn't have the status we're after */
-			if (minrank && i->second->getRank() < minrank)
+			if (minrank && memb->getRank() < minrank)
 				continue;
 
-			i->first->Write(out);
+			if (!line)
+				line = LocalUser::PrepareSharedLine(out);
+			localuser->WriteShared(line);
 		}
 	}
 }
@@ -23,6 +23,19 @@
 
 #include "inspircd.h"
 
+namespace
+{
+	/** Get the amount of memory reserved by a parameter vector and the strings in it
+	 */
+	size_t GetCapacity(const std::vector<std::string>& params)
+	{
+		size_t total = params.capacity() * sizeof(std::string);
+		for (std::vector<std::string>::const_iterator i = params.begin(); i != params.end(); ++i)
+			total += i->capacity();
+		return total;
+	}
+}
+
 bool InspIRCd::PassCompare(Extensible* ex, const std::string& data, const std::string& input, const std::string& hashtype)
 {
 	ModResult res;
@@ -43,6 +56,19 @@ bool InspIRCd::PassCompare(Extensible* ex, const std::string& data, const std::s
 	return TimingSafeCompare(data, input);
 }
 
+void InspIRCd::PassCompare(PassCompareRequest* request)
+{
+	ModResult res;
+	FIRST_MOD_RESULT(OnPassCompareAsync, res, (request));
+
+	/* Module took the request, it will deliver the result */
+	if (res == MOD_RES_ALLOW)
+		return;
+
+	// The check is done before this returns so the user still exists
+	request->Deliver(PassCompare(FindUUID(request->uuid), request->password, request->input, request->hashtype));
+}
+
 bool CommandParser::LoopCall(User* user, Command* handler, const std::vector<std::string>& parameters, unsigned int splithere, int extra, bool usemax)
 {
 	if (splithere >= parameters.size())
@@ -70,27 +96,34 @@ bool CommandParser::LoopCall(User* user, Command* handler, const std::vector<std
 	 */
 	irc::commasepstream items1(parameters[splithere]);
 	irc::commasepstream items2(extra >= 0 ? parameters[extra] : "", true);
-	std::string item;
 	unsigned int max = 0;
 	LocalUser* localuser = IS_LOCAL(user);
+	const std::string emptyline;
+
+	// The parameters for the handler are built in the reusable buffer of the parser, they only
+	// differ in the items taken from the lists. If the handler calls LoopCall() itself then the
+	// buffer is in use and the nested call has to use its own vector.
+	CommandParser& parser = ServerInstance->Parser;
+	std::vector<std::string> localparams;
+	const bool usebuf = !parser.loopbufinuse;
+	std::vector<std::string>& new_parameters = (usebuf ? parser.loopbuf : localparams);
+	parser.loopbufinuse = true;
+	const size_t prevcapacity = GetCapacity(new_parameters);
+	new_parameters = parameters;
 
 	/* Attempt to iterate these lists and call the command handler
 	 * for every parameter or parameter pair until there are no more
 	 * left to parse.
 	 */
-	while (items1.GetToken(item) && (!usemax || max++ < ServerInstance->Config->MaxTargets))
+	while (items1.GetToken(new_parameters[splithere]) && (!usemax || max++ < ServerInstance->Config->MaxTargets))
 	{
-		if ((!check_dupes) || (dupes.insert(item).second))
+		if ((!check_dupes) || (dupes.insert(new_parameters[splithere]).second))
 		{
-			std::vector<std::string> new_parameters(parameters);
-			new_parameters[splithere] = item;
-
 			if (extra >= 0)
 			{
 				// If we have two lists then get the next item from the second list.
-				// In case it runs out of elements then 'item' will be an empty string.
-				items2.GetToken(item);
-				new_parameters[extra] = item;
+				// In case it runs out of elements then the item will be an empty string.
+				items2.GetToken(new_parameters[extra]);
 			}
 
 			CmdResult result = handler->Handle(new_parameters, user);
@@ -98,12 +131,17 @@ bool CommandParser::LoopCall(User* user, Command* handler, const std::vector<std
 			{
 				// Run the OnPostCommand hook with the last parameter (original line) being empty
 				// to indicate that the command had more targets in its original form.
-				item.clear();
-				FOREACH_MOD(OnPostCommand, (handler, new_parameters, localuser, result, item));
+				FOREACH_MOD(OnPostCommand, (handler, new_parameters, localuser, result, emptyline));
 			}
 		}
 	}
 
+	if (usebuf)
+	{
+		if (GetCapacity(new_parameters) > prevcapacity)
+			parser.paramgrowths++;
+		parser.loopbufinuse = false;
+	}
 	return true;
 }
 
@@ -159,11 +197,30 @@ CmdResult CommandParser::CallHandler(const std::string& commandname, const std::
 	return CMD_INVALID;
 }
 
-void CommandParser::ProcessCommand(LocalUser *user, std::string &cmd)
+void CommandParser::ProcessCommand(LocalUser* user, std::string& cmd)
+{
+	// A module may process another command while this one is being handled (e.g. m_alias),
+	// the reusable parameter vector is still in use then so give the nested command its own
+	if (parambufinuse)
+	{
+		std::vector<std::string> command_p;
+		ProcessCommand(user, cmd, command_p);
+		return;
+	}
+
+	linecount++;
+	parambufinuse = true;
+	const size_t prevcapacity = GetCapacity(parambuf);
+	ProcessCommand(user, cmd, parambuf);
+	if (GetCapacity(parambuf) > prevcapacity)
+		paramgrowths++;
+	parambufinuse = false;
+}
+
+void CommandParser::ProcessCommand(LocalUser* user, std::string& cmd, std::vector<std::string>& command_p)
 {
-	std::vector<std::string> command_p;
-	irc::tokenstream tokens(cmd);
-	std::string command, token;
+	irc::linetokenizer tokens(cmd);
+	std::string command;
 	tokens.GetToken(command);
 
 	/* A client sent a nick prefix on their command (ick)
@@ -174,8 +231,7 @@ void CommandParser::ProcessCommand(LocalUser *user, std::string &cmd)
 	if (command[0] == ':')
 		tokens.GetToken(command);
 
-	while (tokens.GetToken(token))
-		command_p.push_back(token);
+	tokens.GetTokens(command_p);
 
 	std::transform(command.begin(), command.end(), command.begin(), ::toupper);
 
@@ -406,6 +462,10 @@ bool CommandParser::AddCommand(Command *f)
 }
 
 CommandParser::CommandParser()
+	: parambufinuse(false)
+	, loopbufinuse(false)
+	, linecount(0)
+	, paramgrowths(0)
 {
 }
 
@@ -422,6 +422,9 @@ void ServerConfig::Fill()
 	SoftLimit = ConfValue("performance")->getInt("softlimit", (SocketEngine::GetMaxFds() > 0 ? SocketEngine::GetMaxFds() : LONG_MAX), 10);
 	CCOnConnect = ConfValue("performance")->getBool("clonesonconnect", true);
 	MaxConn = ConfValue("performance")->getInt("somaxconn", SOMAXCONN);
+	WorkerThreads = ConfValue("performance")->getInt("workerthreads", 2, 1, 64);
+	MaxEvents = ConfValue("performance")->getInt("maxevents", 0, 0, INT_MAX);
+	OffloadSendQ = ConfValue("performance")->getInt("offloadsendq", 0, 0, LONG_MAX);
 	XLineMessage = options->getString("xlinemessage", options->getString("moronbanner", "You're banned!"));
 	ServerDesc = server->getString("description", "Configure Me");
 	Network = server->getString("network", "Network");
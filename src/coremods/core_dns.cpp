@@ -213,7 +213,22 @@ class Packet : public Query
 
 				break;
 			}
+			case QUERY_SOA:
+			{
+				// The last field of the record is the minimum TTL of the zone, negative answers
+				// can be cached for the lower of it and the TTL of the record itself (RFC 2308)
+				if ((rdlength < 22) || (pos + rdlength > input_size))
+					throw Exception("Unable to unpack soa resource record");
+
+				const unsigned short minpos = pos + rdlength - 4;
+				const unsigned int minttl = (input[minpos] << 24) | (input[minpos + 1] << 16) | (input[minpos + 2] << 8) | input[minpos + 3];
+				record.ttl = std::min(record.ttl, minttl);
+				pos += rdlength;
+				break;
+			}
 			default:
+				// Skip records we do not understand so the ones after them can still be read
+				pos += rdlength;
 				break;
 		}
 
@@ -232,6 +247,8 @@ class Packet : public Query
 	RequestId id;
 	/* Flags on the packet */
 	unsigned short flags;
+	/* Records in the authority section, only filled in for answers without records */
+	std::vector<ResourceRecord> authorities;
 
 	Packet() : id(0), flags(0)
 	{
@@ -271,6 +288,33 @@ class Packet : public Query
 
 		for (unsigned i = 0; i < ancount; ++i)
 			this->answers.push_back(this->UnpackResourceRecord(input, len, packet_pos));
+
+		if (!this->answers.empty())
+			return;
+
+		try
+		{
+			for (unsigned i = 0; i < nscount; ++i)
+				this->authorities.push_back(this->UnpackResourceRecord(input, len, packet_pos));
+		}
+		catch (Exception& ex)
+		{
+			// The authority section is only used for negative caching, the answer itself is fine
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Ignoring authority section: " + ex.GetReason());
+		}
+	}
+
+	/** Get how long this answer can be cached if it is negative
+	 * @return TTL of the SOA record in the authority section, 0 if there is none
+	 */
+	unsigned int GetNegativeTTL() const
+	{
+		for (std::vector<ResourceRecord>::const_iterator i = authorities.begin(); i != authorities.end(); ++i)
+		{
+			if (i->type == QUERY_SOA)
+				return i->ttl;
+		}
+		return 0;
 	}
 
 	unsigned short Pack(unsigned char* output, unsigned short output_size)
@@ -347,20 +391,62 @@ class Packet : public Query
 
 class MyManager : public Manager, public Timer, public EventHandler
 {
-	typedef TR1NS::unordered_map<Question, Query, Question::hash> cache_map;
+	/** A cached answer, either positive or negative
+	 */
+	struct CacheEntry
+	{
+		/** The answer, error is set if it is negative
+		 */
+		Query query;
+
+		/** Time the entry expires at
+		 */
+		time_t expires;
+
+		/** Position of the question in the LRU list
+		 */
+		std::list<Question>::iterator lrupos;
+	};
+
+	typedef TR1NS::unordered_map<Question, CacheEntry, Question::hash> cache_map;
 	cache_map cache;
 
+	/** Questions in the cache, most recently used first
+	 */
+	std::list<Question> lru;
+
+	/** A query sent to the nameserver along with all requests waiting for its answer.
+	 * The first request is the one whose id the query was sent with.
+	 */
+	struct PendingQuery
+	{
+		std::vector<DNS::Request*> waiting;
+
+		/** The packet that was sent, used to send the query again if the first request goes away
+		 */
+		std::string packet;
+	};
+
+	typedef TR1NS::unordered_map<Question, PendingQuery, Question::hash> pending_map;
+	pending_map pending;
+
 	irc::sockets::sockaddrs myserver;
 	bool unloading;
 
-	/** Maximum number of entries in cache
+	/** Maximum time an answer is cached for, regardless of the TTL of its records
 	 */
-	static const unsigned int MAX_CACHE_SIZE = 1000;
+	static const unsigned int MAX_CACHE_TTL = 5*60;
 
-	static bool IsExpired(const Query& record, time_t now = ServerInstance->Time())
+	/** Send a pending query to the nameserver using the id of its first request
+	 * @param pq Query to send
+	 * @return True if the query was sent
+	 */
+	bool SendQuery(PendingQuery& pq)
 	{
-		const ResourceRecord& req = record.answers[0];
-		return (req.created + static_cast<time_t>(req.ttl) < now);
+		const RequestId id = pq.waiting.front()->id;
+		pq.packet[0] = id >> 8;
+		pq.packet[1] = id & 0xFF;
+		return (SocketEngine::SendTo(this, pq.packet.data(), pq.packet.size(), 0, &this->myserver.sa, this->myserver.sa_size()) == (int)pq.packet.size());
 	}
 
 	/** Check the DNS cache to see if request can be handled by a cached result
@@ -372,30 +458,80 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 		cache_map::iterator it = this->cache.find(question);
 		if (it == this->cache.end())
+		{
+			cachemisses++;
 			return false;
+		}
 
-		Query& record = it->second;
-		if (IsExpired(record))
+		CacheEntry& entry = it->second;
+		if (entry.expires < ServerInstance->Time())
 		{
+			lru.erase(entry.lrupos);
 			this->cache.erase(it);
+			cachemisses++;
 			return false;
 		}
 
-		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: Using cached result for " + question.name);
+		lru.splice(lru.begin(), lru, entry.lrupos);
+		cachehits++;
+
+		// Hand out the remaining lifetime of each record instead of the TTL it was received with
+		Query record(entry.query);
 		record.cached = true;
-		req->OnLookupComplete(&record);
+		for (std::vector<ResourceRecord>::iterator i = record.answers.begin(); i != record.answers.end(); ++i)
+		{
+			ResourceRecord& rr = *i;
+			const unsigned int age = ServerInstance->Time() - rr.created;
+			rr.ttl = (rr.ttl > age ? rr.ttl - age : 0);
+		}
+
+		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: Using cached result for " + question.name);
+		if (record.error == ERROR_NONE)
+		{
+			req->OnLookupComplete(&record);
+		}
+		else
+		{
+			negativehits++;
+			req->OnError(&record);
+		}
 		return true;
 	}
 
-	/** Add a record to the dns cache
-	 * @param r The record
+	/** Add an answer to the dns cache
+	 * @param r The answer, if its error is set it is cached as a negative answer
+	 * @param ttl How long the answer is valid for
 	 */
-	void AddCache(Query& r)
+	void AddCache(const Query& r, unsigned int ttl)
 	{
-		if (cache.size() >= MAX_CACHE_SIZE)
-			cache.clear();
+		if (maxcachesize == 0)
+			return;
+
+		cache_map::iterator it = this->cache.find(r.question);
+		if (it != this->cache.end())
+		{
+			lru.erase(it->second.lrupos);
+			this->cache.erase(it);
+		}
 
-		// Determine the lowest TTL value and use that as the TTL of the cache entry
+		while (cache.size() >= maxcachesize)
+		{
+			this->cache.erase(lru.back());
+			lru.pop_back();
+		}
+
+		CacheEntry& entry = this->cache[r.question];
+		entry.query = r;
+		entry.expires = ServerInstance->Time() + std::min(ttl, MAX_CACHE_TTL);
+		entry.lrupos = lru.insert(lru.begin(), r.question);
+		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: added %s cache entry for %s ttl: %u", (r.error == ERROR_NONE ? "positive" : "negative"), r.question.name.c_str(), ttl);
+	}
+
+	/** Add a positive answer to the dns cache, the entry expires together with the record with the lowest TTL
+	 * @param r The answer
+	 */
+	void AddCache(const Query& r)
+	{
 		unsigned int cachettl = UINT_MAX;
 		for (std::vector<ResourceRecord>::const_iterator i = r.answers.begin(); i != r.answers.end(); ++i)
 		{
@@ -403,20 +539,32 @@ class MyManager : public Manager, public Timer, public EventHandler
 			if (rr.ttl < cachettl)
 				cachettl = rr.ttl;
 		}
-
-		cachettl = std::min(cachettl, (unsigned int)5*60);
-		ResourceRecord& rr = r.answers.front();
-		// Set TTL to what we've determined to be the lowest
-		rr.ttl = cachettl;
-		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: added cache for " + rr.name + " -> " + rr.rdata + " ttl: " + ConvToStr(rr.ttl));
-		this->cache[r.question] = r;
+		AddCache(r, cachettl);
 	}
 
  public:
+	/** Maximum number of entries in the cache
+	 */
+	unsigned int maxcachesize;
+
+	/** Number of requests answered from the cache, how many of those were negative answers,
+	 * number of requests not found in the cache and number of requests that waited for a
+	 * query another request already sent
+	 */
+	unsigned long cachehits;
+	unsigned long negativehits;
+	unsigned long cachemisses;
+	unsigned long coalesced;
+
 	DNS::Request* requests[MAX_REQUEST_ID+1];
 
 	MyManager(Module* c) : Manager(c), Timer(5*60, true)
 		, unloading(false)
+		, maxcachesize(10000)
+		, cachehits(0)
+		, negativehits(0)
+		, cachemisses(0)
+		, coalesced(0)
 	{
 		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
 			requests[i] = NULL;
@@ -502,8 +650,20 @@ class MyManager : public Manager, public Timer, public EventHandler
 		// Update name in the original request so question checking works for PTR queries
 		req->question.name = p.question.name;
 
-		if (SocketEngine::SendTo(this, buffer, len, 0, &this->myserver.sa, this->myserver.sa_size()) != len)
-			throw Exception("DNS: Unable to send query");
+		// If the same question was already asked wait for that answer instead of asking again
+		PendingQuery& pq = this->pending[req->question];
+		pq.waiting.push_back(req);
+		if (pq.waiting.size() > 1)
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Waiting for the answer to an earlier query for " + req->question.name);
+			coalesced++;
+		}
+		else
+		{
+			pq.packet.assign(reinterpret_cast<const char*>(buffer), len);
+			if (!this->SendQuery(pq))
+				throw Exception("DNS: Unable to send query");
+		}
 
 		// Add timer for timeout
 		ServerInstance->Timers.AddTimer(req);
@@ -511,8 +671,27 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 	void RemoveRequest(DNS::Request* req) CXX11_OVERRIDE
 	{
-		if (requests[req->id] == req)
-			requests[req->id] = NULL;
+		if (requests[req->id] != req)
+			return;
+		requests[req->id] = NULL;
+
+		pending_map::iterator it = this->pending.find(req->question);
+		if (it == this->pending.end())
+			return;
+
+		PendingQuery& pq = it->second;
+		std::vector<DNS::Request*>::iterator pos = std::find(pq.waiting.begin(), pq.waiting.end(), req);
+		if (pos == pq.waiting.end())
+			return;
+
+		// The answer will carry the id of the first request, if that one goes away
+		// send the query again for the next one
+		const bool sent = (pos == pq.waiting.begin());
+		pq.waiting.erase(pos);
+		if (pq.waiting.empty())
+			this->pending.erase(it);
+		else if ((sent) && (!unloading) && (!this->SendQuery(pq)))
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Unable to send the query for " + req->question.name + " again");
 	}
 
 	std::string GetErrorStr(Error e) CXX11_OVERRIDE
@@ -596,18 +775,31 @@ class MyManager : public Manager, public Timer, public EventHandler
 			return;
 		}
 
+		// Only the request the query was sent for can be answered, the others waiting for it have ids nobody saw
+		pending_map::iterator it = this->pending.find(recv_packet.question);
+		if ((it == this->pending.end()) || (it->second.waiting.front() != request))
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Received an answer with the id of a request that is waiting for another query");
+			return;
+		}
+
+		// Remember the ids, a handler may delete one of the other requests and its id must not be read from it afterwards
+		std::vector<std::pair<RequestId, DNS::Request*> > waiting;
+		waiting.reserve(it->second.waiting.size());
+		for (std::vector<DNS::Request*>::const_iterator i = it->second.waiting.begin(); i != it->second.waiting.end(); ++i)
+			waiting.push_back(std::make_pair((*i)->id, *i));
+		this->pending.erase(it);
+
 		if (!valid)
 		{
 			ServerInstance->stats.DnsBad++;
 			recv_packet.error = ERROR_MALFORMED;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.flags & QUERYFLAGS_OPCODE)
 		{
 			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Received a nonstandard query");
 			ServerInstance->stats.DnsBad++;
 			recv_packet.error = ERROR_NONSTANDARD_QUERY;
-			request->OnError(&recv_packet);
 		}
 		else if (!(recv_packet.flags & QUERYFLAGS_QR) || (recv_packet.flags & QUERYFLAGS_RCODE))
 		{
@@ -641,27 +833,48 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 			ServerInstance->stats.DnsBad++;
 			recv_packet.error = error;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.answers.empty())
 		{
 			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "No resource records returned");
 			ServerInstance->stats.DnsBad++;
 			recv_packet.error = ERROR_NO_RECORDS;
-			request->OnError(&recv_packet);
 		}
 		else
 		{
 			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Lookup complete for " + request->question.name);
 			ServerInstance->stats.DnsGood++;
-			request->OnLookupComplete(&recv_packet);
-			this->AddCache(recv_packet);
 		}
 
 		ServerInstance->stats.Dns++;
 
-		/* Request's destructor removes it from the request map */
-		delete request;
+		if (recv_packet.error == ERROR_NONE)
+		{
+			this->AddCache(recv_packet);
+		}
+		else if ((recv_packet.error == ERROR_DOMAIN_NOT_FOUND) || (recv_packet.error == ERROR_NO_RECORDS))
+		{
+			// Without an SOA record the answer must not be cached (RFC 2308 section 5)
+			const unsigned int negttl = recv_packet.GetNegativeTTL();
+			if (negttl)
+				this->AddCache(recv_packet, negttl);
+		}
+
+		for (std::vector<std::pair<RequestId, DNS::Request*> >::const_iterator i = waiting.begin(); i != waiting.end(); ++i)
+		{
+			// Skip requests deleted by the handler of an earlier one
+			DNS::Request* req = i->second;
+			if ((this->requests[i->first] != req) || (req->question != recv_packet.question))
+				continue;
+
+			if (recv_packet.error == ERROR_NONE)
+				req->OnLookupComplete(&recv_packet);
+			else
+				req->OnError(&recv_packet);
+
+			/* Request's destructor removes it from the request map */
+			delete req;
+		}
 	}
 
 	bool Tick(time_t now) CXX11_OVERRIDE
@@ -670,15 +883,30 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 		for (cache_map::iterator it = this->cache.begin(); it != this->cache.end(); )
 		{
-			const Query& query = it->second;
-			if (IsExpired(query, now))
+			const CacheEntry& entry = it->second;
+			if (entry.expires < now)
+			{
+				lru.erase(entry.lrupos);
 				this->cache.erase(it++);
+			}
 			else
 				++it;
 		}
 		return true;
 	}
 
+	size_t GetCacheSize() const { return cache.size(); }
+
+	void SetCacheSize(unsigned int size)
+	{
+		maxcachesize = size;
+		while (cache.size() > maxcachesize)
+		{
+			this->cache.erase(lru.back());
+			lru.pop_back();
+		}
+	}
+
 	void Rehash(const std::string& dnsserver, std::string sourceaddr, unsigned int sourceport)
 	{
 		if (this->GetFd() > -1)
@@ -818,6 +1046,7 @@ class ModuleDNS : public Module
 		DNSServer = tag->getString("server");
 		SourceIP = tag->getString("sourceip");
 		SourcePort = tag->getInt("sourceport", 0, 0, 65535);
+		this->manager.SetCacheSize(tag->getInt("cachesize", 10000, 0, 1000000));
 
 		if (DNSServer.empty())
 			FindDNSServer();
@@ -845,6 +1074,16 @@ class ModuleDNS : public Module
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() == 'T')
+		{
+			stats.AddRow(249, InspIRCd::Format("dns cache %lu/%u entries, %lu hits (%lu negative), %lu misses, %lu requests waited for an earlier query",
+				(unsigned long)manager.GetCacheSize(), manager.maxcachesize, manager.cachehits, manager.negativehits, manager.cachemisses, manager.coalesced));
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
 	Version GetVersion() CXX11_OVERRIDE
 	{
 		return Version("DNS support", VF_CORE|VF_VENDOR);
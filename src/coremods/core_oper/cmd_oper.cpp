@@ -22,51 +22,107 @@
 #include "inspircd.h"
 #include "core_oper.h"
 
+namespace
+{
+	void OperFailed(LocalUser* user, const std::string& login, bool match_login, bool match_pass, bool match_hosts)
+	{
+		std::string fields;
+		if (!match_login)
+			fields.append("login ");
+		if (!match_pass)
+			fields.append("password ");
+		if (!match_hosts)
+			fields.append("hosts");
+
+		// tell them they suck, and lag them up to help prevent brute-force attacks
+		user->WriteNumeric(ERR_NOOPERHOST, "Invalid oper credentials");
+		user->CommandFloodPenalty += 10000;
+
+		ServerInstance->SNO->WriteGlobalSno('o', "WARNING! Failed oper attempt by %s using login '%s': The following fields do not match: %s", user->GetFullRealHost().c_str(), login.c_str(), fields.c_str());
+		ServerInstance->Logs->Log("OPER", LOG_DEFAULT, "OPER: Failed oper attempt by %s using login '%s': The following fields did not match: %s", user->GetFullRealHost().c_str(), login.c_str(), fields.c_str());
+	}
+
+	/** Checks the password of an oper block, possibly on a worker thread
+	 */
+	class OperPasswordRequest : public PassCompareRequest
+	{
+		const std::string login;
+		const reference<OperInfo> oper;
+		const bool match_hosts;
+		LocalIntExt& pending;
+		CmdResult& result;
+
+	 public:
+		OperPasswordRequest(Module* Creator, LocalUser* user, const std::string& Login, OperInfo* ifo, const std::string& Input, bool MatchHosts, LocalIntExt& Pending, CmdResult& Result)
+			: PassCompareRequest(Creator, user, ifo->oper_block->getString("password"), Input, ifo->oper_block->getString("hash"))
+			, login(Login)
+			, oper(ifo)
+			, match_hosts(MatchHosts)
+			, pending(Pending)
+			, result(Result)
+		{
+		}
+
+		void OnResult(bool match_pass) CXX11_OVERRIDE
+		{
+			LocalUser* const user = IS_LOCAL(ServerInstance->FindUUID(uuid));
+			if ((!user) || (user->quitting))
+				return;
+
+			pending.unset(user);
+
+			// The oper block might have been removed by a rehash while the password was being checked
+			ServerConfig::OperIndex::const_iterator i = ServerInstance->Config->oper_blocks.find(login);
+			const bool match_login = ((i != ServerInstance->Config->oper_blocks.end()) && (i->second == static_cast<OperInfo*>(oper)));
+
+			if (match_login && match_pass && match_hosts)
+			{
+				/* found this oper's opertype */
+				user->Oper(oper);
+				return;
+			}
+
+			result = CMD_FAILURE;
+			OperFailed(user, login, match_login, match_pass, match_hosts);
+		}
+	};
+}
+
 CommandOper::CommandOper(Module* parent)
 	: SplitCommand(parent, "OPER", 2, 2)
+	, pending("oper_pending", ExtensionItem::EXT_USER, parent)
+	, result(CMD_SUCCESS)
 {
 	syntax = "<username> <password>";
 }
 
 CmdResult CommandOper::HandleLocal(const std::vector<std::string>& parameters, LocalUser *user)
 {
-	bool match_login = false;
-	bool match_pass = false;
-	bool match_hosts = false;
-
-	const std::string userHost = user->ident + "@" + user->GetRealHost();
-	const std::string userIP = user->ident + "@" + user->GetIPString();
+	// Only one password may be checked at a time, otherwise the penalty for failed
+	// attempts would only be applied after many guesses have been queued
+	if (pending.get(user))
+	{
+		user->WriteNumeric(ERR_NOOPERHOST, "Your previous oper attempt is still being checked");
+		return CMD_FAILURE;
+	}
 
 	ServerConfig::OperIndex::const_iterator i = ServerInstance->Config->oper_blocks.find(parameters[0]);
-	if (i != ServerInstance->Config->oper_blocks.end())
+	if (i == ServerInstance->Config->oper_blocks.end())
 	{
-		OperInfo* ifo = i->second;
-		ConfigTag* tag = ifo->oper_block;
-		match_login = true;
-		match_pass = ServerInstance->PassCompare(user, tag->getString("password"), parameters[1], tag->getString("hash"));
-		match_hosts = InspIRCd::MatchMask(tag->getString("host"), userHost, userIP);
-
-		if (match_pass && match_hosts)
-		{
-			/* found this oper's opertype */
-			user->Oper(ifo);
-			return CMD_SUCCESS;
-		}
+		OperFailed(user, parameters[0], false, false, false);
+		return CMD_FAILURE;
 	}
 
-	std::string fields;
-	if (!match_login)
-		fields.append("login ");
-	if (!match_pass)
-		fields.append("password ");
-	if (!match_hosts)
-		fields.append("hosts");
-
-	// tell them they suck, and lag them up to help prevent brute-force attacks
-	user->WriteNumeric(ERR_NOOPERHOST, "Invalid oper credentials");
-	user->CommandFloodPenalty += 10000;
-
-	ServerInstance->SNO->WriteGlobalSno('o', "WARNING! Failed oper attempt by %s using login '%s': The following fields do not match: %s", user->GetFullRealHost().c_str(), parameters[0].c_str(), fields.c_str());
-	ServerInstance->Logs->Log("OPER", LOG_DEFAULT, "OPER: Failed oper attempt by %s using login '%s': The following fields did not match: %s", user->GetFullRealHost().c_str(), parameters[0].c_str(), fields.c_str());
-	return CMD_FAILURE;
+	const std::string userHost = user->ident + "@" + user->GetRealHost();
+	const std::string userIP = user->ident + "@" + user->GetIPString();
+
+	OperInfo* ifo = i->second;
+	const bool match_hosts = InspIRCd::MatchMask(ifo->oper_block->getString("host"), userHost, userIP);
+
+	// The result may arrive later if the password is hashed with a slow algorithm,
+	// in that case the attempt counts as a success until it is known to have failed
+	result = CMD_SUCCESS;
+	pending.set(user, 1);
+	ServerInstance->PassCompare(new OperPasswordRequest(creator, user, parameters[0], ifo, parameters[1], match_hosts, pending, result));
+	return result;
 }
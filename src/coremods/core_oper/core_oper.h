@@ -81,6 +81,15 @@ class CommandKill : public Command
  */
 class CommandOper : public SplitCommand
 {
+	/** Set on users whose OPER password is still being checked
+	 */
+	LocalIntExt pending;
+
+	/** Set to CMD_FAILURE by a password check which failed, used to return the result
+	 * of checks which were done before PassCompare() returned
+	 */
+	CmdResult result;
+
  public:
 	/** Constructor for oper.
 	 */
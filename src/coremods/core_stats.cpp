@@ -198,6 +198,19 @@ void CommandStats::DoStats(Stats::Context& stats)
 			stats.AddRow(249, "Read events:  "+ConvToStr(sestats.ReadEvents));
 			stats.AddRow(249, "Write events: "+ConvToStr(sestats.WriteEvents));
 			stats.AddRow(249, "Error events: "+ConvToStr(sestats.ErrorEvents));
+
+			std::string histogram = "Events per wait:";
+			for (size_t i = 0; i < SocketEngine::Statistics::HistogramSize; i++)
+			{
+				const unsigned long low = (i ? (1UL << (i - 1)) : 0);
+				histogram.append(" ").append(ConvToStr(low));
+				if (i + 1 == SocketEngine::Statistics::HistogramSize)
+					histogram.push_back('+');
+				else if (low > 1)
+					histogram.append("-").append(ConvToStr((1UL << i) - 1));
+				histogram.append("=").append(ConvToStr(sestats.EventCountHistogram[i]));
+			}
+			stats.AddRow(249, histogram);
 			break;
 		}
 
@@ -222,6 +235,17 @@ void CommandStats::DoStats(Stats::Context& stats)
 			stats.AddRow(249, "Users: "+ConvToStr(ServerInstance->Users->GetUsers().size()));
 			stats.AddRow(249, "Channels: "+ConvToStr(ServerInstance->GetChans().size()));
 			stats.AddRow(249, "Commands: "+ConvToStr(ServerInstance->Parser.GetCommands().size()));
+			stats.AddRow(249, InspIRCd::Format("Command parser: %lu lines, %lu commands grew the parameter buffers",
+				ServerInstance->Parser.GetLineCount(), ServerInstance->Parser.GetParameterGrowths()));
+
+			const std::vector<insp::MemoryPool*>& pools = insp::MemoryPool::GetPools();
+			for (std::vector<insp::MemoryPool*>::const_iterator i = pools.begin(); i != pools.end(); ++i)
+			{
+				const insp::MemoryPool* pool = *i;
+				stats.AddRow(249, InspIRCd::Format("Pool %s: %lu in use, %lu peak, %lu slabs of %lu byte blocks, %lu slabs released, %lu allocations", pool->GetName(),
+					(unsigned long)pool->GetInUse(), (unsigned long)pool->GetPeak(), (unsigned long)pool->GetSlabCount(),
+					(unsigned long)pool->GetBlockSize(), pool->GetReleases(), pool->GetAllocations()));
+			}
 
 			float kbitpersec_in, kbitpersec_out, kbitpersec_total;
 			SocketEngine::GetStats().GetBandwidth(kbitpersec_in, kbitpersec_out, kbitpersec_total);
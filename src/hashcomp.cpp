@@ -255,6 +255,56 @@ bool irc::tokenstream::GetToken(long &token)
 	return returnval;
 }
 
+irc::linetokenizer::linetokenizer(const std::string& source)
+	: line(source)
+	, pos(0)
+{
+}
+
+bool irc::linetokenizer::GetToken(std::string& token)
+{
+	// The first token is never a trailing parameter, see tokenstream
+	const bool first = (pos == 0);
+
+	pos = line.find_first_not_of(' ', pos);
+	if (pos == std::string::npos)
+	{
+		pos = line.length();
+		token.clear();
+		return false;
+	}
+
+	if ((line[pos] == ':') && (!first))
+	{
+		// This is the last parameter, it extends to the end of the line
+		token.assign(line, pos + 1, std::string::npos);
+		pos = line.length();
+		return true;
+	}
+
+	std::string::size_type end = line.find(' ', pos);
+	if (end == std::string::npos)
+		end = line.length();
+
+	token.assign(line, pos, end - pos);
+	pos = end;
+	return true;
+}
+
+void irc::linetokenizer::GetTokens(std::vector<std::string>& tokens)
+{
+	size_t count = 0;
+	while (true)
+	{
+		if (count == tokens.size())
+			tokens.push_back(std::string());
+		if (!GetToken(tokens[count]))
+			break;
+		count++;
+	}
+	tokens.resize(count);
+}
+
 irc::sepstream::sepstream(const std::string& source, char separator, bool allowempty)
 	: tokens(source), sep(separator), pos(0), allow_empty(allowempty)
 {
@@ -110,6 +110,7 @@ void InspIRCd::Cleanup()
 
 	GlobalCulls.Apply();
 	Modules->UnloadAll();
+	Threads.StopPool();
 
 	/* Delete objects dynamically allocated in constructor (destructor would be more appropriate, but we're likely exiting) */
 	/* Must be deleted before modes as it decrements modelines */
@@ -652,7 +653,6 @@ void InspIRCd::Run()
 			}
 
 			Timers.TickTimers(TIME.tv_sec);
-			Users->DoBackgroundUserStuff();
 
 			if ((TIME.tv_sec % 5) == 0)
 			{
@@ -700,6 +700,13 @@ ENTRYPOINT
 {
 	new InspIRCd(argc, argv);
 	ServerInstance->Run();
-	delete ServerInstance;
+
+	// Run() only returns after the test suite. Tear down in the same order as Exit():
+	// members of InspIRCd log when destroyed, which must not reach the LogManager
+	// after it has been destroyed, so ServerInstance is cleared before the delete.
+	InspIRCd* const instance = ServerInstance;
+	instance->Cleanup();
+	ServerInstance = NULL;
+	delete instance;
 	return 0;
 }
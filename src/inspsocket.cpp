@@ -33,6 +33,224 @@ static IOHook* GetNextHook(IOHook* hook)
 	return NULL;
 }
 
+/* Don't try to prepare huge blobs of data to send to a blocked socket */
+static const int MYIOV_MAX = IOV_MAX < 128 ? IOV_MAX : 128;
+
+/** Remove data which was written to the socket from the front of a sendq
+ * @param sq Queue to remove the data from
+ * @param n Number of bytes to remove
+ */
+static void EraseWritten(StreamSocket::SendQueue& sq, size_t n)
+{
+	while (n > 0 && !sq.empty())
+	{
+		const StreamSocket::SendQueue::Element& front = sq.front();
+		if (front.length() <= n)
+		{
+			// this string got fully written out
+			n -= front.length();
+			sq.pop_front();
+		}
+		else
+		{
+			// stopped in the middle of this string
+			sq.erase_front(n);
+			n = 0;
+		}
+	}
+}
+
+/** Writes the sendq of a socket on a worker thread and hands what was not written back to
+ * the socket on the main thread. The worker writes to a duplicate of the fd of the socket so
+ * closing the socket meanwhile can not make it write to another socket reusing the fd number.
+ * The socket itself and the reference counts of shared buffers are only touched on the main thread.
+ */
+class StreamSocket::WriteTask : public ThreadPool::Task
+{
+	/** Socket the data is written for, NULL if the socket was closed before the task was finished
+	 */
+	StreamSocket* sock;
+
+	/** Duplicate of the fd of the socket
+	 */
+	const int fd;
+
+	/** Number of bytes written by the worker
+	 */
+	size_t written;
+
+	/** True if the socket could not take all of the data without blocking
+	 */
+	bool blocked;
+
+	/** True if the socket was closed by the peer
+	 */
+	bool closed;
+
+	/** errno of the write that failed, 0 if none did
+	 */
+	int err;
+
+ public:
+	/** Data to write, taken from the sendq of the socket
+	 */
+	SendQueue sendq;
+
+	WriteTask(StreamSocket* Sock, int Fd)
+		: ThreadPool::Task(NULL)
+		, sock(Sock)
+		, fd(Fd)
+		, written(0)
+		, blocked(false)
+		, closed(false)
+		, err(0)
+	{
+	}
+
+	~WriteTask()
+	{
+		// Tasks are deleted without being finished when the pool is stopped
+		Detach();
+		SocketEngine::Close(fd);
+	}
+
+	/** Stop reporting to the socket, called when it is closed
+	 */
+	void Detach()
+	{
+		if (sock)
+			sock->writetask = NULL;
+		sock = NULL;
+	}
+
+	void Run() CXX11_OVERRIDE
+	{
+		// Like FlushSendQ() but without modifying the queue, removing elements would release
+		// references to shared buffers which may be in use by the main thread
+		SendQueue::const_iterator curr = sendq.begin();
+		size_t skip = 0;
+		while (curr != sendq.end())
+		{
+			SocketEngine::IOVector iovecs[MYIOV_MAX];
+			int bufcount = 0;
+			size_t offered = 0;
+			for (SendQueue::const_iterator i = curr; (i != sendq.end()) && (bufcount < MYIOV_MAX); ++i, bufcount++)
+			{
+				const size_t start = (i == curr) ? skip : 0;
+				iovecs[bufcount].iov_base = const_cast<char*>(i->data() + start);
+				iovecs[bufcount].iov_len = i->length() - start;
+				offered += iovecs[bufcount].iov_len;
+			}
+
+			const int rv = writev(fd, iovecs, bufcount);
+			if (rv == 0)
+			{
+				closed = true;
+				return;
+			}
+			else if (rv < 0)
+			{
+				// restart interrupted syscall
+				if (errno == EINTR)
+					continue;
+				err = errno;
+				return;
+			}
+
+			written += rv;
+			skip += rv;
+			while ((curr != sendq.end()) && (skip >= curr->length()))
+			{
+				skip -= curr->length();
+				++curr;
+			}
+
+			if ((size_t)rv < offered)
+			{
+				blocked = true;
+				return;
+			}
+		}
+	}
+
+	void Finish() CXX11_OVERRIDE
+	{
+		if (written)
+			SocketEngine::AddWrittenBytes(written);
+
+		StreamSocket* const s = sock;
+		if (!s)
+			return;
+		Detach();
+
+		// Put the data that was not written back in front of the data queued meanwhile
+		EraseWritten(sendq, written);
+		sendq.moveall(s->sendq);
+		s->sendq.swap(sendq);
+
+		// The socket has failed for another reason since the write was started
+		if (!s->error.empty())
+			return;
+
+		int eventChange = FD_WANT_EDGE_WRITE;
+		if (blocked)
+		{
+			eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
+		}
+		else if (closed)
+		{
+			s->error = "Connection closed";
+		}
+		else if (err)
+		{
+			errno = err;
+			if (SocketEngine::IgnoreError())
+				eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
+			else
+				s->error = SocketEngine::LastError();
+		}
+
+		if (!s->error.empty())
+		{
+			// error - kill all events
+			SocketEngine::ChangeEventMask(s, FD_WANT_NO_READ | FD_WANT_NO_WRITE);
+			s->CheckError(I_ERR_WRITE);
+			return;
+		}
+
+		SocketEngine::ChangeEventMask(s, eventChange);
+		// Everything was written, carry on with the data queued meanwhile
+		if (eventChange == FD_WANT_EDGE_WRITE)
+			s->OnEventHandlerWrite();
+	}
+};
+
+bool StreamSocket::StartWriteTask()
+{
+#ifdef _WIN32
+	return false;
+#else
+	const unsigned long threshold = ServerInstance->Config->OffloadSendQ;
+	if ((!threshold) || (sendq.bytes() < threshold) || (writetask) || (GetIOHook()))
+		return false;
+
+	if ((fd < 0) || (!error.empty()) || (GetEventMask() & FD_WRITE_WILL_BLOCK))
+		return false;
+
+	const int taskfd = dup(fd);
+	if (taskfd < 0)
+		return false;
+
+	writetask = new WriteTask(this, taskfd);
+	writetask->sendq.swap(sendq);
+
+	// Write events are of no use until the worker is done
+	SocketEngine::ChangeEventMask(this, FD_WANT_NO_WRITE);
+	ServerInstance->Threads.GetPool().Submit(writetask);
+	return true;
+#endif
+}
+
 BufferedSocket::BufferedSocket()
 {
 	Timeout = NULL;
@@ -133,6 +351,16 @@ void StreamSocket::Close()
 		SocketEngine::Shutdown(this, 2);
 		SocketEngine::Close(this);
 	}
+
+	// The worker can't write the data it still has once the socket is shut down
+	if (writetask)
+		writetask->Detach();
+}
+
+StreamSocket::~StreamSocket()
+{
+	if (writetask)
+		writetask->Detach();
 }
 
 CullResult StreamSocket::cull()
@@ -143,11 +371,22 @@ CullResult StreamSocket::cull()
 
 bool StreamSocket::GetNextLine(std::string& line, char delim)
 {
-	std::string::size_type i = recvq.find(delim);
+	const char* data;
+	size_t length;
+	if (!GetNextLine(data, length, delim))
+		return false;
+	line.assign(data, length);
+	return true;
+}
+
+bool StreamSocket::GetNextLine(const char*& data, size_t& length, char delim)
+{
+	std::string::size_type i = recvq.find(delim, recvqpos);
 	if (i == std::string::npos)
 		return false;
-	line.assign(recvq, 0, i);
-	recvq.erase(0, i + 1);
+	data = recvq.data() + recvqpos;
+	length = i - recvqpos;
+	recvqpos = i + 1;
 	return true;
 }
 
@@ -169,6 +408,13 @@ int StreamSocket::HookChainRead(IOHook* hook, std::string& rq)
 
 void StreamSocket::DoRead()
 {
+	// Drop the lines consumed since the last read before appending new data
+	if (recvqpos)
+	{
+		recvq.erase(0, recvqpos);
+		recvqpos = 0;
+	}
+
 	const std::string::size_type prevrecvqsize = recvq.size();
 
 	const int result = HookChainRead(GetIOHook(), recvq);
@@ -221,11 +467,11 @@ int StreamSocket::ReadToRecvQ(std::string& rq)
 	return n;
 }
 
-/* Don't try to prepare huge blobs of data to send to a blocked socket */
-static const int MYIOV_MAX = IOV_MAX < 128 ? IOV_MAX : 128;
-
 void StreamSocket::DoWrite()
 {
+	// Data queued while a worker is writing is sent when it is done
+	if (writetask)
+		return;
 	if (getSendQSize() == 0)
 		return;
 	if (!error.empty() || fd < 0)
@@ -312,22 +558,7 @@ void StreamSocket::FlushSendQ(SendQueue& sq)
 					// it's going to block now
 					eventChange = FD_WANT_FAST_WRITE | FD_WRITE_WILL_BLOCK;
 				}
-				while (rv > 0 && !sq.empty())
-				{
-					const SendQueue::Element& front = sq.front();
-					if (front.length() <= (size_t)rv)
-					{
-						// this string got fully written out
-						rv -= front.length();
-						sq.pop_front();
-					}
-					else
-					{
-						// stopped in the middle of this string
-						sq.erase_front(rv);
-						rv = 0;
-					}
-				}
+				EraseWritten(sq, rv);
 			}
 			else if (rv == 0)
 			{
@@ -373,6 +604,21 @@ void StreamSocket::WriteData(const std::string &data)
 	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
 }
 
+void StreamSocket::WriteData(SharedBuffer* data)
+{
+	if (fd < 0)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Attempt to write data to dead socket: %s",
+			data->data.c_str());
+		return;
+	}
+
+	/* Append a reference to the shared data to the back of the queue */
+	sendq.push_back(SendQueue::Element(data));
+
+	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
+}
+
 bool SocketTimeout::Tick(time_t)
 {
 	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "SocketTimeout::Tick");
@@ -478,7 +724,8 @@ void StreamSocket::OnEventHandlerWrite()
 	if (!error.empty())
 		return;
 
-	DoWrite();
+	if (!StartWriteTask())
+		DoWrite();
 	CheckError(I_ERR_OTHER);
 }
 
@@ -522,9 +769,24 @@ void StreamSocket::AddIOHook(IOHook* newhook)
 	lasthook->SetNextHook(newhook);
 }
 
+void StreamSocket::InsertIOHook(IOHookMiddle* newhook)
+{
+	newhook->sendq.moveall(sendq);
+	newhook->precvq.assign(recvq, recvqpos, std::string::npos);
+	recvq.erase(recvqpos);
+
+	newhook->SetNextHook(iohook);
+	iohook = newhook;
+
+	if ((!newhook->precvq.empty()) && (newhook->OnStreamSocketRead(this, recvq) < 0))
+		SetError("Read Error");
+}
+
 size_t StreamSocket::getSendQSize() const
 {
 	size_t ret = sendq.bytes();
+	if (writetask)
+		ret += writetask->sendq.bytes();
 	IOHook* curr = GetIOHook();
 	while (curr)
 	{
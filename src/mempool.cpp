@@ -0,0 +1,190 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+namespace
+{
+	/** Alignment of the blocks, enough for any object we put in a pool
+	 */
+	const size_t BLOCK_ALIGN = 2 * sizeof(void*);
+
+	/** Round the size of an object up to the size of a block holding it
+	 */
+	size_t RoundToBlockSize(size_t objsize)
+	{
+		const size_t size = std::max(objsize, sizeof(void*));
+		return (size + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+	}
+
+	std::vector<insp::MemoryPool*>& GetPoolList()
+	{
+		static std::vector<insp::MemoryPool*> pools;
+		return pools;
+	}
+}
+
+insp::MemoryPool::MemoryPool(const char* poolname, size_t size)
+	: name(poolname)
+	, objsize(size)
+	, blocksize(RoundToBlockSize(size))
+	, slabblocks(std::max<size_t>(SLAB_SIZE / blocksize, 1))
+	, available(NULL)
+	, releases(0)
+	, inuse(0)
+	, peak(0)
+	, allocations(0)
+{
+	GetPoolList().push_back(this);
+}
+
+insp::MemoryPool::~MemoryPool()
+{
+	stdalgo::erase(GetPoolList(), this);
+}
+
+bool insp::MemoryPool::SlabLess(const Slab* a, const Slab* b)
+{
+	return std::less<char*>()(a->mem, b->mem);
+}
+
+void insp::MemoryPool::Link(Slab* slab)
+{
+	slab->prev = NULL;
+	slab->next = available;
+	if (available)
+		available->prev = slab;
+	available = slab;
+}
+
+void insp::MemoryPool::Unlink(Slab* slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		available = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+insp::MemoryPool::Slab* insp::MemoryPool::Grow()
+{
+	Slab* slab = new Slab;
+	slab->mem = static_cast<char*>(::operator new(slabblocks * blocksize));
+	slab->freelist = NULL;
+	slab->used = 0;
+
+	// Link the blocks so they are handed out in address order
+	for (size_t i = slabblocks; i > 0; i--)
+	{
+		FreeBlock* block = reinterpret_cast<FreeBlock*>(slab->mem + (i - 1) * blocksize);
+		block->next = slab->freelist;
+		slab->freelist = block;
+	}
+
+	slabs.insert(std::upper_bound(slabs.begin(), slabs.end(), slab, SlabLess), slab);
+	return slab;
+}
+
+std::vector<insp::MemoryPool::Slab*>::iterator insp::MemoryPool::FindSlab(void* ptr)
+{
+	// The slab of the block is the last one starting at or before it
+	Slab key;
+	key.mem = static_cast<char*>(ptr);
+	return std::upper_bound(slabs.begin(), slabs.end(), &key, SlabLess) - 1;
+}
+
+void* insp::MemoryPool::Allocate(size_t size)
+{
+	if (size != objsize)
+		return ::operator new(size);
+
+	// Only start on an empty slab once all slabs in use are full
+	if (!available)
+	{
+		Slab* slab;
+		if (emptyslabs.empty())
+			slab = Grow();
+		else
+		{
+			slab = emptyslabs.back();
+			emptyslabs.pop_back();
+		}
+		Link(slab);
+	}
+
+	Slab* slab = available;
+	FreeBlock* block = slab->freelist;
+	slab->freelist = block->next;
+	slab->used++;
+	if (!slab->freelist)
+		Unlink(slab);
+
+	allocations++;
+	inuse++;
+	if (inuse > peak)
+		peak = inuse;
+	return block;
+}
+
+void insp::MemoryPool::Deallocate(void* ptr, size_t size)
+{
+	if (!ptr)
+		return;
+
+	if (size != objsize)
+	{
+		::operator delete(ptr);
+		return;
+	}
+
+	std::vector<Slab*>::iterator it = FindSlab(ptr);
+	Slab* slab = *it;
+	const bool wasfull = (!slab->freelist);
+
+	FreeBlock* block = static_cast<FreeBlock*>(ptr);
+	block->next = slab->freelist;
+	slab->freelist = block;
+	inuse--;
+
+	if (--slab->used)
+	{
+		if (wasfull)
+			Link(slab);
+		return;
+	}
+
+	if (!wasfull)
+		Unlink(slab);
+
+	if (emptyslabs.size() < SLAB_RESERVE)
+	{
+		emptyslabs.push_back(slab);
+		return;
+	}
+
+	// Enough empty slabs are kept for the next burst of allocations already
+	slabs.erase(it);
+	::operator delete(slab->mem);
+	delete slab;
+	releases++;
+}
+
+const std::vector<insp::MemoryPool*>& insp::MemoryPool::GetPools()
+{
+	return GetPoolList();
+}
@@ -0,0 +1,27 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "builtinmodes.h"
+
+ModeAction ModeChannelBan::OnModeChange(User* source, User* dest, Channel* channel, std::string& parameter, bool adding)
+{
+	ModeAction res = ListModeBase::OnModeChange(source, dest, channel, parameter, adding);
+	if (res == MODEACTION_ALLOW)
+		channel->InvalidateBanCache();
+	return res;
+}
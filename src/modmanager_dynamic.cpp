@@ -122,6 +122,7 @@ bool ModuleManager::Load(const std::string& modname, bool defer)
 
 	FOREACH_MOD(OnLoadModule, (newmod));
 	PrioritizeHooks();
+	InvalidateBanCaches();
 	ServerInstance->ISupport.Build();
 	return true;
 }
@@ -127,6 +127,7 @@ bool ModuleManager::Load(const std::string& inputname, bool defer)
 
 	FOREACH_MOD(OnLoadModule, (mod));
 	PrioritizeHooks();
+	InvalidateBanCaches();
 	ServerInstance->ISupport.Build();
 	return true;
 }
@@ -112,6 +112,7 @@ ModResult	Module::OnChangeLocalUserHost(LocalUser*, const std::string&) { Detach
 ModResult	Module::OnChangeLocalUserGECOS(LocalUser*, const std::string&) { DetachEvent(I_OnChangeLocalUserGECOS); return MOD_RES_PASSTHRU; }
 ModResult	Module::OnPreTopicChange(User*, Channel*, const std::string&) { DetachEvent(I_OnPreTopicChange); return MOD_RES_PASSTHRU; }
 ModResult	Module::OnPassCompare(Extensible* ex, const std::string &password, const std::string &input, const std::string& hashtype) { DetachEvent(I_OnPassCompare); return MOD_RES_PASSTHRU; }
+ModResult	Module::OnPassCompareAsync(PassCompareRequest* request) { DetachEvent(I_OnPassCompareAsync); return MOD_RES_PASSTHRU; }
 void		Module::OnPostConnect(User*) { DetachEvent(I_OnPostConnect); }
 void		Module::OnUserMessage(User*, void*, int, const std::string&, char, const CUList&, MessageType) { DetachEvent(I_OnUserMessage); }
 void		Module::OnUserInvite(User*, User*, Channel*, time_t, unsigned int, CUList&) { DetachEvent(I_OnUserInvite); }
@@ -354,8 +355,18 @@ void ModuleManager::UnregisterModes(Module* mod, ModeType modetype)
 	}
 }
 
+void ModuleManager::InvalidateBanCaches()
+{
+	const chan_hash& chans = ServerInstance->GetChans();
+	for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
+		i->second->InvalidateBanCache();
+}
+
 void ModuleManager::DoSafeUnload(Module* mod)
 {
+	// Tasks of the thread pool may run code of the module being unloaded
+	ServerInstance->Threads.FlushPool(mod);
+
 	// First, notify all modules that a module is about to be unloaded, so in case
 	// they pass execution to the soon to be unloaded module, it will happen now,
 	// i.e. before we unregister the services of the module being unloaded
@@ -405,6 +416,7 @@ void ModuleManager::DoSafeUnload(Module* mod)
 	dynamic_reference_base::reset_all();
 
 	DetachAll(mod);
+	InvalidateBanCaches();
 
 	Modules.erase(modfind);
 	ServerInstance->GlobalCulls.AddItem(mod);
@@ -110,6 +110,10 @@ typedef gnutls_connection_end_t inspircd_gnutls_session_init_flags_t;
 #define INSPIRCD_GNUTLS_HAS_CORK
 #endif
 
+#if INSPIRCD_GNUTLS_HAS_VERSION(2, 10, 0)
+#define INSPIRCD_GNUTLS_HAS_SESSION_TICKETS
+#endif
+
 static Module* thismod;
 
 class RandGen : public HandlerBase2<void, char*, size_t>
@@ -566,6 +570,179 @@ namespace GnuTLS
 		int ret() const { return retval; }
 	};
 
+	/** Server side cache of sessions which clients can resume by sending the session id
+	 */
+	class SessionCache
+	{
+		/** Keys in the order they were stored, the oldest entries are evicted first
+		 */
+		typedef std::list<std::string> OrderList;
+		OrderList order;
+
+		struct Entry
+		{
+			std::string data;
+			time_t expiry;
+			OrderList::iterator pos;
+		};
+		typedef std::map<std::string, Entry> EntryMap;
+
+		EntryMap entries;
+
+		/** Maximum number of entries
+		 */
+		const size_t maxsize;
+
+		/** Number of seconds a session can be resumed for
+		 */
+		const time_t timeout;
+
+		unsigned long hits;
+		unsigned long misses;
+
+		static int Store(void* ptr, gnutls_datum_t key, gnutls_datum_t data)
+		{
+			SessionCache* cache = static_cast<SessionCache*>(ptr);
+			const time_t now = ServerInstance->Time();
+
+			const std::string keystr(reinterpret_cast<const char*>(key.data), key.size);
+			EntryMap::iterator it = cache->entries.find(keystr);
+			if (it != cache->entries.end())
+			{
+				// Session is stored again, refresh it and make it the newest entry
+				cache->order.splice(cache->order.end(), cache->order, it->second.pos);
+			}
+			else
+			{
+				// Drop expired and excess entries from the front
+				while (!cache->order.empty())
+				{
+					EntryMap::iterator oldest = cache->entries.find(cache->order.front());
+					if ((oldest->second.expiry > now) && (cache->entries.size() < cache->maxsize))
+						break;
+
+					cache->entries.erase(oldest);
+					cache->order.pop_front();
+				}
+
+				it = cache->entries.insert(std::make_pair(keystr, Entry())).first;
+				it->second.pos = cache->order.insert(cache->order.end(), keystr);
+			}
+
+			it->second.data.assign(reinterpret_cast<const char*>(data.data), data.size);
+			it->second.expiry = now + cache->timeout;
+			return 0;
+		}
+
+		static gnutls_datum_t Retrieve(void* ptr, gnutls_datum_t key)
+		{
+			SessionCache* cache = static_cast<SessionCache*>(ptr);
+			gnutls_datum_t ret = { NULL, 0 };
+
+			EntryMap::iterator it = cache->entries.find(std::string(reinterpret_cast<const char*>(key.data), key.size));
+			if ((it == cache->entries.end()) || (it->second.expiry <= ServerInstance->Time()))
+			{
+				cache->misses++;
+				return ret;
+			}
+
+			// GnuTLS frees the returned data
+			ret.data = static_cast<unsigned char*>(gnutls_malloc(it->second.data.size()));
+			if (!ret.data)
+				return ret;
+
+			memcpy(ret.data, it->second.data.data(), it->second.data.size());
+			ret.size = it->second.data.size();
+			cache->hits++;
+			return ret;
+		}
+
+		static int Remove(void* ptr, gnutls_datum_t key)
+		{
+			SessionCache* cache = static_cast<SessionCache*>(ptr);
+			EntryMap::iterator it = cache->entries.find(std::string(reinterpret_cast<const char*>(key.data), key.size));
+			if (it != cache->entries.end())
+			{
+				cache->order.erase(it->second.pos);
+				cache->entries.erase(it);
+			}
+			return 0;
+		}
+
+	 public:
+		SessionCache(size_t Maxsize, time_t Timeout)
+			: maxsize(Maxsize)
+			, timeout(Timeout)
+			, hits(0)
+			, misses(0)
+		{
+		}
+
+		/** Make a server session use this cache
+		 */
+		void SetupSession(gnutls_session_t sess)
+		{
+			gnutls_db_set_ptr(sess, this);
+			gnutls_db_set_store_function(sess, Store);
+			gnutls_db_set_retrieve_function(sess, Retrieve);
+			gnutls_db_set_remove_function(sess, Remove);
+		}
+
+		std::string GetStats() const
+		{
+			return InspIRCd::Format("session cache %lu/%lu entries, %lu hits, %lu misses",
+				(unsigned long)entries.size(), (unsigned long)maxsize, hits, misses);
+		}
+	};
+
+#ifdef INSPIRCD_GNUTLS_HAS_SESSION_TICKETS
+	/** Master key for session tickets, replaced with a new random key after a configurable lifetime.
+	 * Tickets encrypted with the old key are rejected and those clients do a full handshake.
+	 */
+	class TicketKey : public refcountbase
+	{
+		gnutls_datum_t key;
+		time_t created;
+		const time_t lifetime;
+
+	 public:
+		TicketKey(time_t Lifetime)
+			: created(0)
+			, lifetime(Lifetime)
+		{
+			key.data = NULL;
+			key.size = 0;
+		}
+
+		~TicketKey()
+		{
+			gnutls_free(key.data);
+		}
+
+		time_t GetLifetime() const { return lifetime; }
+
+		/** Get the current key, generating a new one if it has expired
+		 * @return Key or NULL if no key could be generated
+		 */
+		const gnutls_datum_t* Get()
+		{
+			const time_t now = ServerInstance->Time();
+			if (created + lifetime <= now)
+			{
+				gnutls_datum_t newkey;
+				if (gnutls_session_ticket_key_generate(&newkey) < 0)
+					return (key.data ? &key : NULL);
+
+				// Sessions make a copy of the key so the old one can be freed
+				gnutls_free(key.data);
+				key = newkey;
+				created = now;
+			}
+			return &key;
+		}
+	};
+#endif
+
 	class Profile : public refcountbase
 	{
 		/** Name of this profile
@@ -596,10 +773,29 @@ namespace GnuTLS
 		 */
 		const bool requestclientcert;
 
+		/** Number of seconds a session can be resumed for
+		 */
+		const unsigned int sessiontimeout;
+
+		/** Cache of sessions clients can resume, NULL if disabled
+		 */
+		std::auto_ptr<SessionCache> cache;
+
+#ifdef INSPIRCD_GNUTLS_HAS_SESSION_TICKETS
+		/** Key for the session tickets sent to clients, NULL if disabled
+		 */
+		reference<TicketKey> ticketkey;
+#endif
+
+		/** Number of completed handshakes and how many of those resumed an earlier session
+		 */
+		unsigned long handshakes;
+		unsigned long resumed;
+
 		Profile(const std::string& profilename, const std::string& certstr, const std::string& keystr,
 				std::auto_ptr<DHParams>& DH, unsigned int mindh, const std::string& hashstr,
 				const std::string& priostr, std::auto_ptr<X509CertList>& CA, std::auto_ptr<X509CRL>& CRL,
-				unsigned int recsize, bool Requestclientcert)
+				unsigned int recsize, bool Requestclientcert, ConfigTag* tag)
 			: name(profilename)
 			, x509cred(certstr, keystr)
 			, min_dh_bits(mindh)
@@ -607,7 +803,19 @@ namespace GnuTLS
 			, priority(priostr)
 			, outrecsize(recsize)
 			, requestclientcert(Requestclientcert)
-		{
+			, sessiontimeout(tag->getDuration("sessiontimeout", 3600, 1))
+			, handshakes(0)
+			, resumed(0)
+		{
+			// Allow clients to skip the full handshake when they reconnect, either by
+			// using a session from our cache or by sending a session ticket
+			if (tag->getBool("sessioncache", true))
+				cache.reset(new SessionCache(tag->getInt("sessioncachesize", 20480, 1), sessiontimeout));
+#ifdef INSPIRCD_GNUTLS_HAS_SESSION_TICKETS
+			if (tag->getBool("tickets", true))
+				ticketkey = new TicketKey(tag->getDuration("ticketkeylifetime", 3600, 60));
+#endif
+
 			x509cred.SetDH(DH);
 			x509cred.SetCA(CA, CRL);
 		}
@@ -680,7 +888,7 @@ namespace GnuTLS
 
 			const bool requestclientcert = tag->getBool("requestclientcert", true);
 
-			return new Profile(profilename, certstr, keystr, dh, mindh, hashstr, priostr, ca, crl, outrecsize, requestclientcert);
+			return new Profile(profilename, certstr, keystr, dh, mindh, hashstr, priostr, ca, crl, outrecsize, requestclientcert, tag);
 		}
 
 		/** Set up the given session with the settings in this profile
@@ -696,6 +904,53 @@ namespace GnuTLS
 				gnutls_certificate_server_set_request(sess, GNUTLS_CERT_REQUEST);
 		}
 
+		/** Set up session resumption for the given server session
+		 */
+		void SetupServerSession(gnutls_session_t sess)
+		{
+			gnutls_db_set_cache_expiration(sess, sessiontimeout);
+			if (cache.get())
+				cache->SetupSession(sess);
+
+#ifdef INSPIRCD_GNUTLS_HAS_SESSION_TICKETS
+			if (ticketkey)
+			{
+				const gnutls_datum_t* key = ticketkey->Get();
+				if (key)
+					gnutls_session_ticket_enable_server(sess, key);
+			}
+#endif
+		}
+
+		/** Keep using the ticket key of the profile this one replaces on rehash if the ticket settings are
+		 * unchanged so tickets given to clients before the rehash can still be used
+		 * @param oldprofile Profile with the same name that is being replaced
+		 */
+		void KeepTicketKey(const Profile& oldprofile)
+		{
+#ifdef INSPIRCD_GNUTLS_HAS_SESSION_TICKETS
+			if ((ticketkey) && (oldprofile.ticketkey) && (ticketkey->GetLifetime() == oldprofile.ticketkey->GetLifetime()))
+				ticketkey = oldprofile.ticketkey;
+#endif
+		}
+
+		void OnHandshakeDone(bool reused)
+		{
+			handshakes++;
+			if (reused)
+				resumed++;
+		}
+
+		std::string GetStats() const
+		{
+			std::string stats = InspIRCd::Format("%lu handshakes, %lu resumed, ", handshakes, resumed);
+			if (cache.get())
+				stats.append(cache->GetStats());
+			else
+				stats.append("session cache disabled");
+			return stats;
+		}
+
 		const std::string& GetName() const { return name; }
 		X509Credentials& GetX509Credentials() { return x509cred; }
 		gnutls_digest_algorithm_t GetHash() const { return hash.get(); }
@@ -761,6 +1016,7 @@ class GnuTLSIOHook : public SSLIOHook
 		{
 			// Change the seesion state
 			this->status = ISSL_HANDSHAKEN;
+			profile->OnHandshakeDone(gnutls_session_is_resumed(this->sess));
 
 			VerifyCertificate();
 
@@ -1061,6 +1317,8 @@ info_done_dealloc:
 #endif
 		gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
 		profile->SetupSession(sess);
+		if (flags == GNUTLS_SERVER)
+			profile->SetupServerSession(sess);
 
 		sock->AddIOHook(this);
 		Handshake(sock);
@@ -1241,6 +1499,8 @@ class GnuTLSIOHookProvider : public refcountbase, public IOHookProvider
 		ServerInstance->Modules->DelService(*this);
 	}
 
+	GnuTLS::Profile* GetProfile() { return profile; }
+
 	void OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE
 	{
 		new GnuTLSIOHook(this, sock, GNUTLS_SERVER, profile);
@@ -1261,6 +1521,21 @@ class ModuleSSLGnuTLS : public Module
 	RandGen randhandler;
 	ProfileList profiles;
 
+	/** Make a profile created on rehash keep the ticket key of the profile with the same name, if there is one
+	 */
+	void KeepTicketKey(GnuTLS::Profile* profile)
+	{
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			GnuTLS::Profile* oldprofile = (*i)->GetProfile();
+			if (oldprofile->GetName() == profile->GetName())
+			{
+				profile->KeepTicketKey(*oldprofile);
+				return;
+			}
+		}
+	}
+
 	void ReadProfiles()
 	{
 		// First, store all profiles in a new, temporary container. If no problems occur, swap the two
@@ -1279,6 +1554,7 @@ class ModuleSSLGnuTLS : public Module
 			try
 			{
 				reference<GnuTLS::Profile> profile(GnuTLS::Profile::Create(defname, tag));
+				KeepTicketKey(profile);
 				newprofiles.push_back(new GnuTLSIOHookProvider(this, profile));
 			}
 			catch (CoreException& ex)
@@ -1310,6 +1586,7 @@ class ModuleSSLGnuTLS : public Module
 				throw ModuleException("Error while initializing SSL profile \"" + name + "\" at " + tag->getTagLocation() + " - " + ex.GetReason());
 			}
 
+			KeepTicketKey(profile);
 			newprofiles.push_back(new GnuTLSIOHookProvider(this, profile));
 		}
 
@@ -1374,6 +1651,19 @@ class ModuleSSLGnuTLS : public Module
 		return Version("Provides SSL support for clients", VF_VENDOR);
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 'h')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			GnuTLS::Profile* profile = (*i)->GetProfile();
+			stats.AddRow(249, "SSL profile " + profile->GetName() + " (GnuTLS): " + profile->GetStats());
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
 	ModResult OnCheckReady(LocalUser* user) CXX11_OVERRIDE
 	{
 		const GnuTLSIOHook* const iohook = static_cast<GnuTLSIOHook*>(user->eh.GetModHook(this));
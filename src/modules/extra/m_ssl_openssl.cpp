@@ -48,6 +48,8 @@
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
 
 #ifdef _WIN32
 # pragma comment(lib, "ssleay32.lib")
@@ -68,6 +70,20 @@
 # define INSPIRCD_OPENSSL_OPAQUE_BIO
 #endif
 
+// The HMAC_CTX based session ticket key callback is deprecated in OpenSSL 3.0.
+#if ((!defined LIBRESSL_VERSION_NUMBER) && (OPENSSL_VERSION_NUMBER >= 0x30000000L))
+# define INSPIRCD_OPENSSL_EVP_TICKET_CALLBACK
+# include <openssl/core_names.h>
+typedef EVP_MAC_CTX TicketMACContext;
+#else
+typedef HMAC_CTX TicketMACContext;
+#endif
+
+// Kernel TLS needs OpenSSL 3.0 built with it enabled; LibreSSL and older OpenSSL don't have it.
+#if ((defined SSL_OP_ENABLE_KTLS) && (defined BIO_get_ktls_send))
+# define INSPIRCD_OPENSSL_KTLS
+#endif
+
 enum issl_status { ISSL_NONE, ISSL_HANDSHAKING, ISSL_OPEN };
 
 static bool SelfSigned = false;
@@ -80,6 +96,7 @@ char* get_error()
 
 static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx);
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cctx, TicketMACContext* hctx, int enc);
 
 namespace OpenSSL
 {
@@ -181,6 +198,53 @@ namespace OpenSSL
 		}
 #endif
 
+		void SetSessionCache(long size, long timeout)
+		{
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+			SSL_CTX_sess_set_cache_size(ctx, size);
+			SSL_CTX_set_timeout(ctx, timeout);
+		}
+
+		bool SetSessionIdContext(const std::string& context)
+		{
+			// Sessions are only resumed in the context they were created in, this is
+			// also required for resumption when client certificates are requested
+			const unsigned int len = std::min<size_t>(context.length(), SSL_MAX_SID_CTX_LENGTH);
+			return SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>(context.data()), len);
+		}
+
+		void EnableTickets()
+		{
+#ifdef SSL_OP_NO_TICKET
+			SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+#endif
+#ifdef INSPIRCD_OPENSSL_EVP_TICKET_CALLBACK
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, OnTicketKey);
+#else
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, OnTicketKey);
+#endif
+		}
+
+		bool EnableKernelTLS()
+		{
+#ifdef INSPIRCD_OPENSSL_KTLS
+			SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		std::string GetSessionCacheStats() const
+		{
+			if (SSL_CTX_get_session_cache_mode(ctx) == SSL_SESS_CACHE_OFF)
+				return "session cache disabled";
+
+			return InspIRCd::Format("session cache %ld/%ld entries, %ld hits, %ld misses, %ld timeouts",
+				SSL_CTX_sess_number(ctx), SSL_CTX_sess_get_cache_size(ctx), SSL_CTX_sess_hits(ctx),
+				SSL_CTX_sess_misses(ctx), SSL_CTX_sess_timeouts(ctx));
+		}
+
 		bool SetCiphers(const std::string& ciphers)
 		{
 			ERR_clear_error();
@@ -240,6 +304,84 @@ namespace OpenSSL
 		}
 	};
 
+	/** Keys used to encrypt and authenticate session tickets. The keys are replaced after
+	 * a configurable lifetime, tickets encrypted with the previous key are accepted for one
+	 * more lifetime and are replaced with a ticket encrypted with the current key.
+	 */
+	class TicketKeys : public refcountbase
+	{
+	 public:
+		struct Key
+		{
+			unsigned char name[16];
+			unsigned char aeskey[32];
+			unsigned char hmackey[32];
+			time_t created;
+		};
+
+	 private:
+		Key current;
+		Key previous;
+
+		/** Number of seconds a key is used to encrypt new tickets
+		 */
+		const time_t lifetime;
+
+		bool IsUsable(const Key& key, const unsigned char* name) const
+		{
+			return ((key.created) && (key.created + lifetime * 2 > ServerInstance->Time()) && (!memcmp(key.name, name, sizeof(key.name))));
+		}
+
+	 public:
+		TicketKeys(time_t Lifetime)
+			: lifetime(Lifetime)
+		{
+			current.created = previous.created = 0;
+		}
+
+		time_t GetLifetime() const { return lifetime; }
+
+		/** Get the key to encrypt a new ticket with, generating a new one if the current key has expired
+		 * @return Current key or NULL if a new key could not be generated
+		 */
+		const Key* GetEncryptionKey()
+		{
+			const time_t now = ServerInstance->Time();
+			if (current.created + lifetime <= now)
+			{
+				Key key;
+				if ((RAND_bytes(key.name, sizeof(key.name)) <= 0) || (RAND_bytes(key.aeskey, sizeof(key.aeskey)) <= 0) || (RAND_bytes(key.hmackey, sizeof(key.hmackey)) <= 0))
+					return NULL;
+
+				key.created = now;
+				previous = current;
+				current = key;
+			}
+			return &current;
+		}
+
+		/** Find the key a ticket was encrypted with
+		 * @param name Name of the key from the ticket
+		 * @param renew Set to true if the ticket should be replaced with one encrypted with a newer key
+		 * @return Key or NULL if the key is unknown or too old
+		 */
+		const Key* GetDecryptionKey(const unsigned char* name, bool& renew) const
+		{
+			if (IsUsable(current, name))
+			{
+				renew = (current.created + lifetime <= ServerInstance->Time());
+				return &current;
+			}
+
+			if (IsUsable(previous, name))
+			{
+				renew = true;
+				return &previous;
+			}
+			return NULL;
+		}
+	};
+
 	class Profile : public refcountbase
 	{
 		/** Name of this profile
@@ -271,6 +413,21 @@ namespace OpenSSL
 		 */
 		const unsigned int outrecsize;
 
+		/** Keys for the session tickets sent to clients
+		 */
+		reference<TicketKeys> ticketkeys;
+
+		/** True if record encryption should be offloaded to the kernel when possible
+		 */
+		bool kerneltls;
+
+		/** Number of completed handshakes, how many of those resumed an earlier session
+		 * and how many connections send their data through kernel TLS
+		 */
+		unsigned long handshakes;
+		unsigned long resumed;
+		unsigned long kerneltlsconns;
+
 		static int error_callback(const char* str, size_t len, void* u)
 		{
 			Profile* profile = reinterpret_cast<Profile*>(u);
@@ -312,6 +469,11 @@ namespace OpenSSL
 			, clictx(SSL_CTX_new(SSLv23_client_method()))
 			, allowrenego(tag->getBool("renegotiation")) // Disallow by default
 			, outrecsize(tag->getInt("outrecsize", 2048, 512, 16384))
+			, ticketkeys(new TicketKeys(tag->getDuration("ticketkeylifetime", 3600, 60)))
+			, kerneltls(false)
+			, handshakes(0)
+			, resumed(0)
+			, kerneltlsconns(0)
 		{
 			if ((!ctx.SetDH(dh)) || (!clictx.SetDH(dh)))
 				throw Exception("Couldn't set DH parameters");
@@ -340,6 +502,24 @@ namespace OpenSSL
 			SetContextOptions("server", tag, ctx);
 			SetContextOptions("client", tag, clictx);
 
+			// Allow clients to skip the full handshake when they reconnect, either by
+			// using a session from our cache or by sending a session ticket
+			if (!ctx.SetSessionIdContext("inspircd/" + name))
+				throw Exception("Couldn't set session id context");
+
+			if (tag->getBool("sessioncache", true))
+				ctx.SetSessionCache(tag->getInt("sessioncachesize", 20480, 1), tag->getDuration("sessiontimeout", 3600, 1));
+			if (tag->getBool("tickets", true))
+				ctx.EnableTickets();
+
+			// OpenSSL falls back to encrypting in userspace if the kernel does not support the cipher
+			if (tag->getBool("ktls"))
+			{
+				kerneltls = ((ctx.EnableKernelTLS()) && (clictx.EnableKernelTLS()));
+				if (!kerneltls)
+					ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Kernel TLS is not supported by this version of OpenSSL, not enabling it for profile \"%s\"", name.c_str());
+			}
+
 			/* Load our keys and certificates
 			 * NOTE: OpenSSL's error logging API sucks, don't blame us for this clusterfuck.
 			 */
@@ -376,6 +556,36 @@ namespace OpenSSL
 		const EVP_MD* GetDigest() { return digest; }
 		bool AllowRenegotiation() const { return allowrenego; }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
+		TicketKeys& GetTicketKeys() { return *ticketkeys; }
+
+		/** Keep using the ticket keys of the profile this one replaces on rehash if the ticket key
+		 * lifetime is unchanged so tickets given to clients before the rehash can still be used
+		 * @param oldprofile Profile with the same name that is being replaced
+		 */
+		void KeepTicketKeys(const Profile& oldprofile)
+		{
+			if (ticketkeys->GetLifetime() == oldprofile.ticketkeys->GetLifetime())
+				ticketkeys = oldprofile.ticketkeys;
+		}
+
+		bool UseKernelTLS() const { return kerneltls; }
+
+		void OnHandshakeDone(bool reused, bool kernelsend)
+		{
+			handshakes++;
+			if (reused)
+				resumed++;
+			if (kernelsend)
+				kerneltlsconns++;
+		}
+
+		std::string GetStats() const
+		{
+			std::string stats = InspIRCd::Format("%lu handshakes, %lu resumed, ", handshakes, resumed);
+			if (kerneltls)
+				stats.append(ConvToStr(kerneltlsconns)).append(" using kernel TLS, ");
+			return stats + ctx.GetSessionCacheStats();
+		}
 	};
 
 	namespace BIOMethod
@@ -461,6 +671,22 @@ class OpenSSLIOHook : public SSLIOHook
 	bool data_to_write;
 	reference<OpenSSL::Profile> profile;
 
+	/** True if the kernel encrypts the data we send, in that case the sendq is written to the socket as is
+	 */
+	bool kernelsend;
+
+	// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
+	static BIO* CreateSocketBIO(StreamSocket* sock)
+	{
+#ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
+		BIO* bio = BIO_new(biomethods);
+#else
+		BIO* bio = BIO_new(&biomethods);
+#endif
+		BIO_set_data(bio, sock);
+		return bio;
+	}
+
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
@@ -491,6 +717,18 @@ class OpenSSLIOHook : public SSLIOHook
 		else if (ret > 0)
 		{
 			// Handshake complete.
+#ifdef INSPIRCD_OPENSSL_KTLS
+			if (profile->UseKernelTLS())
+			{
+				kernelsend = BIO_get_ktls_send(SSL_get_wbio(sess));
+				if (!kernelsend)
+				{
+					// The kernel didn't take the keys, let the socket engine do the writes again
+					SSL_set0_wbio(sess, CreateSocketBIO(user));
+				}
+			}
+#endif
+			profile->OnHandshakeDone(SSL_session_reused(sess), kernelsend);
 			VerifyCertificate();
 
 			status = ISSL_OPEN;
@@ -628,15 +866,20 @@ class OpenSSLIOHook : public SSLIOHook
 		, status(ISSL_NONE)
 		, data_to_write(false)
 		, profile(sslprofile)
+		, kernelsend(false)
 	{
-		// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
-#ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
-		BIO* bio = BIO_new(biomethods);
-#else
-		BIO* bio = BIO_new(&biomethods);
-#endif
-		BIO_set_data(bio, sock);
-		SSL_set_bio(sess, bio, bio);
+		BIO* bio = CreateSocketBIO(sock);
+		if (profile->UseKernelTLS())
+		{
+			// OpenSSL can only hand the keys to the kernel when it writes to the socket itself.
+			// Handshake records written this way are not counted by the socket engine, after
+			// the handshake the writes go through the socket engine again (see Handshake()).
+			SSL_set_bio(sess, bio, BIO_new_socket(sock->GetFd(), BIO_NOCLOSE));
+		}
+		else
+		{
+			SSL_set_bio(sess, bio, bio);
+		}
 
 		SSL_set_ex_data(sess, exdataindex, this);
 		sock->AddIOHook(this);
@@ -715,6 +958,12 @@ class OpenSSLIOHook : public SSLIOHook
 		if (prepret <= 0)
 			return prepret;
 
+		if (kernelsend)
+		{
+			user->FlushSendQ(sendq);
+			return 1;
+		}
+
 		data_to_write = true;
 
 		// Session is ready for transferring application data
@@ -723,7 +972,7 @@ class OpenSSLIOHook : public SSLIOHook
 			ERR_clear_error();
 			FlattenSendQueue(sendq, profile->GetOutgoingRecordSize());
 			const StreamSocket::SendQueue::Element& buffer = sendq.front();
-			int ret = SSL_write(sess, buffer.data(), buffer.size());
+			int ret = SSL_write(sess, buffer.data(), buffer.length());
 
 			if (!CheckRenego(user))
 				return -1;
@@ -789,6 +1038,7 @@ class OpenSSLIOHook : public SSLIOHook
 		return true;
 	}
 
+	OpenSSL::Profile* GetProfile() { return profile; }
 	bool IsHandshakeDone() const { return (status == ISSL_OPEN); }
 };
 
@@ -798,6 +1048,50 @@ static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc)
 	hook->SSLInfoCallback(where, rc);
 }
 
+static bool SetTicketMACKey(TicketMACContext* hctx, const OpenSSL::TicketKeys::Key* key)
+{
+#ifdef INSPIRCD_OPENSSL_EVP_TICKET_CALLBACK
+	char digest[] = "SHA256";
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key->hmackey), sizeof(key->hmackey));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0);
+	params[2] = OSSL_PARAM_construct_end();
+	return EVP_MAC_CTX_set_params(hctx, params);
+#else
+	return HMAC_Init_ex(hctx, key->hmackey, sizeof(key->hmackey), EVP_sha256(), NULL);
+#endif
+}
+
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cctx, TicketMACContext* hctx, int enc)
+{
+	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
+	OpenSSL::TicketKeys& keys = hook->GetProfile()->GetTicketKeys();
+	const EVP_CIPHER* const cipher = EVP_aes_256_cbc();
+
+	if (enc)
+	{
+		// Issuing a new ticket
+		const OpenSSL::TicketKeys::Key* key = keys.GetEncryptionKey();
+		if ((!key) || (RAND_bytes(iv, EVP_CIPHER_iv_length(cipher)) <= 0))
+			return -1;
+
+		memcpy(keyname, key->name, sizeof(key->name));
+		if ((!EVP_EncryptInit_ex(cctx, cipher, NULL, key->aeskey, iv)) || (!SetTicketMACKey(hctx, key)))
+			return -1;
+		return 1;
+	}
+
+	// Resuming from a ticket, a return value of 0 makes the client do a full handshake
+	bool renew;
+	const OpenSSL::TicketKeys::Key* key = keys.GetDecryptionKey(keyname, renew);
+	if (!key)
+		return 0;
+
+	if ((!SetTicketMACKey(hctx, key)) || (!EVP_DecryptInit_ex(cctx, cipher, NULL, key->aeskey, iv)))
+		return -1;
+	return (renew ? 2 : 1);
+}
+
 static int OpenSSL::BIOMethod::write(BIO* bio, const char* buffer, int size)
 {
 	BIO_clear_retry_flags(bio);
@@ -861,6 +1155,8 @@ class OpenSSLIOHookProvider : public refcountbase, public IOHookProvider
 		ServerInstance->Modules->DelService(*this);
 	}
 
+	OpenSSL::Profile* GetProfile() { return profile; }
+
 	void OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE
 	{
 		new OpenSSLIOHook(this, sock, profile->CreateServerSession(), profile);
@@ -878,6 +1174,21 @@ class ModuleSSLOpenSSL : public Module
 
 	ProfileList profiles;
 
+	/** Make a profile created on rehash keep the ticket keys of the profile with the same name, if there is one
+	 */
+	void KeepTicketKeys(OpenSSL::Profile* profile)
+	{
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			OpenSSL::Profile* oldprofile = (*i)->GetProfile();
+			if (oldprofile->GetName() == profile->GetName())
+			{
+				profile->KeepTicketKeys(*oldprofile);
+				return;
+			}
+		}
+	}
+
 	void ReadProfiles()
 	{
 		ProfileList newprofiles;
@@ -892,6 +1203,7 @@ class ModuleSSLOpenSSL : public Module
 			try
 			{
 				reference<OpenSSL::Profile> profile(new OpenSSL::Profile(defname, tag));
+				KeepTicketKeys(profile);
 				newprofiles.push_back(new OpenSSLIOHookProvider(this, profile));
 			}
 			catch (OpenSSL::Exception& ex)
@@ -923,6 +1235,7 @@ class ModuleSSLOpenSSL : public Module
 				throw ModuleException("Error while initializing SSL profile \"" + name + "\" at " + tag->getTagLocation() + " - " + ex.GetReason());
 			}
 
+			KeepTicketKeys(profile);
 			newprofiles.push_back(new OpenSSLIOHookProvider(this, profile));
 		}
 
@@ -988,6 +1301,19 @@ class ModuleSSLOpenSSL : public Module
 		}
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 'h')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			OpenSSL::Profile* profile = (*i)->GetProfile();
+			stats.AddRow(249, "SSL profile " + profile->GetName() + " (OpenSSL): " + profile->GetStats());
+		}
+		return MOD_RES_PASSTHRU;
+	}
+
 	ModResult OnCheckReady(LocalUser* user) CXX11_OVERRIDE
 	{
 		const OpenSSLIOHook* const iohook = static_cast<OpenSSLIOHook*>(user->eh.GetModHook(this));
@@ -0,0 +1,282 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// $CompilerFlags: find_compiler_flags("zlib")
+/// $LinkerFlags: find_linker_flags("zlib" "-lz")
+
+/// $PackageInfo: require_system("darwin") pkg-config zlib
+/// $PackageInfo: require_system("debian") zlib1g-dev pkg-config
+/// $PackageInfo: require_system("ubuntu") zlib1g-dev pkg-config
+
+#include "inspircd.h"
+#include "iohook.h"
+#include "modules/compression.h"
+#include <zlib.h>
+
+/** Compresses the data written to a socket or decompresses the data read from it.
+ * The other direction passes through the hook unmodified.
+ */
+class ZlibHook : public IOHookMiddle
+{
+	/** Size of the buffer zlib writes its output to
+	 */
+	static const size_t bufsize = 16384;
+
+	z_stream stream;
+
+	/** True if the stream could not be initialized or zlib reported an error
+	 */
+	bool failed;
+
+	/** Pass data to zlib and append the output to a string
+	 * @param data Data to compress or decompress
+	 * @param len Length of the data
+	 * @param flush Flush mode passed to deflate(), unused when decompressing
+	 * @param out String to append the output to
+	 * @return True on success, false on error
+	 */
+	bool Process(const char* data, size_t len, int flush, std::string& out)
+	{
+		char buf[bufsize];
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		stream.avail_in = len;
+		do
+		{
+			stream.next_out = reinterpret_cast<Bytef*>(buf);
+			stream.avail_out = bufsize;
+			const int ret = (compress ? deflate(&stream, flush) : inflate(&stream, Z_NO_FLUSH));
+			// Z_BUF_ERROR only means that no progress was possible
+			if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+				return false;
+			out.append(buf, bufsize - stream.avail_out);
+		}
+		while (stream.avail_out == 0);
+		return true;
+	}
+
+ public:
+	/** True if the hook compresses the data written to the socket, false if it decompresses the data read from it
+	 */
+	const bool compress;
+
+	/** Number of bytes passed to zlib and produced by it
+	 */
+	unsigned long long bytesin;
+	unsigned long long bytesout;
+
+	/** CPU time spent compressing or decompressing
+	 */
+	clock_t cputime;
+
+	ZlibHook(IOHookProvider* Prov, bool Compress, int level)
+		: IOHookMiddle(Prov)
+		, compress(Compress)
+		, bytesin(0)
+		, bytesout(0)
+		, cputime(0)
+	{
+		memset(&stream, 0, sizeof(stream));
+		const int ret = (compress ? deflateInit(&stream, level) : inflateInit(&stream));
+		failed = (ret != Z_OK);
+	}
+
+	~ZlibHook()
+	{
+		if (compress)
+			deflateEnd(&stream);
+		else
+			inflateEnd(&stream);
+	}
+
+	int OnStreamSocketWrite(StreamSocket* sock, StreamSocket::SendQueue& uppersendq) CXX11_OVERRIDE
+	{
+		StreamSocket::SendQueue& mysendq = GetSendQ();
+		if (!compress)
+		{
+			mysendq.moveall(uppersendq);
+			return 1;
+		}
+
+		if (failed)
+			return -1;
+
+		if (uppersendq.empty())
+			return 1;
+
+		// Flush the output after the last element so the other side can process all lines
+		// without waiting for more data
+		const clock_t start = clock();
+		std::string out;
+		for (StreamSocket::SendQueue::const_iterator i = uppersendq.begin(); i != uppersendq.end(); ++i)
+		{
+			const StreamSocket::SendQueue::Element& elem = *i;
+			const int flush = (i+1 == uppersendq.end() ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+			if (!Process(elem.data(), elem.length(), flush, out))
+			{
+				failed = true;
+				return -1;
+			}
+		}
+
+		bytesin += uppersendq.bytes();
+		bytesout += out.size();
+		uppersendq.clear();
+		mysendq.push_back(out);
+		cputime += clock() - start;
+		return 1;
+	}
+
+	int OnStreamSocketRead(StreamSocket* sock, std::string& destrecvq) CXX11_OVERRIDE
+	{
+		std::string& myrecvq = GetRecvQ();
+		if (compress)
+		{
+			destrecvq.append(myrecvq);
+			myrecvq.clear();
+			return 1;
+		}
+
+		if (failed)
+			return -1;
+
+		const clock_t start = clock();
+		const std::string::size_type prevsize = destrecvq.size();
+		if (!Process(myrecvq.data(), myrecvq.size(), Z_NO_FLUSH, destrecvq))
+		{
+			failed = true;
+			return -1;
+		}
+
+		bytesin += myrecvq.size();
+		bytesout += destrecvq.size() - prevsize;
+		myrecvq.clear();
+		cputime += clock() - start;
+		return (destrecvq.size() > prevsize ? 1 : 0);
+	}
+
+	void OnStreamSocketClose(StreamSocket* sock) CXX11_OVERRIDE
+	{
+	}
+};
+
+class ZlibProvider : public Compression::Provider
+{
+	/** Find the hook of this provider on a socket
+	 * @param sock Socket to search the hooks of
+	 * @param compress True to find the compressing hook, false to find the decompressing hook
+	 * @return Hook or NULL if the socket does not have one
+	 */
+	ZlibHook* FindHook(StreamSocket* sock, bool compress)
+	{
+		IOHook* hook = sock->GetIOHook();
+		while (hook)
+		{
+			if ((hook->prov == this) && (static_cast<ZlibHook*>(hook)->compress == compress))
+				return static_cast<ZlibHook*>(hook);
+
+			IOHookMiddle* const iohm = IOHookMiddle::ToMiddleHook(hook);
+			if (!iohm)
+				break;
+			hook = iohm->GetNextHook();
+		}
+		return NULL;
+	}
+
+ public:
+	/** Compression level passed to zlib
+	 */
+	int level;
+
+	ZlibProvider(Module* mod)
+		: Compression::Provider(mod, "zlib")
+		, level(Z_DEFAULT_COMPRESSION)
+	{
+	}
+
+	void OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE
+	{
+		OnConnect(sock);
+	}
+
+	void OnConnect(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		sock->AddIOHook(new ZlibHook(this, true, level));
+		sock->AddIOHook(new ZlibHook(this, false, level));
+	}
+
+	void StartCompress(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		if (!FindHook(sock, true))
+			sock->InsertIOHook(new ZlibHook(this, true, level));
+	}
+
+	void StartDecompress(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		if (!FindHook(sock, false))
+			sock->InsertIOHook(new ZlibHook(this, false, level));
+	}
+
+	std::string GetStats(StreamSocket* sock) CXX11_OVERRIDE
+	{
+		ZlibHook* const out = FindHook(sock, true);
+		ZlibHook* const in = FindHook(sock, false);
+		if ((!out) && (!in))
+			return std::string();
+
+		unsigned long long sent = 0, sentcompressed = 0, recvcompressed = 0, recv = 0;
+		clock_t cputime = 0;
+		if (out)
+		{
+			sent = out->bytesin;
+			sentcompressed = out->bytesout;
+			cputime += out->cputime;
+		}
+		if (in)
+		{
+			recvcompressed = in->bytesin;
+			recv = in->bytesout;
+			cputime += in->cputime;
+		}
+
+		return InspIRCd::Format("%s, sent %llu bytes compressed to %llu (%llu%%), received %llu bytes decompressed to %llu (%llu%%), CPU time %lu ms",
+			method.c_str(), sent, sentcompressed, (sent ? sentcompressed * 100 / sent : 100), recvcompressed, recv,
+			(recv ? recvcompressed * 100 / recv : 100), (unsigned long)(cputime * 1000 / CLOCKS_PER_SEC));
+	}
+};
+
+class ModuleZipLink : public Module
+{
+	ZlibProvider hookprov;
+
+ public:
+	ModuleZipLink()
+		: hookprov(this)
+	{
+	}
+
+	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
+	{
+		ConfigTag* tag = ServerInstance->Config->ConfValue("ziplink");
+		hookprov.level = tag->getInt("level", 6, 1, 9);
+	}
+
+	Version GetVersion() CXX11_OVERRIDE
+	{
+		return Version("Provides zlib compression for server links", VF_VENDOR);
+	}
+};
+
+MODULE_INIT(ModuleZipLink)
@@ -107,11 +107,12 @@ class ModuleAuditorium : public Module
 		if (IsVisible(memb))
 			return;
 
-		const Channel::MemberMap& users = memb->chan->GetUsers();
-		for (Channel::MemberMap::const_iterator i = users.begin(); i != users.end(); ++i)
+		const Channel::LocalMemberList& localusers = memb->chan->GetLocalUsers();
+		for (Channel::LocalMemberList::const_iterator i = localusers.begin(); i != localusers.end(); ++i)
 		{
-			if (IS_LOCAL(i->first) && !CanSee(i->first, memb))
-				excepts.insert(i->first);
+			User* member = (*i)->user;
+			if (!CanSee(member, memb))
+				excepts.insert(member);
 		}
 	}
 
@@ -144,11 +145,12 @@ class ModuleAuditorium : public Module
 			// this channel should not be considered when listing my neighbors
 			i = include.erase(i);
 			// however, that might hide me from ops that can see me...
-			const Channel::MemberMap& users = memb->chan->GetUsers();
-			for(Channel::MemberMap::const_iterator j = users.begin(); j != users.end(); ++j)
+			const Channel::LocalMemberList& localusers = memb->chan->GetLocalUsers();
+			for (Channel::LocalMemberList::const_iterator j = localusers.begin(); j != localusers.end(); ++j)
 			{
-				if (IS_LOCAL(j->first) && CanSee(j->first, memb))
-					exception[j->first] = true;
+				User* member = (*j)->user;
+				if (CanSee(member, memb))
+					exception[member] = true;
 			}
 		}
 	}
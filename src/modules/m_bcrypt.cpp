@@ -956,6 +956,11 @@ class BCryptProvider : public HashProvider
 		return raw;
 	}
 
+	bool IsSlow() const CXX11_OVERRIDE
+	{
+		return true;
+	}
+
 	BCryptProvider(Module* parent)
 		: HashProvider(parent, "bcrypt", 60)
 		, rounds(10)
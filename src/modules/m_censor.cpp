@@ -21,6 +21,7 @@
 
 
 #include "inspircd.h"
+#include "multimatch.h"
 #include "modules/exemption.h"
 
 typedef insp::flat_map<irc::string, irc::string> censor_t;
@@ -45,6 +46,12 @@ class ModuleCensor : public Module
 {
 	CheckExemption::EventProvider exemptionprov;
 	censor_t censors;
+
+	/** Finds the censored words in a message, the id of a word is its position in censors
+	 */
+	insp::MultiMatcher matcher;
+	insp::MultiMatcher::IdList found;
+
 	CensorUser cu;
 	CensorChannel cc;
 
@@ -79,9 +86,24 @@ class ModuleCensor : public Module
 		if (!active)
 			return MOD_RES_PASSTHRU;
 
+		found.clear();
+		if (!matcher.Find(text, found))
+			return MOD_RES_PASSTHRU;
+
 		irc::string text2 = text.c_str();
-		for (censor_t::iterator index = censors.begin(); index != censors.end(); index++)
+		bool replaced = false;
+		insp::MultiMatcher::IdList::const_iterator nextfound = found.begin();
+		for (size_t pos = found.front(); pos < censors.size(); pos++)
 		{
+			// Until a replacement changes the text only the words found by the matcher can occur in it
+			if (!replaced)
+			{
+				if (nextfound == found.end())
+					break;
+				pos = *nextfound++;
+			}
+
+			censor_t::const_iterator index = censors.begin() + pos;
 			if (text2.find(index->first) != irc::string::npos)
 			{
 				if (index->second.empty())
@@ -91,9 +113,12 @@ class ModuleCensor : public Module
 				}
 
 				stdalgo::string::replace_all(text2, index->first, index->second);
+				replaced = true;
 			}
 		}
-		text = text2.c_str();
+
+		if (replaced)
+			text = text2.c_str();
 		return MOD_RES_PASSTHRU;
 	}
 
@@ -114,6 +139,10 @@ class ModuleCensor : public Module
 			str = tag->getString("replace");
 			censors[pattern] = irc::string(str.c_str());
 		}
+
+		matcher.Clear();
+		for (censor_t::const_iterator i = censors.begin(); i != censors.end(); ++i)
+			matcher.Add(std::string(i->first.c_str(), i->first.length()), i - censors.begin());
 	}
 
 	Version GetVersion() CXX11_OVERRIDE
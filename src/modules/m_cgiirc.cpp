@@ -154,11 +154,22 @@ class ModuleCgiIRC : public Module, public Whois::EventListener
 	CommandWebIRC cmd;
 	std::vector<std::string> hosts;
 
-	static void RecheckClass(LocalUser* user)
+	/** Find the connect class of the user again and check them against it.
+	 * @return False if a connect class password is still being checked, in which case
+	 * the user keeps their previous class until the result arrives.
+	 */
+	static bool RecheckClass(LocalUser* user)
 	{
+		reference<ConnectClass> prevclass = user->MyClass;
 		user->MyClass = NULL;
 		user->SetClass();
+		if (user->classpending)
+		{
+			user->MyClass = prevclass;
+			return false;
+		}
 		user->CheckClass();
+		return true;
 	}
 
 	void HandleIdent(LocalUser* user, const std::string& newip)
@@ -239,7 +250,10 @@ public:
 		if (!cmd.realip.get(user))
 			return MOD_RES_PASSTHRU;
 
-		RecheckClass(user);
+		// The user timer calls us again once the password check has finished
+		if (!RecheckClass(user))
+			return MOD_RES_DENY;
+
 		if (user->quitting)
 			return MOD_RES_DENY;
 
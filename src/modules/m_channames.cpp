@@ -83,18 +83,17 @@ class ModuleChannelNames : public Module
 				ServerInstance->Modes->Process(ServerInstance->FakeClient, c, NULL, removepermchan);
 			}
 
-			Channel::MemberMap& users = c->userlist;
-			for (Channel::MemberMap::iterator j = users.begin(); j != users.end(); )
+			// KickUser invalidates the iterators of the member list, collect the local members first
+			std::vector<User*> localmembers;
+			const Channel::MemberMap& users = c->GetUsers();
+			for (Channel::MemberMap::const_iterator j = users.begin(); j != users.end(); ++j)
 			{
 				if (IS_LOCAL(j->first))
-				{
-					// KickUser invalidates the iterator
-					Channel::MemberMap::iterator it = j++;
-					c->KickUser(ServerInstance->FakeClient, it, "Channel name no longer valid");
-				}
-				else
-					++j;
+					localmembers.push_back(j->first);
 			}
+
+			for (std::vector<User*>::const_iterator j = localmembers.begin(); j != localmembers.end(); ++j)
+				c->KickUser(ServerInstance->FakeClient, *j, "Channel name no longer valid");
 		}
 		badchan = false;
 	}
@@ -92,21 +92,25 @@ class CommandClearChan : public Command
 		ServerInstance->Modules->Attach(hook, creator);
 
 		std::string mask;
-		// Now remove all local non-opers from the channel
-		Channel::MemberMap& users = chan->userlist;
-		for (Channel::MemberMap::iterator i = users.begin(); i != users.end(); )
+		// Now remove all local non-opers from the channel. Removing a member invalidates
+		// the iterators of the member list so collect the targets first.
+		std::vector<User*> targets;
+		const Channel::MemberMap& users = chan->GetUsers();
+		for (Channel::MemberMap::const_iterator i = users.begin(); i != users.end(); ++i)
 		{
 			User* curr = i->first;
-			const Channel::MemberMap::iterator currit = i;
-			++i;
+			if (IS_LOCAL(curr) && !curr->IsOper())
+				targets.push_back(curr);
+		}
 
-			if (!IS_LOCAL(curr) || curr->IsOper())
-				continue;
+		for (std::vector<User*>::const_iterator i = targets.begin(); i != targets.end(); ++i)
+		{
+			User* curr = *i;
 
 			// If kicking users, remove them and skip the QuitUser()
 			if (kick)
 			{
-				chan->KickUser(ServerInstance->FakeClient, currit, reason);
+				chan->KickUser(ServerInstance->FakeClient, curr, reason);
 				continue;
 			}
 
@@ -170,13 +174,10 @@ class ModuleClearChan : public Module
 			}
 		}
 
-		const Channel::MemberMap& users = cmd.activechan->GetUsers();
-		for (Channel::MemberMap::const_iterator i = users.begin(); i != users.end(); ++i)
+		const Channel::LocalMemberList& localusers = cmd.activechan->GetLocalUsers();
+		for (Channel::LocalMemberList::const_iterator i = localusers.begin(); i != localusers.end(); ++i)
 		{
-			LocalUser* curr = IS_LOCAL(i->first);
-			if (!curr)
-				continue;
-
+			User* curr = (*i)->user;
 			if (curr->IsOper())
 			{
 				// If another module has removed the channel we're working on from the list of channels
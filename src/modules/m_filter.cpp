@@ -22,6 +22,7 @@
 
 #include "inspircd.h"
 #include "xline.h"
+#include "multimatch.h"
 #include "modules/regex.h"
 
 enum FilterFlags
@@ -162,6 +163,24 @@ class ModuleFilter : public Module
 	RegexFactory* factory;
 	void FreeFilters();
 
+	/** Literal strings required by the filters matched against the text as is and
+	 * against the text with colors stripped. The id of a string is the index of its filter.
+	 */
+	insp::MultiMatcher plainindex;
+	insp::MultiMatcher strippedindex;
+
+	/** Indexes of the filters without a literal string, these are checked for every text
+	 */
+	insp::MultiMatcher::IdList unindexed;
+
+	/** True if the filter list changed since the indexes were built
+	 */
+	bool indexdirty;
+
+	/** Rebuild the indexes from the current filter list
+	 */
+	void BuildIndex();
+
  public:
 	CommandFilter filtcommand;
 	dynamic_reference<RegexFactory> RegexEngine;
@@ -292,7 +311,7 @@ bool ModuleFilter::AppliesToMe(User* user, FilterResult* filter, int iflags)
 }
 
 ModuleFilter::ModuleFilter()
-	: initing(true), filtcommand(this), RegexEngine(this, "regex")
+	: initing(true), indexdirty(true), filtcommand(this), RegexEngine(this, "regex")
 {
 }
 
@@ -308,6 +327,28 @@ void ModuleFilter::FreeFilters()
 		delete i->regex;
 
 	filters.clear();
+	indexdirty = true;
+}
+
+void ModuleFilter::BuildIndex()
+{
+	plainindex.Clear();
+	strippedindex.Clear();
+	unindexed.clear();
+
+	const bool glob = ((RegexEngine) && (RegexEngine->name == "regex/glob"));
+	for (size_t i = 0; i < filters.size(); ++i)
+	{
+		const FilterResult& filter = filters[i];
+		const std::string literal = (glob ? insp::MultiMatcher::GetGlobLiteral(filter.freeform) : insp::MultiMatcher::GetRegexLiteral(filter.freeform));
+		if (literal.empty())
+			unindexed.push_back(i);
+		else if (filter.flag_strip_color)
+			strippedindex.Add(literal, i);
+		else
+			plainindex.Add(literal, i);
+	}
+	indexdirty = false;
 }
 
 ModResult ModuleFilter::OnUserPreMessage(User* user, void* dest, int target_type, std::string& text, char status, CUList& exempt_list, MessageType msgtype)
@@ -571,21 +612,43 @@ void ModuleFilter::OnDecodeMetaData(Extensible* target, const std::string &extna
 
 FilterResult* ModuleFilter::FilterMatch(User* user, const std::string &text, int flgs)
 {
+	if (filters.empty())
+		return NULL;
+
+	if (indexdirty)
+		BuildIndex();
+
 	static std::string stripped_text;
-	stripped_text.clear();
+	bool stripped = false;
+
+	/* Only the filters whose literal string occurs in the text can match,
+	 * check them in the order they were added so the first match wins
+	 */
+	static insp::MultiMatcher::IdList candidates;
+	candidates = unindexed;
+	plainindex.Find(text, candidates);
+	if (!strippedindex.empty())
+	{
+		stripped_text = text;
+		InspIRCd::StripColor(stripped_text);
+		stripped = true;
+		strippedindex.Find(stripped_text, candidates);
+	}
+	std::sort(candidates.begin(), candidates.end());
 
-	for (std::vector<FilterResult>::iterator i = filters.begin(); i != filters.end(); ++i)
+	for (insp::MultiMatcher::IdList::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
 	{
-		FilterResult* filter = &*i;
+		FilterResult* filter = &filters[*i];
 
 		/* Skip ones that dont apply to us */
 		if (!AppliesToMe(user, filter, flgs))
 			continue;
 
-		if ((filter->flag_strip_color) && (stripped_text.empty()))
+		if ((filter->flag_strip_color) && (!stripped))
 		{
 			stripped_text = text;
 			InspIRCd::StripColor(stripped_text);
+			stripped = true;
 		}
 
 		if (filter->regex->Matches(filter->flag_strip_color ? stripped_text : text))
@@ -602,6 +665,7 @@ bool ModuleFilter::DeleteFilter(const std::string &freeform)
 		{
 			delete i->regex;
 			filters.erase(i);
+			indexdirty = true;
 			return true;
 		}
 	}
@@ -621,6 +685,7 @@ std::pair<bool, std::string> ModuleFilter::AddFilter(const std::string &freeform
 	try
 	{
 		filters.push_back(FilterResult(RegexEngine, freeform, reason, type, duration, flgs));
+		indexdirty = true;
 	}
 	catch (ModuleException &e)
 	{
@@ -682,6 +747,7 @@ void ModuleFilter::ReadFilters()
 		try
 		{
 			filters.push_back(FilterResult(RegexEngine, pattern, reason, fa, gline_time, flgs));
+			indexdirty = true;
 			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Regular expression %s loaded.", pattern.c_str());
 		}
 		catch (ModuleException &e)
@@ -81,12 +81,12 @@ class ModuleIRCv3 : public Module, public AccountEventListener
 		std::string line;
 		std::string mode;
 
-		const Channel::MemberMap& userlist = memb->chan->GetUsers();
-		for (Channel::MemberMap::const_iterator it = userlist.begin(); it != userlist.end(); ++it)
+		const Channel::LocalMemberList& localusers = memb->chan->GetLocalUsers();
+		for (Channel::LocalMemberList::const_iterator it = localusers.begin(); it != localusers.end(); ++it)
 		{
-			// Send the extended join line if the current member is local, has the extended-join cap and isn't excepted
-			User* member = IS_LOCAL(it->first);
-			if ((member) && (cap_extendedjoin.get(member)) && (excepts.find(member) == excepts.end()))
+			// Send the extended join line if the current member has the extended-join cap and isn't excepted
+			User* member = (*it)->user;
+			if ((cap_extendedjoin.get(member)) && (excepts.find(member) == excepts.end()))
 			{
 				// Construct the lines we're going to send if we haven't constructed them already
 				if (line.empty())
@@ -128,7 +128,7 @@ class ModuleIRCv3 : public Module, public AccountEventListener
 					member->Write(mode);
 
 				// Prevent the core from sending the JOIN and MODE to this user
-				excepts.insert(it->first);
+				excepts.insert(member);
 			}
 		}
 	}
@@ -155,12 +155,12 @@ class ModuleIRCv3 : public Module, public AccountEventListener
 
 		std::string line = ":" + memb->user->GetFullHost() + " AWAY :" + memb->user->awaymsg;
 
-		const Channel::MemberMap& userlist = memb->chan->GetUsers();
-		for (Channel::MemberMap::const_iterator it = userlist.begin(); it != userlist.end(); ++it)
+		const Channel::LocalMemberList& localusers = memb->chan->GetLocalUsers();
+		for (Channel::LocalMemberList::const_iterator it = localusers.begin(); it != localusers.end(); ++it)
 		{
-			// Send the away notify line if the current member is local, has the away-notify cap and isn't excepted
-			User* member = IS_LOCAL(it->first);
-			if ((member) && (cap_awaynotify.get(member)) && (last_excepts.find(member) == last_excepts.end()) && (it->second != memb))
+			// Send the away notify line if the current member has the away-notify cap and isn't excepted
+			User* member = (*it)->user;
+			if ((cap_awaynotify.get(member)) && (last_excepts.find(member) == last_excepts.end()) && (*it != memb))
 			{
 				member->Write(line);
 			}
@@ -131,6 +131,17 @@ class ModuleOperHash : public Module
 		return MOD_RES_PASSTHRU;
 	}
 
+	ModResult OnPassCompareAsync(PassCompareRequest* request) CXX11_OVERRIDE
+	{
+		// HMAC hashes are cheap to compute so they are checked by OnPassCompare
+		HashProvider* hp = ServerInstance->Modules->FindDataService<HashProvider>("hash/" + request->hashtype);
+		if ((!hp) || (!hp->IsSlow()))
+			return MOD_RES_PASSTHRU;
+
+		hp->CompareAsync(request->input, request->password, request);
+		return MOD_RES_ALLOW;
+	}
+
 	Version GetVersion() CXX11_OVERRIDE
 	{
 		return Version("Allows for hashed oper passwords",VF_VENDOR);
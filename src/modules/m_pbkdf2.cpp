@@ -131,6 +131,11 @@ class PBKDF2Provider : public HashProvider
 		return raw;
 	}
 
+	bool IsSlow() const CXX11_OVERRIDE
+	{
+		return true;
+	}
+
 	PBKDF2Provider(Module* mod, HashProvider* hp)
 		: HashProvider(mod, "pbkdf2-hmac-" + hp->name.substr(hp->name.find('/') + 1))
 		, provider(hp)
@@ -233,6 +238,7 @@ class ModulePBKDF2 : public Module
 
 	void OnUnloadModule(Module* mod) CXX11_OVERRIDE
 	{
+		bool flushed = false;
 		for (std::vector<PBKDF2Provider*>::iterator i = providers.begin(); i != providers.end(); )
 		{
 			PBKDF2Provider* item = *i;
@@ -242,6 +248,13 @@ class ModulePBKDF2 : public Module
 				continue;
 			}
 
+			// Our tasks on the thread pool may be hashing with the provider being removed
+			if (!flushed)
+			{
+				ServerInstance->Threads.FlushPool(this);
+				flushed = true;
+			}
+
 			ServerInstance->Modules->DelService(*item);
 			delete item;
 			i = providers.erase(i);
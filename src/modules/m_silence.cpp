@@ -319,15 +319,13 @@ class ModuleSilence : public Module
 	{
 		int public_silence = (message_type == MSG_PRIVMSG ? SILENCE_CHANNEL : SILENCE_CNOTICE);
 
-		const Channel::MemberMap& ulist = chan->GetUsers();
-		for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
+		const Channel::LocalMemberList& localusers = chan->GetLocalUsers();
+		for (Channel::LocalMemberList::const_iterator i = localusers.begin(); i != localusers.end(); ++i)
 		{
-			if (IS_LOCAL(i->first))
+			User* member = (*i)->user;
+			if (MatchPattern(member, sender, public_silence) == MOD_RES_DENY)
 			{
-				if (MatchPattern(i->first, sender, public_silence) == MOD_RES_DENY)
-				{
-					exempt_list.insert(i->first);
-				}
+				exempt_list.insert(member);
 			}
 		}
 	}
@@ -167,6 +167,10 @@ void TreeSocket::SendCapabilities(int phase)
 	if (proto_version == 1202)
 		extra.append(" PROTOCOL="+ConvToStr(ProtocolVersion));
 
+	capab->compression = GetOfferedCompression();
+	if (!capab->compression.empty())
+		extra.append(" COMPRESSION=" + capab->compression);
+
 	this->WriteLine("CAPAB CAPABILITIES " /* Preprocessor does this one. */
 			":NICKMAX="+ConvToStr(ServerInstance->Config->Limits.NickMax)+
 			" CHANMAX="+ConvToStr(ServerInstance->Config->Limits.ChanMax)+
@@ -363,6 +367,9 @@ bool TreeSocket::Capab(const parameterlist &params)
 
 		}
 
+		if (reason.empty())
+			StartCompression();
+
 		/* Challenge response, store their challenge for our password */
 		std::map<std::string,std::string>::iterator n = this->capab->CapKeys.find("CHALLENGE");
 		if ((n != this->capab->CapKeys.end()) && (ServerInstance->Modules->FindService(SERVICE_DATA, "hash/sha256")))
@@ -0,0 +1,181 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include "channelroutes.h"
+#include "treeserver.h"
+
+unsigned int ChannelRoutes::Route::Count(unsigned int minrank) const
+{
+	if (!minrank)
+		return members;
+
+	unsigned int count = 0;
+	for (insp::flat_map<unsigned int, unsigned int>::const_iterator i = ranks.lower_bound(minrank); i != ranks.end(); ++i)
+		count += i->second;
+	return count;
+}
+
+ChannelRoutes::RouteList::iterator ChannelRoutes::FindRoute(Membership* memb)
+{
+	TreeServer* const server = TreeServer::Get(memb->user)->GetRoute();
+	for (RouteList::iterator i = routes.begin(); i != routes.end(); ++i)
+	{
+		if (i->server == server)
+			return i;
+	}
+	return routes.end();
+}
+
+unsigned int ChannelRoutes::CountRanks(Membership* memb, unsigned int minrank)
+{
+	if (!minrank)
+		return 1;
+
+	unsigned int count = 0;
+	for (std::string::const_iterator i = memb->modes.begin(); i != memb->modes.end(); ++i)
+	{
+		PrefixMode* pm = ServerInstance->Modes->FindPrefixMode(*i);
+		if ((pm) && (pm->GetPrefixRank() >= minrank))
+			count++;
+	}
+	return count;
+}
+
+void ChannelRoutes::AddMember(Membership* memb)
+{
+	RouteList::iterator route = FindRoute(memb);
+	if (route == routes.end())
+		route = routes.insert(routes.end(), Route(TreeServer::Get(memb->user)->GetRoute()));
+
+	route->members++;
+
+	// Members joining from a remote server may already have prefix modes
+	for (std::string::const_iterator i = memb->modes.begin(); i != memb->modes.end(); ++i)
+	{
+		PrefixMode* pm = ServerInstance->Modes->FindPrefixMode(*i);
+		if (pm)
+			route->ranks[pm->GetPrefixRank()]++;
+	}
+}
+
+void ChannelRoutes::RemoveMember(Membership* memb)
+{
+	RouteList::iterator route = FindRoute(memb);
+	if (route == routes.end())
+		return;
+
+	if (--route->members == 0)
+	{
+		routes.erase(route);
+		return;
+	}
+
+	for (std::string::const_iterator i = memb->modes.begin(); i != memb->modes.end(); ++i)
+	{
+		PrefixMode* pm = ServerInstance->Modes->FindPrefixMode(*i);
+		if (pm)
+			ChangeRank(memb, pm, false);
+	}
+}
+
+void ChannelRoutes::ChangeRank(Membership* memb, PrefixMode* pm, bool adding)
+{
+	RouteList::iterator route = FindRoute(memb);
+	if (route == routes.end())
+		return;
+
+	if (adding)
+	{
+		route->ranks[pm->GetPrefixRank()]++;
+		return;
+	}
+
+	insp::flat_map<unsigned int, unsigned int>::iterator it = route->ranks.find(pm->GetPrefixRank());
+	if ((it != route->ranks.end()) && (--it->second == 0))
+		route->ranks.erase(it);
+}
+
+void ChannelRoutes::GetSockets(Channel* chan, SpanningTreeUtilities::TreeSocketSet& list, unsigned int minrank, const CUList& exempt_list) const
+{
+	std::vector<unsigned int> counts;
+	for (RouteList::const_iterator i = routes.begin(); i != routes.end(); ++i)
+		counts.push_back(i->Count(minrank));
+
+	// Exempt members do not make their route receive the message
+	if (!exempt_list.empty())
+	{
+		for (CUList::const_iterator i = exempt_list.begin(); i != exempt_list.end(); ++i)
+		{
+			User* user = *i;
+			if (IS_LOCAL(user))
+				continue;
+
+			Membership* memb = chan->GetUser(user);
+			if (!memb)
+				continue;
+
+			TreeServer* const server = TreeServer::Get(user)->GetRoute();
+			std::vector<unsigned int>::iterator count = counts.begin();
+			for (RouteList::const_iterator j = routes.begin(); j != routes.end(); ++j, ++count)
+			{
+				if (j->server == server)
+				{
+					*count -= std::min(*count, CountRanks(memb, minrank));
+					break;
+				}
+			}
+		}
+	}
+
+	std::vector<unsigned int>::const_iterator count = counts.begin();
+	for (RouteList::const_iterator i = routes.begin(); i != routes.end(); ++i, ++count)
+	{
+		if (*count)
+			list.insert(i->server->GetSocket());
+	}
+}
+
+void ChannelRoutesExt::AddMember(Membership* memb)
+{
+	ChannelRoutes* routes = get(memb->chan);
+	if (!routes)
+	{
+		routes = new ChannelRoutes;
+		set(memb->chan, routes);
+	}
+	routes->AddMember(memb);
+}
+
+void ChannelRoutesExt::RemoveMember(Membership* memb)
+{
+	ChannelRoutes* routes = get(memb->chan);
+	if (!routes)
+		return;
+
+	routes->RemoveMember(memb);
+	if (routes->empty())
+		unset(memb->chan);
+}
+
+void ChannelRoutesExt::ChangeRank(Membership* memb, PrefixMode* pm, bool adding)
+{
+	ChannelRoutes* routes = get(memb->chan);
+	if (routes)
+		routes->ChangeRank(memb, pm, adding);
+}
@@ -0,0 +1,119 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "utils.h"
+
+/** Number of remote members of a channel behind each of our links. It is updated as
+ * members join, leave and get or lose prefix modes so the links a channel message
+ * must be sent to can be found without looking at every member of the channel.
+ */
+class ChannelRoutes
+{
+	struct Route
+	{
+		/** Directly linked server the members are behind
+		 */
+		TreeServer* server;
+
+		/** Number of members behind the route
+		 */
+		unsigned int members;
+
+		/** Number of prefix modes set on the members behind the route, by the rank of the mode
+		 */
+		insp::flat_map<unsigned int, unsigned int> ranks;
+
+		Route(TreeServer* Server)
+			: server(Server)
+			, members(0)
+		{
+		}
+
+		/** Get the number of members behind the route that a message to a status prefix reaches
+		 * @param minrank Rank of the status prefix, 0 if the message is for all members
+		 * @return Number of members with a prefix mode of at least minrank, counting members
+		 * with several such modes once for each mode
+		 */
+		unsigned int Count(unsigned int minrank) const;
+	};
+
+	/** A list so routes are never assigned to, which flat_map does not support
+	 */
+	typedef std::list<Route> RouteList;
+	RouteList routes;
+
+	/** Find the route of a member
+	 * @param memb Membership of a remote user
+	 * @return Route of the member or routes.end() if there are no members behind it yet
+	 */
+	RouteList::iterator FindRoute(Membership* memb);
+
+	/** Get the number of prefix modes of a member that have at least the given rank
+	 * @param memb Membership to count the prefix modes of
+	 * @param minrank Rank of the status prefix, 0 if the message is for all members
+	 * @return Number of prefix modes, or 1 if minrank is 0
+	 */
+	static unsigned int CountRanks(Membership* memb, unsigned int minrank);
+
+ public:
+	/** Add a remote member, including the prefix modes it already has
+	 * @param memb Membership of the remote user
+	 */
+	void AddMember(Membership* memb);
+
+	/** Remove a remote member, including the prefix modes it has
+	 * @param memb Membership of the remote user
+	 */
+	void RemoveMember(Membership* memb);
+
+	/** Update the counts after a prefix mode was set or removed on a remote member
+	 * @param memb Membership of the remote user
+	 * @param pm Prefix mode that changed
+	 * @param adding True if the mode was set, false if it was removed
+	 */
+	void ChangeRank(Membership* memb, PrefixMode* pm, bool adding);
+
+	/** Check if there are no remote members
+	 * @return True if no remote user is on the channel
+	 */
+	bool empty() const { return routes.empty(); }
+
+	/** Get the links a channel message has to be sent to
+	 * @param chan Channel the message is for
+	 * @param list Set to insert the sockets of the links into
+	 * @param minrank Rank of the status prefix, 0 if the message is for all members
+	 * @param exempt_list Users who must not receive the message
+	 */
+	void GetSockets(Channel* chan, SpanningTreeUtilities::TreeSocketSet& list, unsigned int minrank, const CUList& exempt_list) const;
+};
+
+/** Extension item keeping a ChannelRoutes object on each channel that has remote members
+ */
+class ChannelRoutesExt : public SimpleExtItem<ChannelRoutes>
+{
+ public:
+	ChannelRoutesExt(Module* mod)
+		: SimpleExtItem<ChannelRoutes>("channelroutes", ExtensionItem::EXT_CHANNEL, mod)
+	{
+	}
+
+	void AddMember(Membership* memb);
+	void RemoveMember(Membership* memb);
+	void ChangeRank(Membership* memb, PrefixMode* pm, bool adding);
+};
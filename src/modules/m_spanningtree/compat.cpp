@@ -26,6 +26,9 @@ static std::string newline("\n");
 
 void TreeSocket::WriteLineNoCompat(const std::string& line)
 {
+	if (DeferLine(line))
+		return;
+
 	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] O %s", this->GetFd(), line.c_str());
 	this->WriteData(line);
 	this->WriteData(newline);
@@ -44,278 +47,327 @@ void TreeSocket::WriteLine(const std::string& original_line)
 		if (proto_version != ProtocolVersion)
 		{
 			std::string line = original_line;
-			std::string::size_type a = line.find(' ');
-			std::string::size_type b = line.find(' ', a + 1);
-			std::string command(line, a + 1, b-a-1);
-			// now try to find a translation entry
-			// TODO a more efficient lookup method will be needed later
-			if (proto_version < 1205)
+			if (TranslateLine(line))
+				WriteLineNoCompat(line);
+			return;
+		}
+	}
+
+	WriteLineNoCompat(original_line);
+}
+
+void TreeSocket::WriteLine(SharedLine& shared)
+{
+	const std::string& line = shared.line;
+
+	// Lines without a prefix and lines sent before the link is up are handled as usual, as are
+	// SERVER lines for 1202 servers because their translation depends on the state of the link
+	const std::string::size_type a = line.find(' ');
+	if ((LinkState != CONNECTED) || (line.c_str()[0] != ':') || ((proto_version < 1205) && (a != std::string::npos) && (!line.compare(a + 1, 7, "SERVER "))))
+	{
+		WriteLine(line);
+		return;
+	}
+
+	std::vector<SharedLine::Translation>::const_iterator it;
+	for (it = shared.translations.begin(); it != shared.translations.end(); ++it)
+	{
+		if (it->version == proto_version)
+			break;
+	}
+
+	if (it == shared.translations.end())
+	{
+		// First link using this protocol version, serialize the line for it
+		SharedLine::Translation translation;
+		translation.version = proto_version;
+		std::string translated = line;
+		if ((proto_version == ProtocolVersion) || (TranslateLine(translated)))
+			translation.buffer = new SharedBuffer(translated + newline);
+		it = shared.translations.insert(shared.translations.end(), translation);
+	}
+
+	// The line is not sent to servers using this version
+	SharedBuffer* const buffer = it->buffer;
+	if (!buffer)
+		return;
+
+	if (DeferLine(buffer->data))
+		return;
+
+	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] O %.*s", this->GetFd(), (int)buffer->data.length() - 1, buffer->data.c_str());
+	this->WriteData(buffer);
+}
+
+bool TreeSocket::TranslateLine(std::string& line)
+{
+	std::string::size_type a = line.find(' ');
+	std::string::size_type b = line.find(' ', a + 1);
+	std::string command(line, a + 1, b-a-1);
+	// now try to find a translation entry
+	// TODO a more efficient lookup method will be needed later
+	if (proto_version < 1205)
+	{
+		if (command == "IJOIN")
+		{
+			// Convert
+			// :<uid> IJOIN <chan> <membid> [<ts> [<flags>]]
+			// to
+			// :<sid> FJOIN <chan> <ts> + [<flags>],<uuid>
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
+
+			std::string::size_type d = line.find(' ', c + 1);
+			// Erase membership id first
+			line.erase(c, d-c);
+			if (d == std::string::npos)
 			{
-				if (command == "IJOIN")
-				{
-					// Convert
-					// :<uid> IJOIN <chan> <membid> [<ts> [<flags>]]
-					// to
-					// :<sid> FJOIN <chan> <ts> + [<flags>],<uuid>
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					// Erase membership id first
-					line.erase(c, d-c);
-					if (d == std::string::npos)
-					{
-						// No TS or modes in the command
-						// :22DAAAAAB IJOIN #chan
-						const std::string channame(line, b+1, c-b-1);
-						Channel* chan = ServerInstance->FindChan(channame);
-						if (!chan)
-							return;
-
-						line.push_back(' ');
-						line.append(ConvToStr(chan->age));
-						line.append(" + ,");
-					}
-					else
-					{
-						d = line.find(' ', c + 1);
-						if (d == std::string::npos)
-						{
-							// TS present, no modes
-							// :22DAAAAAC IJOIN #chan 12345
-							line.append(" + ,");
-						}
-						else
-						{
-							// Both TS and modes are present
-							// :22DAAAAAC IJOIN #chan 12345 ov
-							std::string::size_type e = line.find(' ', d + 1);
-							if (e != std::string::npos)
-								line.erase(e);
-
-							line.insert(d, " +");
-							line.push_back(',');
-						}
-					}
-
-					// Move the uuid to the end and replace the I with an F
-					line.append(line.substr(1, 9));
-					line.erase(4, 6);
-					line[5] = 'F';
-				}
-				else if (command == "RESYNC")
-					return;
-				else if (command == "METADATA")
+				// No TS or modes in the command
+				// :22DAAAAAB IJOIN #chan
+				const std::string channame(line, b+1, c-b-1);
+				Channel* chan = ServerInstance->FindChan(channame);
+				if (!chan)
+					return false;
+
+				line.push_back(' ');
+				line.append(ConvToStr(chan->age));
+				line.append(" + ,");
+			}
+			else
+			{
+				d = line.find(' ', c + 1);
+				if (d == std::string::npos)
 				{
-					// Drop TS for channel METADATA, translate METADATA operquit into an OPERQUIT command
-					// :sid METADATA #target TS extname ...
-					//     A        B       C  D
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if (d == std::string::npos)
-						return;
-
-					if (line[b + 1] == '#')
-					{
-						// We're sending channel metadata
-						line.erase(c, d-c);
-					}
-					else if (!line.compare(c, d-c, " operquit", 9))
-					{
-						// ":22D METADATA 22DAAAAAX operquit :message" -> ":22DAAAAAX OPERQUIT :message"
-						line = ":" + line.substr(b+1, c-b) + "OPERQUIT" + line.substr(d);
-					}
+					// TS present, no modes
+					// :22DAAAAAC IJOIN #chan 12345
+					line.append(" + ,");
 				}
-				else if (command == "FTOPIC")
+				else
 				{
-					// Drop channel TS for FTOPIC
-					// :sid FTOPIC #target TS TopicTS setter :newtopic
-					//     A      B       C  D       E      F
-					// :uid FTOPIC #target TS TopicTS :newtopic
-					//     A      B       C  D       E
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if (d == std::string::npos)
-						return;
-
+					// Both TS and modes are present
+					// :22DAAAAAC IJOIN #chan 12345 ov
 					std::string::size_type e = line.find(' ', d + 1);
-					if (line[e+1] == ':')
-					{
-						line.erase(c, e-c);
-						line.erase(a+1, 1);
-					}
-					else
-						line.erase(c, d-c);
-				}
-				else if ((command == "PING") || (command == "PONG"))
-				{
-					// :22D PING 20D
-					if (line.length() < 13)
-						return;
+					if (e != std::string::npos)
+						line.erase(e);
 
-					// Insert the source SID (and a space) between the command and the first parameter
-					line.insert(10, line.substr(1, 4));
+					line.insert(d, " +");
+					line.push_back(',');
 				}
-				else if (command == "OPERTYPE")
-				{
-					std::string::size_type colon = line.find(':', b);
-					if (colon != std::string::npos)
-					{
-						for (std::string::iterator i = line.begin()+colon; i != line.end(); ++i)
-						{
-							if (*i == ' ')
-								*i = '_';
-						}
-						line.erase(colon, 1);
-					}
-				}
-				else if (command == "INVITE")
-				{
-					// :22D INVITE 22DAAAAAN #chan TS ExpirationTime
-					//     A      B         C     D  E
-					if (b == std::string::npos)
-						return;
+			}
 
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
+			// Move the uuid to the end and replace the I with an F
+			line.append(line.substr(1, 9));
+			line.erase(4, 6);
+			line[5] = 'F';
+		}
+		else if (command == "RESYNC")
+			return false;
+		else if (command == "METADATA")
+		{
+			// Drop TS for channel METADATA, translate METADATA operquit into an OPERQUIT command
+			// :sid METADATA #target TS extname ...
+			//     A        B       C  D
+			if (b == std::string::npos)
+				return false;
 
-					std::string::size_type d = line.find(' ', c + 1);
-					if (d == std::string::npos)
-						return;
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
 
-					std::string::size_type e = line.find(' ', d + 1);
-					// If there is no expiration time then everything will be erased from 'd'
-					line.erase(d, e-d);
-				}
-				else if (command == "FJOIN")
-				{
-					// Strip membership ids
-					// :22D FJOIN #chan 1234 +f 4:3 :o,22DAAAAAB:15 o,22DAAAAAA:15
-					// :22D FJOIN #chan 1234 +f 4:3 o,22DAAAAAB:15
-					// :22D FJOIN #chan 1234 +Pf 4:3 :
-
-					// If the last parameter is prefixed by a colon then it's a userlist which may have 0 or more users;
-					// if it isn't, then it is a single member
-					std::string::size_type spcolon = line.find(" :");
-					if (spcolon != std::string::npos)
-					{
-						spcolon++;
-						// Loop while there is a ':' in the userlist, this is never true if the channel is empty
-						std::string::size_type pos = std::string::npos;
-						while ((pos = line.rfind(':', pos-1)) > spcolon)
-						{
-							// Find the next space after the ':'
-							std::string::size_type sp = line.find(' ', pos);
-							// Erase characters between the ':' and the next space after it, including the ':' but not the space;
-							// if there is no next space, everything will be erased between pos and the end of the line
-							line.erase(pos, sp-pos);
-						}
-					}
-					else
-					{
-						// Last parameter is a single member
-						std::string::size_type sp = line.rfind(' ');
-						std::string::size_type colon = line.find(':', sp);
-						line.erase(colon);
-					}
-				}
-				else if (command == "KICK")
-				{
-					// Strip membership id if the KICK has one
-					if (b == std::string::npos)
-						return;
-
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = line.find(' ', c + 1);
-					if ((d < line.size()-1) && (original_line[d+1] != ':'))
-					{
-						// There is a third parameter which doesn't begin with a colon, erase it
-						std::string::size_type e = line.find(' ', d + 1);
-						line.erase(d, e-d);
-					}
-				}
-				else if (command == "SINFO")
-				{
-					// :22D SINFO version :InspIRCd-3.0
-					//     A     B       C
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
+			std::string::size_type d = line.find(' ', c + 1);
+			if (d == std::string::npos)
+				return false;
 
-					// Only translating SINFO version, discard everything else
-					if (line.compare(b, 9, " version ", 9))
-						return;
+			if (line[b + 1] == '#')
+			{
+				// We're sending channel metadata
+				line.erase(c, d-c);
+			}
+			else if (!line.compare(c, d-c, " operquit", 9))
+			{
+				// ":22D METADATA 22DAAAAAX operquit :message" -> ":22DAAAAAX OPERQUIT :message"
+				line = ":" + line.substr(b+1, c-b) + "OPERQUIT" + line.substr(d);
+			}
+		}
+		else if (command == "FTOPIC")
+		{
+			// Drop channel TS for FTOPIC
+			// :sid FTOPIC #target TS TopicTS setter :newtopic
+			//     A      B       C  D       E      F
+			// :uid FTOPIC #target TS TopicTS :newtopic
+			//     A      B       C  D       E
+			if (b == std::string::npos)
+				return false;
 
-					line = line.substr(0, 5) + "VERSION" + line.substr(c);
-				}
-				else if (command == "SERVER")
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
+
+			std::string::size_type d = line.find(' ', c + 1);
+			if (d == std::string::npos)
+				return false;
+
+			std::string::size_type e = line.find(' ', d + 1);
+			if (line[e+1] == ':')
+			{
+				line.erase(c, e-c);
+				line.erase(a+1, 1);
+			}
+			else
+				line.erase(c, d-c);
+		}
+		else if ((command == "PING") || (command == "PONG"))
+		{
+			// :22D PING 20D
+			if (line.length() < 13)
+				return false;
+
+			// Insert the source SID (and a space) between the command and the first parameter
+			line.insert(10, line.substr(1, 4));
+		}
+		else if (command == "OPERTYPE")
+		{
+			std::string::size_type colon = line.find(':', b);
+			if (colon != std::string::npos)
+			{
+				for (std::string::iterator i = line.begin()+colon; i != line.end(); ++i)
 				{
-					// :001 SERVER inspircd.test 002 [<anything> ...] :gecos
-					//     A      B             C
-					std::string::size_type c = line.find(' ', b + 1);
-					if (c == std::string::npos)
-						return;
-
-					std::string::size_type d = c + 4;
-					std::string::size_type spcolon = line.find(" :", d);
-					if (spcolon == std::string::npos)
-						return;
-
-					line.erase(d, spcolon-d);
-					line.insert(c, " * 0");
-
-					if (burstsent)
-					{
-						WriteLineNoCompat(line);
-
-						// Synthesize a :<newserver> BURST <time> message
-						spcolon = line.find(" :");
-						line = CmdBuilder(line.substr(spcolon-3, 3), "BURST").push_int(ServerInstance->Time()).str();
-					}
+					if (*i == ' ')
+						*i = '_';
 				}
-				else if (command == "NUM")
+				line.erase(colon, 1);
+			}
+		}
+		else if (command == "INVITE")
+		{
+			// :22D INVITE 22DAAAAAN #chan TS ExpirationTime
+			//     A      B         C     D  E
+			if (b == std::string::npos)
+				return false;
+
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
+
+			std::string::size_type d = line.find(' ', c + 1);
+			if (d == std::string::npos)
+				return false;
+
+			std::string::size_type e = line.find(' ', d + 1);
+			// If there is no expiration time then everything will be erased from 'd'
+			line.erase(d, e-d);
+		}
+		else if (command == "FJOIN")
+		{
+			// Strip membership ids
+			// :22D FJOIN #chan 1234 +f 4:3 :o,22DAAAAAB:15 o,22DAAAAAA:15
+			// :22D FJOIN #chan 1234 +f 4:3 o,22DAAAAAB:15
+			// :22D FJOIN #chan 1234 +Pf 4:3 :
+
+			// If the last parameter is prefixed by a colon then it's a userlist which may have 0 or more users;
+			// if it isn't, then it is a single member
+			std::string::size_type spcolon = line.find(" :");
+			if (spcolon != std::string::npos)
+			{
+				spcolon++;
+				// Loop while there is a ':' in the userlist, this is never true if the channel is empty
+				std::string::size_type pos = std::string::npos;
+				while ((pos = line.rfind(':', pos-1)) > spcolon)
 				{
-					// :<sid> NUM <numeric source sid> <target uuid> <3 digit number> <params>
-					// Translate to
-					// :<sid> PUSH <target uuid> :<numeric source name> <3 digit number> <target nick> <params>
-
-					TreeServer* const numericsource = Utils->FindServerID(line.substr(9, 3));
-					if (!numericsource)
-						return;
-
-					// The nick of the target is necessary for building the PUSH message
-					User* const target = ServerInstance->FindUUID(line.substr(13, UIDGenerator::UUID_LENGTH));
-					if (!target)
-						return;
-
-					std::string push = InspIRCd::Format(":%.*s PUSH %s ::%s %.*s %s", 3, line.c_str()+1, target->uuid.c_str(), numericsource->GetName().c_str(), 3, line.c_str()+23, target->nick.c_str());
-					push.append(line, 26, std::string::npos);
-					push.swap(line);
+					// Find the next space after the ':'
+					std::string::size_type sp = line.find(' ', pos);
+					// Erase characters between the ':' and the next space after it, including the ':' but not the space;
+					// if there is no next space, everything will be erased between pos and the end of the line
+					line.erase(pos, sp-pos);
 				}
 			}
-			WriteLineNoCompat(line);
-			return;
+			else
+			{
+				// Last parameter is a single member
+				std::string::size_type sp = line.rfind(' ');
+				std::string::size_type colon = line.find(':', sp);
+				line.erase(colon);
+			}
 		}
-	}
+		else if (command == "KICK")
+		{
+			// Strip membership id if the KICK has one
+			if (b == std::string::npos)
+				return false;
 
-	WriteLineNoCompat(original_line);
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
+
+			std::string::size_type d = line.find(' ', c + 1);
+			if ((d < line.size()-1) && (line[d+1] != ':'))
+			{
+				// There is a third parameter which doesn't begin with a colon, erase it
+				std::string::size_type e = line.find(' ', d + 1);
+				line.erase(d, e-d);
+			}
+		}
+		else if (command == "SINFO")
+		{
+			// :22D SINFO version :InspIRCd-3.0
+			//     A     B       C
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
+
+			// Only translating SINFO version, discard everything else
+			if (line.compare(b, 9, " version ", 9))
+				return false;
+
+			line = line.substr(0, 5) + "VERSION" + line.substr(c);
+		}
+		else if (command == "SERVER")
+		{
+			// :001 SERVER inspircd.test 002 [<anything> ...] :gecos
+			//     A      B             C
+			std::string::size_type c = line.find(' ', b + 1);
+			if (c == std::string::npos)
+				return false;
+
+			std::string::size_type d = c + 4;
+			std::string::size_type spcolon = line.find(" :", d);
+			if (spcolon == std::string::npos)
+				return false;
+
+			line.erase(d, spcolon-d);
+			line.insert(c, " * 0");
+
+			if (burstsent)
+			{
+				WriteLineNoCompat(line);
+
+				// Synthesize a :<newserver> BURST <time> message
+				spcolon = line.find(" :");
+				line = CmdBuilder(line.substr(spcolon-3, 3), "BURST").push_int(ServerInstance->Time()).str();
+			}
+		}
+		else if (command == "NUM")
+		{
+			// :<sid> NUM <numeric source sid> <target uuid> <3 digit number> <params>
+			// Translate to
+			// :<sid> PUSH <target uuid> :<numeric source name> <3 digit number> <target nick> <params>
+
+			TreeServer* const numericsource = Utils->FindServerID(line.substr(9, 3));
+			if (!numericsource)
+				return false;
+
+			// The nick of the target is necessary for building the PUSH message
+			User* const target = ServerInstance->FindUUID(line.substr(13, UIDGenerator::UUID_LENGTH));
+			if (!target)
+				return false;
+
+			std::string push = InspIRCd::Format(":%.*s PUSH %s ::%s %.*s %s", 3, line.c_str()+1, target->uuid.c_str(), numericsource->GetName().c_str(), 3, line.c_str()+23, target->nick.c_str());
+			push.append(line, 26, std::string::npos);
+			push.swap(line);
+		}
+	}
+	return true;
 }
 
 namespace
@@ -0,0 +1,91 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "modules/compression.h"
+
+#include "treesocket.h"
+#include "link.h"
+
+/** Compression method offered to other servers if a module provides it */
+static const char compressmethod[] = "zlib";
+
+static Compression::Provider* FindCompressionProvider(const std::string& method)
+{
+	return static_cast<Compression::Provider*>(ServerInstance->Modules->FindService(SERVICE_IOHOOK, "compression/" + method));
+}
+
+std::string TreeSocket::GetOfferedCompression()
+{
+	if (!FindCompressionProvider(compressmethod))
+		return std::string();
+
+	// Outgoing connections only offer compression if the link block asks for it,
+	// incoming connections offer it whenever it's available.
+	if ((LinkState == CONNECTING) && (!capab->link->Compress))
+		return std::string();
+
+	return compressmethod;
+}
+
+void TreeSocket::StartCompression()
+{
+	std::map<std::string, std::string>::const_iterator it = capab->CapKeys.find("COMPRESSION");
+	if ((capab->compression.empty()) || (it == capab->CapKeys.end()) || (it->second != capab->compression))
+		return;
+
+	Compression::Provider* const prov = FindCompressionProvider(capab->compression);
+	if (!prov)
+		return;
+
+	// Everything after this line is compressed
+	WriteLine("COMPRESS " + capab->compression);
+	prov->StartCompress(this);
+	compression = capab->compression;
+}
+
+void TreeSocket::HandleCompress(const parameterlist& params)
+{
+	if ((params.empty()) || (params[0] != capab->compression))
+	{
+		SendError("Compression method was not offered: " + (params.empty() ? std::string() : params[0]));
+		return;
+	}
+
+	Compression::Provider* const prov = FindCompressionProvider(params[0]);
+	if (!prov)
+	{
+		SendError("Compression method is no longer available: " + params[0]);
+		return;
+	}
+
+	// Data after the current line is compressed, including what we've already read
+	prov->StartDecompress(this);
+	compression = params[0];
+}
+
+std::string TreeSocket::GetCompressionStatus()
+{
+	if (compression.empty())
+		return std::string();
+
+	Compression::Provider* const prov = FindCompressionProvider(compression);
+	if (!prov)
+		return std::string();
+
+	return "Compression on " + linkID + ": " + prov->GetStats(this);
+}
@@ -41,6 +41,7 @@ ModuleSpanningTree::ModuleSpanningTree()
 	, commands(this)
 	, currmembid(0)
 	, eventprov(this, "event/spanningtree")
+	, channelroutes(this)
 	, DNS(this, "DNS")
 	, loopCall(false)
 {
@@ -448,7 +449,10 @@ void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created_by
 {
 	// Only do this for local users
 	if (!IS_LOCAL(memb->user))
+	{
+		channelroutes.AddMember(memb);
 		return;
+	}
 
 	// Assign the current membership id to the new Membership and increase it
 	memb->id = currmembid++;
@@ -508,6 +512,10 @@ void ModuleSpanningTree::OnUserPart(Membership* memb, std::string &partmessage,
 			params.push_last(partmessage);
 		params.Broadcast();
 	}
+	else
+	{
+		channelroutes.RemoveMember(memb);
+	}
 }
 
 void ModuleSpanningTree::OnUserQuit(User* user, const std::string &reason, const std::string &oper_message)
@@ -531,6 +539,9 @@ void ModuleSpanningTree::OnUserQuit(User* user, const std::string &reason, const
 			ServerInstance->SNO->WriteToSnoMask('Q', "Client exiting on server %s: %s (%s) [%s]",
 				user->server->GetName().c_str(), user->GetFullRealHost().c_str(), user->GetIPString().c_str(), oper_message.c_str());
 		}
+
+		for (User::ChanList::iterator i = user->chans.begin(); i != user->chans.end(); ++i)
+			channelroutes.RemoveMember(*i);
 	}
 
 	// Regardless, update the UserCount
@@ -555,6 +566,9 @@ void ModuleSpanningTree::OnUserPostNick(User* user, const std::string &oldnick)
 
 void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::string &reason, CUList& excepts)
 {
+	if (!IS_LOCAL(memb->user))
+		channelroutes.RemoveMember(memb);
+
 	if ((!IS_LOCAL(source)) && (source != ServerInstance->FakeClient))
 		return;
 
@@ -657,7 +671,7 @@ restart:
 		TreeSocket* sock = (*i)->GetSocket();
 		if (sock->GetModHook(mod))
 		{
-			sock->SendError("SSL module unloaded");
+			sock->SendError("IO hook module " + mod->ModuleSourceFile + " unloaded");
 			sock->Close();
 			// XXX: The list we're iterating is modified by TreeServer::SQuit() which is called by Close()
 			goto restart;
@@ -717,6 +731,27 @@ ModResult ModuleSpanningTree::OnSetAway(User* user, const std::string &awaymsg)
 
 void ModuleSpanningTree::OnMode(User* source, User* u, Channel* c, const Modes::ChangeList& modes, ModeParser::ModeProcessFlag processflags, const std::string& output_mode)
 {
+	if (c)
+	{
+		// Keep the prefix mode counts of remote members up to date, the parameter is the nick of the member
+		const Modes::ChangeList::List& list = modes.getlist();
+		for (Modes::ChangeList::List::const_iterator i = list.begin(); i != list.end(); ++i)
+		{
+			const Modes::Change& item = *i;
+			PrefixMode* const pm = item.mh->IsPrefixMode();
+			if (!pm)
+				continue;
+
+			User* const target = ServerInstance->FindNick(item.param);
+			if ((!target) || (IS_LOCAL(target)))
+				continue;
+
+			Membership* const memb = c->GetUser(target);
+			if (memb)
+				channelroutes.ChangeRank(memb, pm, item.adding);
+		}
+	}
+
 	if (processflags & ModeParser::MODE_LOCALONLY)
 		return;
 
@@ -29,6 +29,7 @@
 #include "servercommand.h"
 #include "commands.h"
 #include "protocolinterface.h"
+#include "channelroutes.h"
 
 /** If you make a change which breaks the protocol, increment this.
  * If you  completely change the protocol, completely change the number.
@@ -77,6 +78,10 @@ class ModuleSpanningTree : public Module
 	Events::ModuleEventProvider eventprov;
 
  public:
+	/** Number of remote members behind each link, for every channel
+	 */
+	ChannelRoutesExt channelroutes;
+
 	dynamic_reference<DNS::Manager> DNS;
 
 	ServerCommandManager CmdManager;
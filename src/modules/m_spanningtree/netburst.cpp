@@ -91,10 +91,77 @@ class FModeBuilder : public CmdBuilder
 
 struct TreeSocket::BurstState
 {
+	/** Parts of the burst that are sent incrementally, in the order they are sent
+	 */
+	enum Phase
+	{
+		PHASE_USERS,
+		PHASE_CHANNELS,
+		PHASE_DONE
+	};
+
 	SpanningTreeProtocolInterface::Server server;
-	BurstState(TreeSocket* sock) : server(sock) { }
+
+	/** Part of the burst currently being sent
+	 */
+	Phase phase;
+
+	/** UUIDs of the users that were fully connected when the burst began, sorted.
+	 * Kept until the channels are sent because only these users are in the FJOINs.
+	 */
+	std::vector<std::string> users;
+
+	/** Names of the channels that existed when the burst began
+	 */
+	std::vector<std::string> chans;
+
+	/** Index of the next item to send in the list belonging to the current phase
+	 */
+	size_t pos;
+
+	/** Number of users and channels in the lists, kept after the lists are freed
+	 */
+	size_t usercount;
+	size_t chancount;
+
+	/** Number of bytes generated by the burst
+	 */
+	unsigned long long bytes;
+
+	/** Time when the burst began and ended in milliseconds, end time is 0 while the burst is in progress
+	 */
+	uint64_t startms;
+	uint64_t endms;
+
+	/** True while lines belonging to the burst are being written
+	 */
+	bool sending;
+
+	/** Lines routed to the server while the burst is in progress. They may refer to users
+	 * and channels that have not been sent yet, so they are held back until the burst ends.
+	 */
+	std::vector<std::string> pending;
+
+	/** Number of lines held back, kept after they are sent
+	 */
+	size_t pendingcount;
+
+	/** Size of the lines in pending in bytes, counted against the sendq of the link
+	 */
+	size_t pendingbytes;
+
+	BurstState(TreeSocket* sock)
+		: server(sock), phase(PHASE_USERS), pos(0), usercount(0), chancount(0), bytes(0), startms(0), endms(0)
+		, sending(false), pendingcount(0), pendingbytes(0)
+	{
+	}
 };
 
+static uint64_t GetTimeMs()
+{
+	return ServerInstance->Time() * 1000 + (ServerInstance->Time_ns() / 1000000);
+}
+
 /** This function is called when we want to send a netburst to a local
  * server. There is a set order we must do this, because for example
  * users require their servers to exist, and channels require their
@@ -111,22 +178,175 @@ void TreeSocket::DoBurst(TreeServer* s)
 	// Introduce all servers behind us
 	this->SendServers(Utils->TreeRoot, s);
 
-	BurstState bs(this);
-	// Introduce all users
-	this->SendUsers(bs);
+	// Remember which users and channels to send, the rest of the burst is generated
+	// as the sendq drains. Users and channels created from now on are introduced to
+	// the remote server by the regular messages we route to it, these are held back
+	// until the burst is over.
+	burst = new BurstState(this);
+	burst->startms = GetTimeMs();
+
+	const user_hash& users = ServerInstance->Users->GetUsers();
+	burst->users.reserve(users.size());
+	for (user_hash::const_iterator i = users.begin(); i != users.end(); ++i)
+	{
+		if (i->second->registered == REG_ALL)
+			burst->users.push_back(i->second->uuid);
+	}
+	burst->usercount = burst->users.size();
+	std::sort(burst->users.begin(), burst->users.end());
 
-	// Sync all channels
 	const chan_hash& chans = ServerInstance->GetChans();
+	burst->chans.reserve(chans.size());
 	for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
-		SyncChannel(i->second, bs);
+		burst->chans.push_back(i->first);
+	burst->chancount = burst->chans.size();
+
+	ContinueBurst();
+}
 
+/** Send the next part of the burst until the sendq reaches the burst watermark.
+ * Every user and channel is sent as a whole, so the sendq may grow past the
+ * watermark by the size of one user or channel.
+ */
+void TreeSocket::ContinueBurst()
+{
+	BurstState& bs = *burst;
+	bs.sending = true;
+	while ((bs.phase != BurstState::PHASE_DONE) && (getSendQSize() < Utils->BurstSendQ) && (getError().empty()))
+	{
+		const size_t prevsize = getSendQSize();
+		if (bs.phase == BurstState::PHASE_USERS)
+		{
+			if (bs.pos < bs.users.size())
+			{
+				// The user may have quit since the burst began
+				User* user = ServerInstance->FindUUID(bs.users[bs.pos++]);
+				if ((user) && (!user->quitting))
+					SendUser(user, bs);
+			}
+			else
+			{
+				bs.phase = BurstState::PHASE_CHANNELS;
+				bs.pos = 0;
+			}
+		}
+		else
+		{
+			if (bs.pos < bs.chans.size())
+			{
+				Channel* chan = ServerInstance->FindChan(bs.chans[bs.pos++]);
+				if (chan)
+					SyncChannel(chan, bs);
+			}
+			else
+			{
+				std::vector<std::string>().swap(bs.users);
+				std::vector<std::string>().swap(bs.chans);
+				bs.phase = BurstState::PHASE_DONE;
+				bs.pos = 0;
+			}
+		}
+		bs.bytes += getSendQSize() - prevsize;
+	}
+
+	if (bs.phase != BurstState::PHASE_DONE)
+	{
+		// If the socket is not blocked then the sendq is going to be flushed without us
+		// getting a write event, ask for one so we can continue when it's done
+		if (!(GetEventMask() & FD_WRITE_WILL_BLOCK))
+			SocketEngine::ChangeEventMask(this, FD_WANT_SINGLE_WRITE);
+		bs.sending = false;
+		return;
+	}
+
+	const size_t prevsize = getSendQSize();
 	// Send all xlines
 	this->SendXLines();
 	FOREACH_MOD(OnSyncNetwork, (bs.server));
 	this->WriteLine(CmdBuilder("ENDBURST"));
-	ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \2"+ s->GetName()+"\2.");
+	bs.bytes += getSendQSize() - prevsize;
+	bs.endms = GetTimeMs();
+	bs.sending = false;
+
+	ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \2"+ MyRoot->GetName()+"\2.");
 
 	this->burstsent = true;
+
+	// Everything the held back lines can refer to has been sent now
+	std::vector<std::string> lines;
+	lines.swap(bs.pending);
+	bs.pendingbytes = 0;
+	for (std::vector<std::string>::const_iterator i = lines.begin(); i != lines.end(); ++i)
+		WriteLineNoCompat(*i);
+}
+
+bool TreeSocket::DeferLine(const std::string& line)
+{
+	if ((!burst) || (burst->endms) || (burst->sending))
+		return false;
+
+	// PING, PONG and ERROR only refer to servers, which are all sent when the burst begins.
+	// They are not held back so the link does not time out while the burst is in progress.
+	std::string::size_type start = 0;
+	if (line.c_str()[0] == ':')
+	{
+		start = line.find(' ');
+		if (start == std::string::npos)
+			return false;
+		start++;
+	}
+	if ((!line.compare(start, 5, "PING ")) || (!line.compare(start, 5, "PONG ")) || (!line.compare(start, 6, "ERROR ")))
+		return false;
+
+	// The link is closing, nothing held back is going to be sent
+	if (!getError().empty())
+		return true;
+
+	// Held back lines are going to be written to the sendq so they count against the optional
+	// limit, which stops them from piling up without bound for a server reading the burst slowly
+	if ((Utils->BurstHardSendQ) && (getSendQSize() + burst->pendingbytes + line.length() > Utils->BurstHardSendQ))
+	{
+		ServerInstance->SNO->WriteToSnoMask('l', "Closing link to \2%s\2: SendQ of %lu bytes exceeded during burst (%lu lines held back)",
+			linkID.c_str(), (unsigned long)Utils->BurstHardSendQ, (unsigned long)burst->pendingcount);
+		SendError("SendQ exceeded during burst");
+		return true;
+	}
+
+	// Lines are sent with WriteLineNoCompat() later, which adds the new line again
+	const std::string::size_type length = ((!line.empty() && line[line.length() - 1] == '\n') ? line.length() - 1 : line.length());
+	burst->pending.push_back(line.substr(0, length));
+	burst->pendingcount++;
+	burst->pendingbytes += line.length();
+	return true;
+}
+
+void TreeSocket::OnEventHandlerWrite()
+{
+	BufferedSocket::OnEventHandlerWrite();
+	if ((burst) && (!burst->endms) && (getError().empty()))
+		ContinueBurst();
+}
+
+void TreeSocket::DeleteBurstState()
+{
+	delete burst;
+	burst = NULL;
+}
+
+std::string TreeSocket::GetBurstStatus() const
+{
+	if (!burst)
+		return "Burst to " + linkID + ": not started";
+
+	const BurstState& bs = *burst;
+	const size_t userssent = (bs.phase == BurstState::PHASE_USERS ? bs.pos : bs.usercount);
+	const size_t chanssent = (bs.phase == BurstState::PHASE_CHANNELS ? bs.pos : (bs.phase == BurstState::PHASE_DONE ? bs.chancount : 0));
+	const uint64_t duration = (bs.endms ? bs.endms : GetTimeMs()) - bs.startms;
+	const unsigned long long rate = (duration ? bs.bytes * 1000 / duration : bs.bytes);
+	return InspIRCd::Format("Burst to %s: %s, %lu/%lu users, %lu/%lu channels, %llu bytes in %lu ms (%llu bytes/s), %lu lines held back (%lu bytes pending), sendq %lu",
+		linkID.c_str(), (bs.endms ? "finished" : "in progress"), (unsigned long)userssent, (unsigned long)bs.usercount,
+		(unsigned long)chanssent, (unsigned long)bs.chancount, bs.bytes, (unsigned long)duration, rate, (unsigned long)bs.pendingcount,
+		(unsigned long)bs.pendingbytes, (unsigned long)getSendQSize());
 }
 
 void TreeSocket::SendServerInfo(TreeServer* from)
@@ -168,10 +388,21 @@ void TreeSocket::SendFJoins(Channel* c)
 {
 	CommandFJoin::Builder fjoin(c);
 
+	// While bursting, only users introduced by the burst can be in the FJOIN. Users who connected
+	// since the burst began are introduced by the held back lines, as are their joins.
+	const std::vector<std::string>* introduced = (((burst) && (!burst->endms)) ? &burst->users : NULL);
+
 	const Channel::MemberMap& ulist = c->GetUsers();
 	for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
 	{
 		Membership* memb = i->second;
+		// Users behind the server we're sending to may have joined since our burst began, don't send them back
+		if (TreeServer::Get(memb->user)->GetSocket() == this)
+			continue;
+
+		if ((introduced) && (!std::binary_search(introduced->begin(), introduced->end(), memb->user->uuid)))
+			continue;
+
 		if (!fjoin.has_room(memb))
 		{
 			// No room for this user, send the line and prepare a new one
@@ -270,35 +501,25 @@ void TreeSocket::SyncChannel(Channel* chan)
 	SyncChannel(chan, bs);
 }
 
-/** Send all users and their state, including oper and away status and global metadata */
-void TreeSocket::SendUsers(BurstState& bs)
+/** Send a user and its state, including oper and away status and global metadata */
+void TreeSocket::SendUser(User* user, BurstState& bs)
 {
-	ProtocolInterface::Server& piserver = bs.server;
+	this->WriteLine(CommandUID::Builder(user));
 
-	const user_hash& users = ServerInstance->Users->GetUsers();
-	for (user_hash::const_iterator u = users.begin(); u != users.end(); ++u)
-	{
-		User* user = u->second;
-		if (user->registered != REG_ALL)
-			continue;
-
-		this->WriteLine(CommandUID::Builder(user));
-
-		if (user->IsOper())
-			this->WriteLine(CommandOpertype::Builder(user));
-
-		if (user->IsAway())
-			this->WriteLine(CommandAway::Builder(user));
+	if (user->IsOper())
+		this->WriteLine(CommandOpertype::Builder(user));
 
-		const Extensible::ExtensibleStore& exts = user->GetExtList();
-		for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
-		{
-			ExtensionItem* item = i->first;
-			std::string value = item->serialize(FORMAT_NETWORK, u->second, i->second);
-			if (!value.empty())
-				this->WriteLine(CommandMetadata::Builder(user, item->name, value));
-		}
+	if (user->IsAway())
+		this->WriteLine(CommandAway::Builder(user));
 
-		FOREACH_MOD(OnSyncUser, (user, piserver));
+	const Extensible::ExtensibleStore& exts = user->GetExtList();
+	for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
+	{
+		ExtensionItem* item = i->first;
+		std::string value = item->serialize(FORMAT_NETWORK, user, i->second);
+		if (!value.empty())
+			this->WriteLine(CommandMetadata::Builder(user, item->name, value));
 	}
+
+	FOREACH_MOD(OnSyncUser, (user, bs.server));
 }
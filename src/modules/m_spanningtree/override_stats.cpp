@@ -23,6 +23,8 @@
 #include "main.h"
 #include "utils.h"
 #include "link.h"
+#include "treeserver.h"
+#include "treesocket.h"
 
 ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 {
@@ -55,5 +57,26 @@ ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 		}
 		return MOD_RES_DENY;
 	}
+	else if (stats.GetSymbol() == 'B')
+	{
+		const TreeServer::ChildServers& children = Utils->TreeRoot->GetChildren();
+		for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			TreeServer* server = *i;
+			stats.AddRow(249, server->GetSocket()->GetBurstStatus());
+		}
+		return MOD_RES_DENY;
+	}
+	else if (stats.GetSymbol() == 'x')
+	{
+		const TreeServer::ChildServers& children = Utils->TreeRoot->GetChildren();
+		for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			const std::string status = (*i)->GetSocket()->GetCompressionStatus();
+			if (!status.empty())
+				stats.AddRow(249, status);
+		}
+		return MOD_RES_DENY;
+	}
 	return MOD_RES_PASSTHRU;
 }
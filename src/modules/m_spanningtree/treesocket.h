@@ -81,6 +81,43 @@ struct CapabData
 	std::string sid;
 	std::string name;
 	bool hidden;
+
+	/** Compression method we offered in our CAPAB, empty if none */
+	std::string compression;
+};
+
+/** A line sent to several servers at once. The line is serialized, and translated if needed,
+ * only once for each protocol version among the links it is sent to. The sendqs of all links
+ * using the same protocol version share the resulting buffer.
+ */
+class SharedLine
+{
+	struct Translation
+	{
+		/** Protocol version of the links the buffer is for
+		 */
+		int version;
+
+		/** The line with a new line character appended, NULL if the line is not sent to servers using this version
+		 */
+		reference<SharedBuffer> buffer;
+	};
+
+	/** Buffers created so far, usually only one for the current protocol version
+	 */
+	std::vector<Translation> translations;
+
+	friend class TreeSocket;
+
+ public:
+	/** The line in the format of the current protocol version, without a new line character
+	 */
+	const std::string& line;
+
+	SharedLine(const std::string& Line)
+		: line(Line)
+	{
+	}
 };
 
 /** Every SERVER connection inbound or outbound is represented by an object of
@@ -103,6 +140,16 @@ class TreeSocket : public BufferedSocket
 	 */
 	bool burstsent;
 
+	/** State of the burst we are sending, NULL until the burst begins.
+	 * Kept after the burst is sent for the burst statistics.
+	 */
+	BurstState* burst;
+
+	/** Parameters of the line being processed, reused for every line read from the socket
+	 * so splitting a line does not allocate memory once the strings are large enough.
+	 */
+	parameterlist lineparams;
+
 	/** Checks if the given servername and sid are both free
 	 */
 	bool CheckDuplicate(const std::string& servername, const std::string& sid);
@@ -114,8 +161,24 @@ class TreeSocket : public BufferedSocket
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan, BurstState& bs);
 
-	/** Send all users and their oper state, away state and metadata */
-	void SendUsers(BurstState& bs);
+	/** Send a user and its oper state, away state and metadata */
+	void SendUser(User* user, BurstState& bs);
+
+	/** Send the next part of the burst, until the sendq reaches the burst watermark.
+	 * When everything has been sent, send the xlines and end the burst.
+	 */
+	void ContinueBurst();
+
+	/** Free the burst state, called when the socket is destroyed */
+	void DeleteBurstState();
+
+	/** Hold back a line routed to this server until the burst we are sending is complete,
+	 * so it can't arrive before the users and channels it refers to. The link is closed if the
+	 * lines held back and the sendq exceed \<performance:bursthardsendq>, if it is set.
+	 * @param line Line to send, may end with a new line character
+	 * @return True if the line was held back or dropped because the link is closing, false if it should be sent now
+	 */
+	bool DeferLine(const std::string& line);
 
 	/** Send all additional info about the given server to this server */
 	void SendServerInfo(TreeServer* from);
@@ -151,11 +214,36 @@ class TreeSocket : public BufferedSocket
 	 */
 	Link* AuthRemote(const parameterlist& params);
 
+	/** Compression method used on this link, empty if the link is not compressed
+	 */
+	std::string compression;
+
+	/** Get the compression method we offer to the remote server in CAPAB
+	 * @return Name of the compression method or an empty string if we don't offer compression
+	 */
+	std::string GetOfferedCompression();
+
+	/** Start compressing the data we send if both sides offered the same compression method in CAPAB.
+	 * Sends a COMPRESS line to mark the point in the stream where compression starts.
+	 */
+	void StartCompression();
+
+	/** Handle COMPRESS command, start decompressing the data we receive after the current line
+	 * @param params Parameters of the command
+	 */
+	void HandleCompress(const parameterlist& params);
+
 	/** Write a line on this socket with a new line character appended, skipping all translation for old protocols
 	 * @param line Line to write without a new line character at the end
 	 */
 	void WriteLineNoCompat(const std::string& line);
 
+	/** Translate a line to the protocol version of the remote server
+	 * @param line Line to translate, without a new line character at the end
+	 * @return True if the line should be sent, false if it has no equivalent in the protocol of the remote server
+	 */
+	bool TranslateLine(std::string& line);
+
  public:
 	const time_t age;
 
@@ -264,9 +352,25 @@ class TreeSocket : public BufferedSocket
 	 * server. There is a set order we must do this, because for example
 	 * users require their servers to exist, and channels require their
 	 * users to exist. You get the idea.
+	 * Only the servers are sent immediately, users and channels are sent
+	 * when the sendq drains below the burst watermark.
 	 */
 	void DoBurst(TreeServer* s);
 
+	/** Get a description of the progress of the burst we are sending to this server
+	 * @return Burst status line for /STATS
+	 */
+	std::string GetBurstStatus() const;
+
+	/** Get the compression statistics of this link
+	 * @return Compression status line for /STATS, empty if the link is not compressed
+	 */
+	std::string GetCompressionStatus();
+
+	/** Flush the sendq and continue the burst if it's in progress and the sendq has drained
+	 */
+	void OnEventHandlerWrite() CXX11_OVERRIDE;
+
 	/** This function is called when we receive data from a remote
 	 * server.
 	 */
@@ -276,6 +380,12 @@ class TreeSocket : public BufferedSocket
 	 */
 	void WriteLine(const std::string& line);
 
+	/** Send a line that is also sent to other servers, sharing its buffer with the links
+	 * that use the same protocol version
+	 * @param line Line to send
+	 */
+	void WriteLine(SharedLine& line);
+
 	/** Handle ERROR command */
 	void Error(parameterlist &params);
 
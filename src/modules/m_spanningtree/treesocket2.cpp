@@ -40,7 +40,7 @@ void TreeSocket::Error(parameterlist &params)
 
 void TreeSocket::Split(const std::string& line, std::string& prefix, std::string& command, parameterlist& params)
 {
-	irc::tokenstream tokens(line);
+	irc::linetokenizer tokens(line);
 
 	if (!tokens.GetToken(prefix))
 		return;
@@ -68,18 +68,14 @@ void TreeSocket::Split(const std::string& line, std::string& prefix, std::string
 	if (command.empty())
 		this->SendError("BUG (?) Empty command received: " + line);
 
-	std::string param;
-	while (tokens.GetToken(param))
-	{
-		params.push_back(param);
-	}
+	tokens.GetTokens(params);
 }
 
 void TreeSocket::ProcessLine(std::string &line)
 {
 	std::string prefix;
 	std::string command;
-	parameterlist params;
+	parameterlist& params = lineparams;
 
 	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] I %s", this->GetFd(), line.c_str());
 
@@ -124,6 +120,10 @@ void TreeSocket::ProcessLine(std::string &line)
 			{
 				this->Capab(params);
 			}
+			else if (command == "COMPRESS")
+			{
+				this->HandleCompress(params);
+			}
 			else
 			{
 				this->SendError("Invalid command in negotiation phase: " + command);
@@ -178,6 +178,10 @@ void TreeSocket::ProcessLine(std::string &line)
 			{
 				this->Capab(params);
 			}
+			else if (command == "COMPRESS")
+			{
+				this->HandleCompress(params);
+			}
 
 		break;
 		case CONNECTING:
@@ -200,6 +204,10 @@ void TreeSocket::ProcessLine(std::string &line)
 			{
 				this->Capab(params);
 			}
+			else if (command == "COMPRESS")
+			{
+				this->HandleCompress(params);
+			}
 		break;
 		case CONNECTED:
 			/*
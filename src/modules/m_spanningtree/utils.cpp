@@ -144,27 +144,14 @@ void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeSocketSet
 			minrank = mh->GetPrefixRank();
 	}
 
-	const Channel::MemberMap& ulist = c->GetUsers();
-	for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
-	{
-		if (IS_LOCAL(i->first))
-			continue;
-
-		if (minrank && i->second->getRank() < minrank)
-			continue;
-
-		if (exempt_list.find(i->first) == exempt_list.end())
-		{
-			TreeServer* best = TreeServer::Get(i->first);
-			list.insert(best->GetSocket());
-		}
-	}
-	return;
+	const ChannelRoutes* routes = Creator->channelroutes.get(c);
+	if (routes)
+		routes->GetSockets(c, list, minrank, exempt_list);
 }
 
 void SpanningTreeUtilities::DoOneToAllButSender(const CmdBuilder& params, TreeServer* omitroute)
 {
-	const std::string& FullLine = params.str();
+	SharedLine FullLine(params.str());
 
 	const TreeServer::ChildServers& children = TreeRoot->GetChildren();
 	for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
@@ -228,7 +215,12 @@ void SpanningTreeUtilities::ReadConfiguration()
 	HideULines = security->getBool("hideulines");
 	AnnounceTSChange = options->getBool("announcets");
 	AllowOptCommon = options->getBool("allowmismatch");
-	quiet_bursts = ServerInstance->Config->ConfValue("performance")->getBool("quietbursts");
+	ConfigTag* performance = ServerInstance->Config->ConfValue("performance");
+	quiet_bursts = performance->getBool("quietbursts");
+	BurstSendQ = performance->getInt("burstsendq", 262144, 4096);
+	BurstHardSendQ = performance->getInt("bursthardsendq", 0, 0);
+	if ((BurstHardSendQ) && (BurstHardSendQ < BurstSendQ))
+		BurstHardSendQ = BurstSendQ;
 	PingWarnTime = options->getDuration("pingwarning");
 	PingFreq = options->getDuration("serverpingfreq");
 
@@ -262,6 +254,7 @@ void SpanningTreeUtilities::ReadConfiguration()
 		L->Hook = tag->getString("ssl");
 		L->Bind = tag->getString("bind");
 		L->Hidden = tag->getBool("hidden");
+		L->Compress = tag->getBool("compress");
 
 		if (L->Name.empty())
 			throw ModuleException("Invalid configuration, found a link tag without a name!" + (!L->IPAddr.empty() ? " IP address: "+L->IPAddr : ""));
@@ -349,10 +342,11 @@ void SpanningTreeUtilities::SendChannelMessage(const std::string& prefix, Channe
 
 	TreeSocketSet list;
 	this->GetListOfServersForChannel(target, list, status, exempt_list);
+	SharedLine line(msg.str());
 	for (TreeSocketSet::iterator i = list.begin(); i != list.end(); ++i)
 	{
 		TreeSocket* Sock = *i;
 		if (Sock != omit)
-			Sock->WriteLine(msg);
+			Sock->WriteLine(line);
 	}
 }
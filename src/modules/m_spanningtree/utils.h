@@ -102,6 +102,16 @@ class SpanningTreeUtilities : public classbase
 	 */
 	int PingFreq;
 
+	/** Size of the sendq of a server link up to which the netburst to that server is generated,
+	 * the rest of the burst is generated when the sendq drains
+	 */
+	size_t BurstSendQ;
+
+	/** Maximum size of the sendq of a server link plus the lines held back while the netburst
+	 * to that server is in progress, the link is closed if it is exceeded. 0 if there is no limit.
+	 */
+	size_t BurstHardSendQ;
+
 	/** Initialise utility class
 	 */
 	SpanningTreeUtilities(ModuleSpanningTree* Creator);
@@ -0,0 +1,431 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "multimatch.h"
+
+namespace
+{
+	/** Skip an escape sequence in a regular expression, including the arguments of
+	 * escapes such as \x41, \p{L} or \k<name>
+	 * @param pattern Regular expression
+	 * @param pos Position of the backslash
+	 * @return Position of the first character after the escape sequence
+	 */
+	std::string::size_type SkipEscape(const std::string& pattern, std::string::size_type pos)
+	{
+		pos++;
+		if (pos >= pattern.length())
+			return pos;
+
+		const char chr = pattern[pos++];
+		if (!isalnum(static_cast<unsigned char>(chr)))
+			return pos;
+
+		if (pos < pattern.length())
+		{
+			// Named and braced arguments: \x{263a} \p{L} \k<name> \g{-1} \N{U+41} \o{101}
+			static const char openers[] = "{<'";
+			static const char closers[] = "}>'";
+			const char* opener = strchr(openers, pattern[pos]);
+			if ((opener) && (*opener))
+			{
+				pos = pattern.find(closers[opener - openers], pos + 1);
+				return (pos == std::string::npos ? pattern.length() : pos + 1);
+			}
+		}
+
+		size_t maxdigits = 0;
+		const char* digits = "0123456789";
+		switch (chr)
+		{
+			case 'x':
+				maxdigits = 2;
+				digits = "0123456789abcdefABCDEF";
+				break;
+			case 'u':
+				maxdigits = 4;
+				digits = "0123456789abcdefABCDEF";
+				break;
+			case 'c':
+			case 'p':
+			case 'P':
+				return std::min(pos + 1, pattern.length());
+			case 'g':
+				if ((pos < pattern.length()) && (pattern[pos] == '-'))
+					pos++;
+				maxdigits = std::string::npos;
+				break;
+			default:
+				if (isdigit(static_cast<unsigned char>(chr)))
+					maxdigits = std::string::npos;
+				break;
+		}
+
+		for (size_t n = 0; (n < maxdigits) && (pos < pattern.length()) && (pattern[pos]) && (strchr(digits, pattern[pos])); n++)
+			pos++;
+		return pos;
+	}
+
+	/** Skip a bracket expression in a regular expression
+	 * @param pattern Regular expression
+	 * @param pos Position of the opening bracket
+	 * @return Position of the first character after the closing bracket
+	 */
+	std::string::size_type SkipClass(const std::string& pattern, std::string::size_type pos)
+	{
+		pos++;
+		if ((pos < pattern.length()) && (pattern[pos] == '^'))
+			pos++;
+		// A closing bracket at the start is part of the set
+		if ((pos < pattern.length()) && (pattern[pos] == ']'))
+			pos++;
+
+		while ((pos < pattern.length()) && (pattern[pos] != ']'))
+		{
+			if (pattern[pos] == '\\')
+				pos += 2;
+			else if ((pattern[pos] == '[') && (pos + 1 < pattern.length()) && (strchr(":.=", pattern[pos + 1])))
+			{
+				// Character class, collating element or equivalence class such as [:alpha:]
+				const char terminator[] = { pattern[pos + 1], ']', 0 };
+				pos = pattern.find(terminator, pos + 2);
+				if (pos == std::string::npos)
+					return pattern.length();
+				pos += 2;
+			}
+			else
+				pos++;
+		}
+		return std::min(pos + 1, pattern.length());
+	}
+
+	/** Skip a parenthesized group in a regular expression
+	 * @param pattern Regular expression
+	 * @param pos Position of the opening parenthesis
+	 * @return Position of the first character after the closing parenthesis
+	 */
+	std::string::size_type SkipGroup(const std::string& pattern, std::string::size_type pos)
+	{
+		unsigned int depth = 0;
+		while (pos < pattern.length())
+		{
+			switch (pattern[pos])
+			{
+				case '\\':
+					pos = SkipEscape(pattern, pos);
+					continue;
+				case '[':
+					pos = SkipClass(pattern, pos);
+					continue;
+				case '(':
+					depth++;
+					break;
+				case ')':
+					if (--depth == 0)
+						return pos + 1;
+					break;
+			}
+			pos++;
+		}
+		return pos;
+	}
+
+	/** Check whether a group starting with "(?" turns on free-spacing mode, in which
+	 * whitespace in the pattern is ignored and '#' starts a comment
+	 * @param pattern Regular expression
+	 * @param pos Position of the first character after "(?"
+	 * @return True if the option letters of the group include 'x'
+	 */
+	bool IsFreeSpacing(const std::string& pattern, std::string::size_type pos)
+	{
+		for (; pos < pattern.length(); pos++)
+		{
+			const char chr = pattern[pos];
+			if (chr == 'x')
+				return true;
+			if ((!isalpha(static_cast<unsigned char>(chr))) && (chr != '-') && (chr != '^'))
+				break;
+		}
+		return false;
+	}
+
+	void EndRun(std::string& run, std::string& best)
+	{
+		if (run.length() > best.length())
+			best.swap(run);
+		run.clear();
+	}
+}
+
+insp::MultiMatcher::MultiMatcher()
+	: casemap(NULL)
+	, generation(0)
+	, dirty(true)
+{
+}
+
+void insp::MultiMatcher::Add(const std::string& str, size_t id)
+{
+	if (str.empty())
+		return;
+
+	strings.push_back(std::make_pair(str, id));
+	dirty = true;
+}
+
+void insp::MultiMatcher::Clear()
+{
+	strings.clear();
+	dirty = true;
+}
+
+unsigned int insp::MultiMatcher::GetEdge(unsigned int state, unsigned char chr) const
+{
+	const State& st = states[state];
+	const Edge* first = &edges[0] + st.firstedge;
+	const Edge* last = &edges[0] + st.lastedge;
+	Edge key;
+	key.chr = chr;
+	const Edge* edge = std::lower_bound(first, last, key);
+	if ((edge == last) || (edge->chr != chr))
+		return 0;
+	return edge->target;
+}
+
+void insp::MultiMatcher::Compile()
+{
+	casemap = national_case_insensitive_map;
+	states.clear();
+	edges.clear();
+	ids.clear();
+
+	// Build a trie of the strings, state 0 is the root
+	std::vector<std::vector<Edge> > trie(1);
+	std::vector<std::vector<size_t> > stateids(1);
+	for (std::vector<std::pair<std::string, size_t> >::const_iterator i = strings.begin(); i != strings.end(); ++i)
+	{
+		unsigned int state = 0;
+		for (std::string::const_iterator c = i->first.begin(); c != i->first.end(); ++c)
+		{
+			Edge edge;
+			edge.chr = casemap[static_cast<unsigned char>(*c)];
+			edge.target = trie.size();
+
+			std::vector<Edge>& stateedges = trie[state];
+			std::vector<Edge>::iterator it = std::lower_bound(stateedges.begin(), stateedges.end(), edge);
+			if ((it != stateedges.end()) && (it->chr == edge.chr))
+			{
+				state = it->target;
+				continue;
+			}
+
+			stateedges.insert(it, edge);
+			state = edge.target;
+			trie.push_back(std::vector<Edge>());
+			stateids.push_back(std::vector<size_t>());
+		}
+		stateids[state].push_back(i->second);
+	}
+
+	// Store the edges and ids of all states in two arrays
+	states.resize(trie.size());
+	for (unsigned int i = 0; i < trie.size(); i++)
+	{
+		State& state = states[i];
+		state.firstedge = edges.size();
+		edges.insert(edges.end(), trie[i].begin(), trie[i].end());
+		state.lastedge = edges.size();
+
+		state.firstid = ids.size();
+		ids.insert(ids.end(), stateids[i].begin(), stateids[i].end());
+		state.lastid = ids.size();
+
+		state.fail = 0;
+		state.output = 0;
+	}
+
+	// Compute the fail and output links breadth first, so the links of all shorter states are known
+	std::fill(roottable, roottable + 256, 0);
+	std::vector<unsigned int> queue;
+	for (unsigned int i = states[0].firstedge; i < states[0].lastedge; i++)
+	{
+		roottable[edges[i].chr] = edges[i].target;
+		queue.push_back(edges[i].target);
+	}
+
+	for (size_t q = 0; q < queue.size(); q++)
+	{
+		const unsigned int parent = queue[q];
+		for (unsigned int i = states[parent].firstedge; i < states[parent].lastedge; i++)
+		{
+			const Edge& edge = edges[i];
+			unsigned int fail = states[parent].fail;
+			unsigned int next = 0;
+			while ((fail) && (!(next = GetEdge(fail, edge.chr))))
+				fail = states[fail].fail;
+			if (!fail)
+				next = roottable[edge.chr];
+
+			State& child = states[edge.target];
+			const State& failstate = states[next];
+			child.fail = next;
+			child.output = (failstate.firstid != failstate.lastid ? next : failstate.output);
+			queue.push_back(edge.target);
+		}
+	}
+
+	reported.assign(states.size(), 0);
+	generation = 0;
+	dirty = false;
+}
+
+bool insp::MultiMatcher::Find(const std::string& text, IdList& result)
+{
+	if (strings.empty())
+		return false;
+
+	if ((dirty) || (casemap != national_case_insensitive_map))
+		Compile();
+
+	if (++generation == 0)
+	{
+		std::fill(reported.begin(), reported.end(), 0);
+		generation = 1;
+	}
+
+	const IdList::size_type prevsize = result.size();
+	unsigned int state = 0;
+	for (std::string::const_iterator c = text.begin(); c != text.end(); ++c)
+	{
+		const unsigned char chr = casemap[static_cast<unsigned char>(*c)];
+		unsigned int next = 0;
+		while ((state) && (!(next = GetEdge(state, chr))))
+			state = states[state].fail;
+		state = (state ? next : roottable[chr]);
+
+		// Report the strings ending here unless an earlier visit of the same state already did
+		const State& st = states[state];
+		unsigned int output = (st.firstid != st.lastid ? state : st.output);
+		while ((output) && (reported[output] != generation))
+		{
+			reported[output] = generation;
+			const State& outstate = states[output];
+			result.insert(result.end(), ids.begin() + outstate.firstid, ids.begin() + outstate.lastid);
+			output = outstate.output;
+		}
+	}
+
+	if (result.size() == prevsize)
+		return false;
+
+	std::sort(result.begin() + prevsize, result.end());
+	result.erase(std::unique(result.begin() + prevsize, result.end()), result.end());
+	return true;
+}
+
+std::string insp::MultiMatcher::GetGlobLiteral(const std::string& mask)
+{
+	std::string best;
+	std::string run;
+	for (std::string::const_iterator i = mask.begin(); i != mask.end(); ++i)
+	{
+		if ((*i == '*') || (*i == '?'))
+			EndRun(run, best);
+		else
+			run.push_back(*i);
+	}
+	EndRun(run, best);
+	return best;
+}
+
+std::string insp::MultiMatcher::GetRegexLiteral(const std::string& pattern)
+{
+	std::string best;
+	std::string run;
+	std::string::size_type pos = 0;
+	while (pos < pattern.length())
+	{
+		const unsigned char chr = pattern[pos];
+		switch (chr)
+		{
+			case '|':
+			case ')':
+				// Alternation or unbalanced parenthesis at the top level
+				return std::string();
+
+			case '\\':
+				// Grouping, alternation or repetition in basic regular expressions
+				if ((pos + 1 < pattern.length()) && (strchr("(){}|?+", pattern[pos + 1])))
+					return std::string();
+
+				// The meaning of escaped characters differs between engines, don't use them
+				pos = SkipEscape(pattern, pos);
+				break;
+
+			case '[':
+				pos = SkipClass(pattern, pos);
+				break;
+
+			case '(':
+				if ((pattern.compare(pos, 2, "(?") == 0) && (IsFreeSpacing(pattern, pos + 2)))
+					return std::string();
+
+				pos = SkipGroup(pattern, pos);
+				break;
+
+			case '{':
+				pos = pattern.find('}', pos);
+				pos = (pos == std::string::npos ? pattern.length() : pos + 1);
+				break;
+
+			case '.':
+			case '^':
+			case '$':
+			case '*':
+			case '+':
+			case '?':
+				pos++;
+				break;
+
+			default:
+			{
+				// Case folding of non-ASCII characters depends on the engine and its settings
+				if (chr >= 0x80)
+				{
+					pos++;
+					break;
+				}
+
+				// A character that may be omitted ends the run, a character that may be repeated
+				// ends the run after itself
+				const char next = (pos + 1 < pattern.length() ? pattern[pos + 1] : 0);
+				pos++;
+				if ((next) && (strchr("*?{", next)))
+					break;
+
+				run.push_back(chr);
+				if (next != '+')
+					continue;
+				break;
+			}
+		}
+		EndRun(run, best);
+	}
+	EndRun(run, best);
+	return best;
+}
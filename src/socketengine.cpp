@@ -128,6 +128,16 @@ void SocketEngine::DispatchTrialWrites()
 	}
 }
 
+int SocketEngine::GetDispatchTimeout()
+{
+	if (!trials.empty())
+		return 0;
+
+	// Timers are checked once every second so there is no point in waking up before that
+	ServerInstance->UpdateTime();
+	return 1000 - (ServerInstance->Time_ns() / 1000000);
+}
+
 bool SocketEngine::AddFdRef(EventHandler* eh)
 {
 	int fd = eh->GetFd();
@@ -329,6 +339,14 @@ void SocketEngine::Statistics::UpdateWriteCounters(int len_out)
 		ErrorEvents++;
 }
 
+void SocketEngine::Statistics::UpdateDispatchCounters(int count)
+{
+	size_t bucket = 0;
+	for (; (count > 0) && (bucket < HistogramSize - 1); count >>= 1)
+		bucket++;
+	EventCountHistogram[bucket]++;
+}
+
 void SocketEngine::Statistics::CheckFlush() const
 {
 	// Reset the in/out byte counters if it has been more than a second
@@ -32,6 +32,18 @@ namespace
 	/** These are used by epoll() to hold socket events
 	 */
 	std::vector<struct epoll_event> events(1);
+
+	/** Events registered in the kernel for each fd, indexed by fd
+	 */
+	std::vector<unsigned> kernelevents;
+
+	/** Fds whose event mask changed since the last call to epoll_wait()
+	 */
+	std::vector<int> changedfds;
+
+	/** True for the fds in changedfds, indexed by fd
+	 */
+	std::vector<bool> changed;
 }
 
 void SocketEngine::Init()
@@ -108,22 +120,60 @@ bool SocketEngine::AddFd(EventHandler* eh, int event_mask)
 	eh->SetEventMask(event_mask);
 	ResizeDouble(events);
 
+	if (static_cast<unsigned int>(fd) >= kernelevents.size())
+	{
+		kernelevents.resize(fd + 1);
+		changed.resize(fd + 1);
+	}
+	kernelevents[fd] = ev.events;
+
 	return true;
 }
 
 void SocketEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
 {
-	unsigned old_events = mask_to_epoll(old_mask);
-	unsigned new_events = mask_to_epoll(new_mask);
-	if (old_events != new_events)
+	if (mask_to_epoll(old_mask) == mask_to_epoll(new_mask))
+		return;
+
+	// The mask is often changed back and forth several times while dispatching events,
+	// e.g. when FD_WANT_SINGLE_WRITE is set and cleared, so only tell the kernel about
+	// the final state before waiting for events again
+	const int fd = eh->GetFd();
+	if ((fd < 0) || (static_cast<unsigned int>(fd) >= changed.size()) || (changed[fd]))
+		return;
+
+	changed[fd] = true;
+	changedfds.push_back(fd);
+}
+
+/** Apply the event mask changes made since the last call to epoll_wait()
+ */
+static void ApplyChanges()
+{
+	for (std::vector<int>::const_iterator i = changedfds.begin(); i != changedfds.end(); ++i)
 	{
-		// ok, we actually have something to tell the kernel about
+		const int fd = *i;
+		changed[fd] = false;
+
+		// The handler may have been removed since the change, in that case the fd is no longer in epoll
+		EventHandler* const eh = SocketEngine::GetRef(fd);
+		if (!eh)
+			continue;
+
+		const unsigned new_events = mask_to_epoll(eh->GetEventMask());
+		if (new_events == kernelevents[fd])
+			continue;
+
 		struct epoll_event ev;
 		memset(&ev, 0, sizeof(ev));
 		ev.events = new_events;
 		ev.data.ptr = static_cast<void*>(eh);
-		epoll_ctl(EngineHandle, EPOLL_CTL_MOD, eh->GetFd(), &ev);
+		if (epoll_ctl(EngineHandle, EPOLL_CTL_MOD, fd, &ev) == 0)
+			kernelevents[fd] = new_events;
+		else
+			ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Error modifying fd: %d in socketengine: %s", fd, strerror(errno));
 	}
+	changedfds.clear();
 }
 
 void SocketEngine::DelFd(EventHandler* eh)
@@ -153,9 +203,17 @@ void SocketEngine::DelFd(EventHandler* eh)
 
 int SocketEngine::DispatchEvents()
 {
-	int i = epoll_wait(EngineHandle, &events[0], events.size(), 1000);
+	ApplyChanges();
+
+	int maxevents = events.size();
+	const unsigned int limit = ServerInstance->Config->MaxEvents;
+	if ((limit) && (limit < events.size()))
+		maxevents = limit;
+
+	int i = epoll_wait(EngineHandle, &events[0], maxevents, GetDispatchTimeout());
 	ServerInstance->UpdateTime();
 
+	stats.UpdateDispatchCounters(i);
 	stats.TotalEvents += i;
 
 	for (int j = 0; j < i; j++)
@@ -0,0 +1,540 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/** A specialisation of the SocketEngine class, designed to use linux 5.5 io_uring.
+ * Every fd has at most one one-shot poll request in flight. All poll requests and
+ * cancellations queued in an iteration of the main loop are submitted together with
+ * the wait for completions in a single io_uring_enter() call.
+ */
+namespace
+{
+	/** Number of submission queue entries. The queue is submitted early if it fills up.
+	 */
+	const unsigned SubmissionQueueSize = 4096;
+
+	/** Number of completion queue entries, completions that do not fit are kept by the kernel
+	 */
+	const unsigned CompletionQueueSize = 65536;
+
+	/** The type of a request is stored in the top two bits of its user_data.
+	 * For poll requests the lower 32 bits are the fd and the rest is a sequence number
+	 * which tells completions of an old request apart from the one currently in flight.
+	 */
+	const uint64_t TagMask = 3ULL << 62;
+	const uint64_t TagPoll = 0;
+	const uint64_t TagRemove = 1ULL << 62;
+	const uint64_t TagTimeout = 2ULL << 62;
+
+	struct FdState
+	{
+		/** user_data of the poll request in flight, 0 if there is none */
+		uint64_t armed;
+
+		/** Events of the poll request in flight */
+		unsigned events;
+
+		/** True if the fd is in changedfds */
+		bool changed;
+
+		FdState() : armed(0), events(0), changed(false) { }
+	};
+
+	int EngineHandle;
+
+	/** Pointers into the memory shared with the kernel
+	 */
+	void* sqring;
+	size_t sqringsize;
+	void* cqring;
+	size_t cqringsize;
+	struct io_uring_sqe* sqes;
+	size_t sqessize;
+
+	unsigned* sqhead;
+	unsigned* sqtail;
+	unsigned* sqmask;
+	unsigned* sqarray;
+	unsigned sqentries;
+	unsigned* cqhead;
+	unsigned* cqtail;
+	unsigned* cqmask;
+	struct io_uring_cqe* cqes;
+
+	/** Tail of the submission queue including the entries not yet made visible to the kernel
+	 */
+	unsigned localsqtail;
+
+	/** State of each fd, indexed by fd
+	 */
+	std::vector<FdState> fdstates;
+
+	/** Fds whose poll request has to be updated before waiting for events again
+	 */
+	std::vector<int> changedfds;
+
+	/** Completions taken from the completion queue but not yet dispatched
+	 */
+	std::vector<struct io_uring_cqe> completions;
+
+	/** Sequence number of the last poll request
+	 */
+	uint32_t lastseq;
+
+	/** True if a timeout request is in flight
+	 */
+	bool timeoutpending;
+
+	/** Expiry of the timeout request, must stay valid until the request is submitted
+	 */
+	struct __kernel_timespec timeoutspec;
+}
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, EngineHandle, to_submit, min_complete, flags, NULL, 0);
+}
+
+/** Check that the kernel supports every operation this engine submits.
+ * Kernels before 5.6 can not be probed, those which have IORING_FEAT_NODROP support all of them.
+ */
+static bool SupportsRequiredOps()
+{
+	const unsigned required[] = { IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_TIMEOUT };
+	const unsigned maxops = 256;
+
+	std::vector<char> buf(sizeof(struct io_uring_probe) + maxops * sizeof(struct io_uring_probe_op));
+	struct io_uring_probe* const probe = reinterpret_cast<struct io_uring_probe*>(&buf[0]);
+	if (syscall(__NR_io_uring_register, EngineHandle, IORING_REGISTER_PROBE, probe, maxops) < 0)
+		return (errno == EINVAL);
+
+	for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); i++)
+	{
+		if ((required[i] > probe->last_op) || (!(probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED)))
+			return false;
+	}
+	return true;
+}
+
+static void* MapRing(size_t size, off_t offset)
+{
+	void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, EngineHandle, offset);
+	return (ptr == MAP_FAILED ? NULL : ptr);
+}
+
+void SocketEngine::Init()
+{
+	LookupMaxFds();
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = CompletionQueueSize;
+	EngineHandle = io_uring_setup(SubmissionQueueSize, &params);
+	if (EngineHandle == -1)
+		InitError();
+
+	// Without IORING_FEAT_NODROP completions are lost when the completion queue overflows
+	if ((!(params.features & IORING_FEAT_NODROP)) || (!SupportsRequiredOps()))
+	{
+		errno = ENOSYS;
+		InitError();
+	}
+
+	sqringsize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqringsize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sqringsize = cqringsize = std::max(sqringsize, cqringsize);
+
+	sqring = MapRing(sqringsize, IORING_OFF_SQ_RING);
+	cqring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqring : MapRing(cqringsize, IORING_OFF_CQ_RING);
+	sqessize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = static_cast<struct io_uring_sqe*>(MapRing(sqessize, IORING_OFF_SQES));
+	if ((!sqring) || (!cqring) || (!sqes))
+		InitError();
+
+	char* const sqbase = static_cast<char*>(sqring);
+	sqhead = reinterpret_cast<unsigned*>(sqbase + params.sq_off.head);
+	sqtail = reinterpret_cast<unsigned*>(sqbase + params.sq_off.tail);
+	sqmask = reinterpret_cast<unsigned*>(sqbase + params.sq_off.ring_mask);
+	sqarray = reinterpret_cast<unsigned*>(sqbase + params.sq_off.array);
+	sqentries = params.sq_entries;
+
+	char* const cqbase = static_cast<char*>(cqring);
+	cqhead = reinterpret_cast<unsigned*>(cqbase + params.cq_off.head);
+	cqtail = reinterpret_cast<unsigned*>(cqbase + params.cq_off.tail);
+	cqmask = reinterpret_cast<unsigned*>(cqbase + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct io_uring_cqe*>(cqbase + params.cq_off.cqes);
+
+	localsqtail = *sqtail;
+	lastseq = 0;
+	timeoutpending = false;
+}
+
+void SocketEngine::RecoverFromFork()
+{
+}
+
+void SocketEngine::Deinit()
+{
+	munmap(sqes, sqessize);
+	if (cqring != sqring)
+		munmap(cqring, cqringsize);
+	munmap(sqring, sqringsize);
+	Close(EngineHandle);
+}
+
+static int mask_to_poll(int event_mask)
+{
+	int rv = 0;
+	if (event_mask & (FD_WANT_POLL_READ | FD_WANT_FAST_READ))
+		rv |= POLLIN;
+	if (event_mask & (FD_WANT_POLL_WRITE | FD_WANT_FAST_WRITE | FD_WANT_SINGLE_WRITE))
+		rv |= POLLOUT;
+	return rv;
+}
+
+/** Move all completions from the completion queue to the completions vector
+ */
+static void ReapCompletions()
+{
+	unsigned head = *cqhead;
+	const unsigned tail = __atomic_load_n(cqtail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+		completions.push_back(cqes[head & *cqmask]);
+	__atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+}
+
+/** Submit the queued requests to the kernel
+ * @param min_complete Number of completions to wait for
+ * @return True on success, false if the call failed, e.g. because it was interrupted by a signal
+ */
+static bool Submit(unsigned min_complete)
+{
+	__atomic_store_n(sqtail, localsqtail, __ATOMIC_RELEASE);
+	const unsigned to_submit = localsqtail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE);
+	if ((to_submit == 0) && (min_complete == 0))
+		return true;
+
+	if (io_uring_enter(to_submit, min_complete, (min_complete ? IORING_ENTER_GETEVENTS : 0)) >= 0)
+		return true;
+
+	if (errno == EBUSY)
+	{
+		// The completion queue has overflowed, the kernel refuses new requests until it is drained
+		ReapCompletions();
+		return (io_uring_enter(to_submit, 0, 0) >= 0);
+	}
+
+	if (errno != EINTR)
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "io_uring_enter() failed: %s", strerror(errno));
+	return false;
+}
+
+/** Get an unused submission queue entry, submitting the queue first if it is full
+ * @return Cleared submission queue entry, or NULL if the queue cannot be emptied
+ */
+static struct io_uring_sqe* GetSubmissionEntry()
+{
+	if (localsqtail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries)
+	{
+		Submit(0);
+		if (localsqtail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries)
+			return NULL;
+	}
+
+	const unsigned index = localsqtail & *sqmask;
+	struct io_uring_sqe* const sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqarray[index] = index;
+	localsqtail++;
+	return sqe;
+}
+
+/** Cancel the poll request in flight for an fd, if any
+ * @param state State of the fd
+ */
+static void CancelPoll(FdState& state)
+{
+	if (!state.armed)
+		return;
+
+	struct io_uring_sqe* const sqe = GetSubmissionEntry();
+	if (!sqe)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Unable to cancel poll request %llu", (unsigned long long)state.armed);
+		return;
+	}
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = state.armed;
+	sqe->user_data = TagRemove;
+
+	// Completions of the old request are ignored from now on
+	state.armed = 0;
+	state.events = 0;
+}
+
+static void MarkChanged(int fd)
+{
+	FdState& state = fdstates[fd];
+	if (state.changed)
+		return;
+
+	state.changed = true;
+	changedfds.push_back(fd);
+}
+
+/** Bring the poll requests in flight in line with the event masks of the handlers
+ */
+static void ApplyChanges()
+{
+	for (std::vector<int>::const_iterator i = changedfds.begin(); i != changedfds.end(); ++i)
+	{
+		const int fd = *i;
+		FdState& state = fdstates[fd];
+		state.changed = false;
+
+		EventHandler* const eh = SocketEngine::GetRef(fd);
+		if (!eh)
+			continue;
+
+		const unsigned events = mask_to_poll(eh->GetEventMask());
+		if ((state.armed) && (state.events == events))
+			continue;
+
+		CancelPoll(state);
+		if (!events)
+			continue;
+
+		struct io_uring_sqe* const sqe = GetSubmissionEntry();
+		if (!sqe)
+		{
+			ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Unable to poll fd: %d", fd);
+			continue;
+		}
+
+		if (++lastseq == 0)
+			lastseq = 1;
+
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll_events = events;
+		sqe->user_data = TagPoll | (static_cast<uint64_t>(lastseq & 0x3FFFFFFF) << 32) | static_cast<uint32_t>(fd);
+		state.armed = sqe->user_data;
+		state.events = events;
+	}
+	changedfds.clear();
+}
+
+/** Queue a timeout request which wakes up io_uring_enter() once the given time has passed
+ * @param timeout Timeout in milliseconds
+ */
+static void QueueTimeout(int timeout)
+{
+	struct io_uring_sqe* const sqe = GetSubmissionEntry();
+	if (!sqe)
+		return;
+
+	timeoutspec.tv_sec = timeout / 1000;
+	timeoutspec.tv_nsec = (timeout % 1000) * 1000000;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = reinterpret_cast<uintptr_t>(&timeoutspec);
+	sqe->len = 1;
+	sqe->user_data = TagTimeout;
+	timeoutpending = true;
+}
+
+bool SocketEngine::AddFd(EventHandler* eh, int event_mask)
+{
+	int fd = eh->GetFd();
+	if (fd < 0)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "AddFd out of range: (fd: %d)", fd);
+		return false;
+	}
+
+	if (!SocketEngine::AddFdRef(eh))
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Attempt to add duplicate fd: %d", fd);
+		return false;
+	}
+
+	while (static_cast<unsigned int>(fd) >= fdstates.size())
+		fdstates.resize(fdstates.empty() ? 16 : (fdstates.size() * 2));
+
+	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "New file descriptor: %d", fd);
+
+	eh->SetEventMask(event_mask);
+	MarkChanged(fd);
+	return true;
+}
+
+void SocketEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
+{
+	if (mask_to_poll(old_mask) == mask_to_poll(new_mask))
+		return;
+
+	const int fd = eh->GetFd();
+	if ((fd < 0) || (static_cast<unsigned int>(fd) >= fdstates.size()))
+		return;
+
+	MarkChanged(fd);
+}
+
+void SocketEngine::DelFd(EventHandler* eh)
+{
+	int fd = eh->GetFd();
+	if (fd < 0)
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "DelFd out of range: (fd: %d)", fd);
+		return;
+	}
+
+	// The kernel keeps a reference to the file as long as a request is in flight so
+	// closing the fd is not enough, the poll request has to be cancelled explicitly
+	if (static_cast<unsigned int>(fd) < fdstates.size())
+		CancelPoll(fdstates[fd]);
+
+	SocketEngine::DelFdRef(eh);
+
+	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Remove file descriptor: %d", fd);
+}
+
+int SocketEngine::DispatchEvents()
+{
+	ApplyChanges();
+
+	const int timeout = GetDispatchTimeout();
+	if ((timeout > 0) && (!timeoutpending))
+		QueueTimeout(timeout);
+
+	// Completions of cancel requests do not count, keep waiting until
+	// there is an event to dispatch or the timeout request completes
+	bool wakeup = false;
+	while (!wakeup)
+	{
+		if (!Submit(timeout > 0 ? 1 : 0))
+			break;
+
+		ReapCompletions();
+		if (timeout == 0)
+			break;
+
+		for (std::vector<struct io_uring_cqe>::const_iterator i = completions.begin(); i != completions.end(); ++i)
+		{
+			if ((i->user_data & TagMask) != TagRemove)
+			{
+				wakeup = true;
+				break;
+			}
+		}
+	}
+	ServerInstance->UpdateTime();
+
+	int processed = 0;
+	for (size_t j = 0; j < completions.size(); j++)
+	{
+		// Copy this as the vector may grow while dispatching the event
+		const struct io_uring_cqe cqe = completions[j];
+
+		const uint64_t tag = cqe.user_data & TagMask;
+		if (tag == TagTimeout)
+		{
+			timeoutpending = false;
+			continue;
+		}
+		else if (tag != TagPoll)
+			continue;
+
+		const int fd = static_cast<int>(cqe.user_data & 0xFFFFFFFF);
+		if ((static_cast<unsigned int>(fd) >= fdstates.size()) || (fdstates[fd].armed != cqe.user_data))
+			continue;
+
+		// The request is one-shot, it is reissued by ApplyChanges() before the next wait
+		fdstates[fd].armed = 0;
+		MarkChanged(fd);
+
+		EventHandler* const eh = GetRef(fd);
+		if (!eh)
+			continue;
+
+		processed++;
+		if (cqe.res < 0)
+		{
+			stats.ErrorEvents++;
+			eh->OnEventHandlerError(-cqe.res);
+			continue;
+		}
+
+		const int revents = cqe.res;
+		if (revents & POLLHUP)
+		{
+			stats.ErrorEvents++;
+			eh->OnEventHandlerError(0);
+			continue;
+		}
+
+		if (revents & POLLERR)
+		{
+			stats.ErrorEvents++;
+			/* Get error number */
+			socklen_t codesize = sizeof(int);
+			int errcode;
+			if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &errcode, &codesize) < 0)
+				errcode = errno;
+			eh->OnEventHandlerError(errcode);
+			continue;
+		}
+
+		if (revents & POLLIN)
+		{
+			eh->SetEventMask(eh->GetEventMask() & ~FD_READ_WILL_BLOCK);
+			eh->OnEventHandlerRead();
+			if (eh != GetRef(fd))
+				// whoops, deleted out from under us
+				continue;
+		}
+
+		if (revents & POLLOUT)
+		{
+			int mask = eh->GetEventMask();
+			mask &= ~(FD_WRITE_WILL_BLOCK | FD_WANT_SINGLE_WRITE);
+			eh->SetEventMask(mask);
+			eh->OnEventHandlerWrite();
+		}
+	}
+	completions.clear();
+
+	stats.UpdateDispatchCounters(processed);
+	stats.TotalEvents += processed;
+	return processed;
+}
@@ -23,7 +23,10 @@
 
 #include "inspircd.h"
 #include "testsuite.h"
+#include "xline.h"
+#include "multimatch.h"
 #include <iostream>
+#include <set>
 
 class TestSuiteThread : public Thread
 {
@@ -63,6 +66,12 @@ TestSuite::TestSuite()
 		std::cout << "(6) Comma sepstream tests\n";
 		std::cout << "(7) Space sepstream tests\n";
 		std::cout << "(8) UID generation tests\n";
+		std::cout << "(9) Timer tests\n";
+		std::cout << "(A) XLine lookup tests\n";
+		std::cout << "(B) Channel member list tests\n";
+		std::cout << "(C) Line tokenizer tests\n";
+		std::cout << "(D) Multi-pattern matcher tests\n";
+		std::cout << "(E) Benchmarks\n";
 
 		std::cout << std::endl << "(X) Exit test suite\n";
 
@@ -110,6 +119,24 @@ TestSuite::TestSuite()
 			case '8':
 				std::cout << (DoGenerateUIDTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
 				break;
+			case '9':
+				std::cout << (DoTimerTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'A':
+				std::cout << (DoXLineTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'B':
+				std::cout << (DoMemberListTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'C':
+				std::cout << (DoLineTokenizerTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'D':
+				std::cout << (DoMultiMatchTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'E':
+				DoBenchmarks();
+				break;
 			case 'X':
 				return;
 				break;
@@ -280,6 +307,78 @@ bool TestSuite::DoSpaceSepStreamTests()
 	return true;
 }
 
+namespace
+{
+	/** A line and the tokens it is split into, NULL terminated
+	 */
+	struct TokenizerTestCase
+	{
+		const char* line;
+		const char* tokens[6];
+	};
+}
+
+bool TestSuite::DoLineTokenizerTests()
+{
+	// Longer lines come first so the vector has strings left over from the previous line
+	const TokenizerTestCase tests[] = {
+		{ "MODE #test +o-v  nick1 nick2", { "MODE", "#test", "+o-v", "nick1", "nick2", NULL } },
+		{ ":prefix PRIVMSG #test :foo bar", { ":prefix", "PRIVMSG", "#test", "foo bar", NULL } },
+		{ "PRIVMSG #test :foo bar baz qux", { "PRIVMSG", "#test", "foo bar baz qux", NULL } },
+		{ "  PRIVMSG   #test    :  spaced  trailing  ", { "PRIVMSG", "#test", "  spaced  trailing  ", NULL } },
+		{ "PRIVMSG #test not:trailing", { "PRIVMSG", "#test", "not:trailing", NULL } },
+		{ "PRIVMSG #test : x", { "PRIVMSG", "#test", " x", NULL } },
+		{ "PRIVMSG #test :", { "PRIVMSG", "#test", "", NULL } },
+		{ "MODE #test :", { "MODE", "#test", "", NULL } },
+		{ ":trailing", { ":trailing", NULL } },
+		{ "NICK", { "NICK", NULL } },
+		{ "", { NULL } },
+		{ "   ", { NULL } }
+	};
+
+	bool passed = true;
+	std::vector<std::string> tokens;
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		const std::string line = tests[i].line;
+		std::vector<std::string> expected;
+		for (const char* const* t = tests[i].tokens; *t; ++t)
+			expected.push_back(*t);
+
+		irc::linetokenizer lt(line);
+		lt.GetTokens(tokens);
+		if (tokens != expected)
+		{
+			std::cout << "LINETOKENIZER: FAILURE: \"" << line << "\" was split into " << tokens.size() << " tokens, expected " << expected.size() << std::endl;
+			passed = false;
+		}
+
+		// tokenstream is still used elsewhere and has to split lines the same way
+		std::vector<std::string> streamtokens;
+		irc::tokenstream ts(line);
+		std::string token;
+		while (ts.GetToken(token))
+			streamtokens.push_back(token);
+
+		if (streamtokens != expected)
+		{
+			std::cout << "LINETOKENIZER: FAILURE: tokenstream split \"" << line << "\" into " << streamtokens.size() << " tokens, expected " << expected.size() << std::endl;
+			passed = false;
+		}
+	}
+
+	// GetToken() reports the end of the line and clears the token
+	const std::string line = "JOIN #test";
+	irc::linetokenizer lt(line);
+	std::string token;
+	if ((!lt.GetToken(token)) || (token != "JOIN") || (!lt.GetToken(token)) || (token != "#test") || (lt.GetToken(token)) || (!token.empty()) || (lt.GetToken(token)))
+	{
+		std::cout << "LINETOKENIZER: FAILURE: GetToken() did not return JOIN, #test and then nothing\n";
+		passed = false;
+	}
+	return passed;
+}
+
 bool TestSuite::DoThreadTests()
 {
 	std::string anything;
@@ -295,7 +394,7 @@ bool TestSuite::DoThreadTests()
 		std::cout << "Creation failed, test failure.\n";
 		return false;
 	}
-	std::cout << "Creation success, type " << te->GetName() << "\n";
+	std::cout << "Creation success\n";
 
 	std::cout << "Allocate: new TestSuiteThread...\n";
 	TestSuiteThread* tst = new TestSuiteThread();
@@ -394,6 +493,973 @@ bool TestSuite::DoGenerateUIDTests()
 	return true;
 }
 
+namespace
+{
+	class TestSuiteTimer : public Timer
+	{
+	 public:
+		unsigned long ticks;
+
+		/** Time passed to the last Tick()
+		 */
+		time_t lasttick;
+
+		/** Timer to remove from the manager when this one ticks, if any
+		 */
+		Timer* cancel;
+		TimerManager* manager;
+
+		TestSuiteTimer(time_t when, bool repeating = false, unsigned int interval = 0)
+			: Timer(interval, repeating)
+			, ticks(0)
+			, lasttick(0)
+			, cancel(NULL)
+			, manager(NULL)
+		{
+			SetTrigger(when);
+		}
+
+		bool Tick(time_t TIME) CXX11_OVERRIDE
+		{
+			ticks++;
+			lasttick = TIME;
+			if (cancel)
+				manager->DelTimer(cancel);
+			return true;
+		}
+	};
+
+	bool CheckTimer(const TestSuiteTimer& t, const char* what, unsigned long ticks, time_t lasttick)
+	{
+		if ((t.ticks == ticks) && (t.lasttick == lasttick))
+			return true;
+
+		std::cout << "TIMER: FAILURE: " << what << " ticked " << t.ticks << " times, last at " << t.lasttick << ", expected " << ticks << " times, last at " << lasttick << std::endl;
+		return false;
+	}
+}
+
+bool TestSuite::DoTimerTests()
+{
+	bool passed = true;
+	time_t now = 1000000;
+	TimerManager manager;
+	manager.TickTimers(now);
+
+	// Timers at the edges of every level of the wheel and in the overflow list, added in
+	// reverse order. Ticking second by second, each must tick once at its trigger time.
+	static const time_t delays[] = { 1, 2, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 262145, 16777215, 16777216, 16777217, 20000000 };
+	const size_t count = sizeof(delays) / sizeof(delays[0]);
+	std::vector<TestSuiteTimer*> timers;
+	for (size_t i = count; i-- > 0; )
+	{
+		timers.push_back(new TestSuiteTimer(now + delays[i]));
+		manager.AddTimer(timers.back());
+	}
+
+	const time_t end = now + delays[count - 1];
+	for (time_t t = now + 1; t <= end; t++)
+		manager.TickTimers(t);
+	for (size_t i = 0; i < count; i++)
+	{
+		TestSuiteTimer* t = timers[count - 1 - i];
+		const std::string what = "timer due in " + ConvToStr(delays[i]) + "s";
+		passed &= CheckTimer(*t, what.c_str(), 1, now + delays[i]);
+	}
+	stdalgo::delete_all(timers);
+	now = end;
+
+	// Removed timers don't tick, also when removed by a timer ticking in the same second
+	TestSuiteTimer first(now + 10), second(now + 10), removed(now + 5);
+	first.cancel = &second;
+	first.manager = &manager;
+	manager.AddTimer(&first);
+	manager.AddTimer(&second);
+	manager.AddTimer(&removed);
+	manager.DelTimer(&removed);
+
+	// Adding a pending timer again moves it
+	TestSuiteTimer moved(now + 3);
+	manager.AddTimer(&moved);
+	moved.SetTrigger(now + 7);
+	manager.AddTimer(&moved);
+
+	// Repeating timers tick every interval until the repeat is cancelled
+	TestSuiteTimer repeating(now + 4, true, 4);
+	manager.AddTimer(&repeating);
+
+	for (time_t t = now + 1; t <= now + 12; t++)
+		manager.TickTimers(t);
+	passed &= CheckTimer(first, "timer removing another", 1, now + 10);
+	passed &= CheckTimer(second, "timer removed by another", 0, 0);
+	passed &= CheckTimer(removed, "removed timer", 0, 0);
+	passed &= CheckTimer(moved, "moved timer", 1, now + 7);
+	passed &= CheckTimer(repeating, "repeating timer", 3, now + 12);
+
+	repeating.CancelRepeat();
+	for (time_t t = now + 13; t <= now + 20; t++)
+		manager.TickTimers(t);
+	passed &= CheckTimer(repeating, "cancelled repeating timer", 4, now + 16);
+	now += 20;
+
+	// When the clock jumps ahead, every timer that became due ticks once
+	TestSuiteTimer skipped1(now + 10), skipped2(now + 5000), pending(now + 200000);
+	manager.AddTimer(&skipped1);
+	manager.AddTimer(&skipped2);
+	manager.AddTimer(&pending);
+	manager.TickTimers(now + 100000);
+	passed &= CheckTimer(skipped1, "timer skipped by a jump", 1, now + 100000);
+	passed &= CheckTimer(skipped2, "timer skipped by a jump", 1, now + 100000);
+	passed &= CheckTimer(pending, "timer after a jump", 0, 0);
+	now += 100000;
+
+	// When the clock goes backwards, timers still tick at their trigger time and not earlier
+	TestSuiteTimer backwards(now + 10);
+	manager.AddTimer(&backwards);
+	manager.TickTimers(now - 100);
+	for (time_t t = now - 99; t <= now + 9; t++)
+		manager.TickTimers(t);
+	passed &= CheckTimer(backwards, "timer before its trigger after the clock went back", 0, 0);
+	manager.TickTimers(now + 10);
+	passed &= CheckTimer(backwards, "timer after the clock went back", 1, now + 10);
+
+	return passed;
+}
+
+namespace
+{
+	/** Look up a line by checking every line of the type, the way XLineManager used to
+	 */
+	XLine* LinearMatchesLine(XLineLookup* lookup, User* user)
+	{
+		for (LookupIter i = lookup->begin(); i != lookup->end(); ++i)
+		{
+			if (i->second->Matches(user))
+				return i->second;
+		}
+		return NULL;
+	}
+
+	FakeUser* CreateXLineUser(const std::string& uid, const std::string& ident, const std::string& host, const std::string& ip)
+	{
+		FakeUser* user = new FakeUser(uid, ServerInstance->FakeClient->server);
+		user->ident = ident;
+		user->SetClientIP(ip);
+		user->ChangeRealHost(host, true);
+		return user;
+	}
+
+	/** Check that a lookup returns the line with the given mask, or nothing if mask is NULL
+	 */
+	bool CheckXLineMatch(XLineManager& manager, const std::string& type, User* user, const char* mask)
+	{
+		XLine* line = manager.MatchesLine(type, user);
+		if ((mask ? ((line) && (line->Displayable() == mask)) : (!line)))
+			return true;
+
+		std::cout << "XLINE: FAILURE: " << type << " lookup for " << user->ident << "@" << user->GetRealHost() << " [" << user->GetIPString() << "] returned "
+			<< (line ? line->Displayable() : "nothing") << ", expected " << (mask ? mask : "nothing") << std::endl;
+		return false;
+	}
+
+	/** Check that the index returns the same line as a scan of all lines for every user
+	 */
+	bool CheckXLineIndex(XLineManager& manager, const std::vector<FakeUser*>& users, const char* stage)
+	{
+		bool passed = true;
+		const char* types[] = { "Z", "G" };
+		for (unsigned int t = 0; t < 2; t++)
+		{
+			for (std::vector<FakeUser*>::const_iterator i = users.begin(); i != users.end(); ++i)
+			{
+				XLine* expected = LinearMatchesLine(manager.GetAll(types[t]), *i);
+				XLine* line = manager.MatchesLine(types[t], *i);
+				if (line != expected)
+				{
+					std::cout << "XLINE: FAILURE: " << stage << ": " << types[t] << " lookup for " << (*i)->ident << "@" << (*i)->GetRealHost() << " [" << (*i)->GetIPString() << "] returned "
+						<< (line ? line->Displayable() : "nothing") << ", expected " << (expected ? expected->Displayable() : "nothing") << std::endl;
+					passed = false;
+				}
+			}
+		}
+		return passed;
+	}
+}
+
+bool TestSuite::DoXLineTests()
+{
+	XLineManager manager;
+	XLineFactory* zfactory = manager.GetFactory("Z");
+	XLineFactory* gfactory = manager.GetFactory("G");
+	const time_t now = ServerInstance->Time();
+
+	const char* masks[][2] = {
+		{ "Z", "10.1.2.3" },
+		{ "Z", "10.2.0.0/16" },
+		{ "Z", "10.2.3.4" },
+		{ "Z", "2001:db8::/32" },
+		{ "G", "*@HOST1.EXAMPLE.COM" },
+		{ "G", "ident5@192.168.5.0/24" },
+		{ "G", "*@*.isp3.example.net" },
+	};
+	for (unsigned int i = 0; i < sizeof(masks) / sizeof(masks[0]); i++)
+	{
+		XLineFactory* factory = (masks[i][0][0] == 'Z' ? zfactory : gfactory);
+		manager.AddLine(factory->Generate(now, 0, "testsuite", "test", masks[i][1]), NULL);
+	}
+
+	std::vector<FakeUser*> users;
+	users.push_back(CreateXLineUser("0TSXLINE1", "user", "host1.example.com", "10.1.2.3"));
+	users.push_back(CreateXLineUser("0TSXLINE2", "user", "10.2.3.4", "10.2.3.4"));
+	users.push_back(CreateXLineUser("0TSXLINE3", "ident5", "192.168.5.1", "192.168.5.1"));
+	users.push_back(CreateXLineUser("0TSXLINE4", "ident6", "192.168.5.1", "192.168.5.1"));
+	users.push_back(CreateXLineUser("0TSXLINE5", "user", "dsl1.isp3.example.net", "2001:db8::1"));
+	users.push_back(CreateXLineUser("0TSXLINE6", "user", "dsl1.isp4.example.net", "2001:db9::1"));
+
+	// Single IPs, ranges, exact hosts (case insensitive) and wildcards are found, if more
+	// than one line matches the first in list order is returned
+	bool passed = true;
+	passed &= CheckXLineMatch(manager, "Z", users[0], "10.1.2.3");
+	passed &= CheckXLineMatch(manager, "G", users[0], "*@HOST1.EXAMPLE.COM");
+	passed &= CheckXLineMatch(manager, "Z", users[1], "10.2.0.0/16");
+	passed &= CheckXLineMatch(manager, "G", users[2], "ident5@192.168.5.0/24");
+	passed &= CheckXLineMatch(manager, "G", users[3], NULL);
+	passed &= CheckXLineMatch(manager, "Z", users[4], "2001:db8::/32");
+	passed &= CheckXLineMatch(manager, "G", users[4], "*@*.isp3.example.net");
+	passed &= CheckXLineMatch(manager, "Z", users[5], NULL);
+	passed &= CheckXLineMatch(manager, "G", users[5], NULL);
+
+	// Removed lines are no longer found, the next matching line is
+	manager.DelLine("10.2.0.0/16", "Z", NULL);
+	manager.DelLine("*@HOST1.EXAMPLE.COM", "G", NULL);
+	passed &= CheckXLineMatch(manager, "Z", users[1], "10.2.3.4");
+	passed &= CheckXLineMatch(manager, "G", users[0], NULL);
+
+	// Expired lines are skipped and removed, the next matching line is returned
+	XLine* expiring = gfactory->Generate(now, 60, "testsuite", "expiring", "*@*.example.net");
+	manager.AddLine(expiring, NULL);
+	passed &= CheckXLineMatch(manager, "G", users[4], "*@*.example.net");
+	expiring->SetCreateTime(now - 120);
+	passed &= CheckXLineMatch(manager, "G", users[4], "*@*.isp3.example.net");
+	passed &= CheckXLineMatch(manager, "G", users[5], NULL);
+	if (manager.GetAll("G")->count("*@*.example.net"))
+	{
+		std::cout << "XLINE: FAILURE: expired line was not removed\n";
+		passed = false;
+	}
+
+	// Many lines of every kind, the index must agree with a scan of all lines after lines are added and removed
+	std::vector<std::string> bulk;
+	for (unsigned int i = 0; i < 1000; i++)
+	{
+		bulk.push_back("10." + ConvToStr(i % 256) + "." + ConvToStr(i / 256) + ".0/" + ConvToStr(16 + i % 17));
+		bulk.push_back("*@host" + ConvToStr(i) + ".example.com");
+		bulk.push_back("ident" + ConvToStr(i % 50) + "@172." + ConvToStr(i % 32) + "." + ConvToStr(i % 256) + ".*");
+	}
+	for (unsigned int i = 0; i < 500; i++)
+	{
+		const unsigned int n = i * 7919;
+		const std::string ip = "10." + ConvToStr(n % 256) + "." + ConvToStr((n / 256) % 8) + "." + ConvToStr(n % 100);
+		const std::string host = (i % 2 ? "host" + ConvToStr(n % 2000) + ".example.com" : "172." + ConvToStr(n % 32) + "." + ConvToStr(n % 256) + ".1");
+		users.push_back(CreateXLineUser("0TSXL" + ConvToStr(1000 + i), "ident" + ConvToStr(n % 60), host, ip));
+	}
+
+	for (std::vector<std::string>::const_iterator i = bulk.begin(); i != bulk.end(); ++i)
+	{
+		XLineFactory* factory = ((*i)[0] == '1' ? zfactory : gfactory);
+		manager.AddLine(factory->Generate(now, 0, "testsuite", "bulk", *i), NULL);
+	}
+	passed &= CheckXLineIndex(manager, users, "after adding");
+
+	for (unsigned int i = 0; i < bulk.size(); i += 2)
+		manager.DelLine(bulk[i].c_str(), (bulk[i][0] == '1' ? "Z" : "G"), NULL);
+	passed &= CheckXLineIndex(manager, users, "after removing");
+
+	for (unsigned int i = 0; i < bulk.size(); i += 4)
+	{
+		XLineFactory* factory = (bulk[i][0] == '1' ? zfactory : gfactory);
+		manager.AddLine(factory->Generate(now, 0, "testsuite", "bulk", bulk[i]), NULL);
+	}
+	passed &= CheckXLineIndex(manager, users, "after adding again");
+
+	for (std::vector<FakeUser*>::const_iterator i = users.begin(); i != users.end(); ++i)
+		ServerInstance->GlobalCulls.AddItem(*i);
+	return passed;
+}
+
+namespace
+{
+	/** Check that the member list of a channel holds exactly the given users
+	 * @param present Whether each user of users should be a member
+	 */
+	bool CheckMembers(Channel* chan, const std::vector<FakeUser*>& users, const std::vector<bool>& present, const char* stage)
+	{
+		size_t expected = 0;
+		for (size_t i = 0; i < users.size(); i++)
+		{
+			Membership* memb = chan->GetUser(users[i]);
+			if (present[i])
+				expected++;
+			if ((present[i] != (memb != NULL)) || ((memb) && ((memb->user != users[i]) || (memb->chan != chan))))
+			{
+				std::cout << "MEMBERS: FAILURE: " << stage << ": lookup of member " << i << " returned the wrong Membership\n";
+				return false;
+			}
+		}
+
+		// Walking the list visits every member once
+		std::set<User*> seen;
+		const Channel::MemberMap& members = chan->GetUsers();
+		for (Channel::MemberMap::const_iterator i = members.begin(); i != members.end(); ++i)
+		{
+			if ((i->second->user != i->first) || (!seen.insert(i->first).second))
+			{
+				std::cout << "MEMBERS: FAILURE: " << stage << ": walking the member list visited a member twice or an entry with the wrong Membership\n";
+				return false;
+			}
+		}
+
+		if ((members.size() != expected) || (seen.size() != expected))
+		{
+			std::cout << "MEMBERS: FAILURE: " << stage << ": " << members.size() << " members, walked " << seen.size() << ", expected " << expected << std::endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+bool TestSuite::DoMemberListTests()
+{
+	const unsigned int MEMBER_COUNT = 5000;
+
+	std::vector<FakeUser*> users;
+	for (unsigned int i = 0; i < MEMBER_COUNT; i++)
+		users.push_back(new FakeUser("0TS" + ConvToStr(100000 + i), ServerInstance->FakeClient->server));
+
+	bool passed = true;
+	Channel* chan = new Channel("#testsuite-members", ServerInstance->Time());
+	std::vector<bool> present(MEMBER_COUNT, false);
+	std::vector<Membership*> handles(MEMBER_COUNT);
+	for (unsigned int i = 0; i < MEMBER_COUNT; i++)
+	{
+		const unsigned int n = (i * 7919) % MEMBER_COUNT;
+		handles[n] = chan->AddUser(users[n]);
+		present[n] = true;
+		if (!handles[n])
+			passed = false;
+	}
+	passed &= CheckMembers(chan, users, present, "after joining");
+
+	if (chan->AddUser(users[0]))
+	{
+		std::cout << "MEMBERS: FAILURE: duplicate AddUser() succeeded\n";
+		passed = false;
+	}
+
+	// Fan-out only visits the local members and none of the members are local
+	if (!chan->GetLocalUsers().empty())
+	{
+		std::cout << "MEMBERS: FAILURE: remote members are in the local member list\n";
+		passed = false;
+	}
+
+	// Members leave in a different order than they joined
+	for (unsigned int i = 0; i < MEMBER_COUNT; i += 3)
+	{
+		const unsigned int n = (i * 104729) % MEMBER_COUNT;
+		chan->DelUser(users[n]);
+		present[n] = false;
+	}
+	passed &= CheckMembers(chan, users, present, "after parting");
+
+	// Removing members does not move the Membership objects of the others
+	for (unsigned int i = 0; i < MEMBER_COUNT; i++)
+	{
+		if ((present[i]) && (chan->GetUser(users[i]) != handles[i]))
+		{
+			std::cout << "MEMBERS: FAILURE: Membership of member " << i << " changed after other members left\n";
+			passed = false;
+			break;
+		}
+	}
+
+	for (unsigned int i = 0; i < MEMBER_COUNT; i += 6)
+	{
+		const unsigned int n = (i * 104729) % MEMBER_COUNT;
+		chan->AddUser(users[n]);
+		present[n] = true;
+	}
+	passed &= CheckMembers(chan, users, present, "after joining again");
+
+	// Leave a handful of members so the member list shrinks, then empty it
+	for (unsigned int i = 10; i < MEMBER_COUNT; i++)
+	{
+		if (present[i])
+			chan->DelUser(users[i]);
+		present[i] = false;
+	}
+	passed &= CheckMembers(chan, users, present, "after most members left");
+
+	// Deleting the last member queues the channel for destruction
+	for (unsigned int i = 0; i < 10; i++)
+	{
+		if (present[i])
+			chan->DelUser(users[i]);
+	}
+
+	for (std::vector<FakeUser*>::const_iterator i = users.begin(); i != users.end(); ++i)
+		ServerInstance->GlobalCulls.AddItem(*i);
+	return passed;
+}
+
+namespace
+{
+	/** Return the index of the first mask matching the text, or masks.size() if none does
+	 */
+	size_t LinearMatch(const std::vector<std::string>& masks, const std::string& text)
+	{
+		for (size_t i = 0; i < masks.size(); i++)
+		{
+			if (InspIRCd::Match(text, masks[i]))
+				return i;
+		}
+		return masks.size();
+	}
+
+	/** Find the first mask matching the text by only checking the masks whose literal the matcher finds, like m_filter does
+	 */
+	size_t IndexedMatch(insp::MultiMatcher& matcher, const std::vector<std::string>& masks, const std::string& text)
+	{
+		insp::MultiMatcher::IdList found;
+		matcher.Find(text, found);
+		for (insp::MultiMatcher::IdList::const_iterator i = found.begin(); i != found.end(); ++i)
+		{
+			if (InspIRCd::Match(text, masks[*i]))
+				return *i;
+		}
+		return masks.size();
+	}
+
+	/** Check that Find() returns the given ids, terminated by -1
+	 */
+	bool CheckFind(insp::MultiMatcher& matcher, const std::string& text, const int* expected)
+	{
+		insp::MultiMatcher::IdList wanted;
+		for (const int* i = expected; *i >= 0; ++i)
+			wanted.push_back(*i);
+
+		insp::MultiMatcher::IdList found;
+		if ((matcher.Find(text, found) == !wanted.empty()) && (found == wanted))
+			return true;
+
+		std::cout << "MULTIMATCH: FAILURE: found " << found.size() << " strings in '" << text << "', expected " << wanted.size() << std::endl;
+		return false;
+	}
+
+	/** Check that the matcher finds exactly the strings that occur in each text
+	 * @param strings The strings in the matcher, the index is the id, empty strings are not in the matcher
+	 */
+	bool CheckFindAll(insp::MultiMatcher& matcher, const std::vector<std::string>& strings, const std::vector<std::string>& texts, const char* stage)
+	{
+		insp::MultiMatcher::IdList found;
+		for (std::vector<std::string>::const_iterator m = texts.begin(); m != texts.end(); ++m)
+		{
+			found.clear();
+			matcher.Find(*m, found);
+			irc::string text(m->c_str());
+			for (size_t i = 0; i < strings.size(); i++)
+			{
+				const bool expected = ((!strings[i].empty()) && (text.find(irc::string(strings[i].c_str())) != irc::string::npos));
+				if (expected != std::binary_search(found.begin(), found.end(), i))
+				{
+					std::cout << "MULTIMATCH: FAILURE: " << stage << ": '" << strings[i] << "' " << (expected ? "not found" : "found") << " in '" << *m << "'\n";
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	/** Spam filters as they are usually written, some of them sharing prefixes and suffixes
+	 */
+	std::vector<std::string> CreateFilterMasks(unsigned int count)
+	{
+		std::vector<std::string> masks;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			switch (i % 4)
+			{
+				case 0:
+					masks.push_back("*spam" + ConvToStr(i) + "*");
+					break;
+				case 1:
+					masks.push_back("*www.badsite" + ConvToStr(i) + ".example.com*");
+					break;
+				case 2:
+					masks.push_back("*BUY*PILLS" + ConvToStr(i) + "*");
+					break;
+				default:
+					masks.push_back("hello world " + ConvToStr(i) + "*");
+					break;
+			}
+		}
+		return masks;
+	}
+
+	std::vector<std::string> CreateFilterMessages(unsigned int count, unsigned int filtercount)
+	{
+		std::vector<std::string> messages;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			const unsigned int n = i * 7919;
+			std::string message = "hey there, did you see the game last night? it was about time " + ConvToStr(n);
+			switch (i % 10)
+			{
+				case 0:
+					message += " SPAM" + ConvToStr(n % (filtercount * 2));
+					break;
+				case 1:
+					message = "check out www.badsite" + ConvToStr(n % filtercount) + ".example.com " + message;
+					break;
+				case 2:
+					message = "Hello World " + ConvToStr(n % filtercount) + " and goodbye";
+					break;
+				case 3:
+					message += " buy some pills" + ConvToStr(n % filtercount);
+					break;
+			}
+			messages.push_back(message);
+		}
+		return messages;
+	}
+}
+
+bool TestSuite::DoMultiMatchTests()
+{
+	bool passed = true;
+
+	// Literal extraction must never return a string that a matching text can lack
+	static const char* const regexes[][2] = {
+		{ "buy cheap viagra", "buy cheap viagra" },
+		{ "\\bfree (money|cash)\\b", "free " },
+		{ "^join #[a-z]+ now$", "join #" },
+		{ "spam|eggs", "" },
+		{ "colou?r tv", "colo" },
+		{ "ab+c", "ab" },
+		{ "x{2,3}yz", "yz" },
+		{ "\\x41bcd", "bcd" },
+		{ "w(hat)*ever", "ever" },
+		{ "(?x) a b c", "" },
+		{ "(?i)hello world", "hello world" },
+		{ "a\\(bc\\)*d", "" },
+		{ "foo\\.bar", "foo" },
+		{ "[[:alpha:]]+xyz]", "xyz]" },
+		{ "unbalanced)", "" },
+	};
+	for (size_t i = 0; i < sizeof(regexes) / sizeof(regexes[0]); i++)
+	{
+		const std::string literal = insp::MultiMatcher::GetRegexLiteral(regexes[i][0]);
+		if (literal != regexes[i][1])
+		{
+			std::cout << "MULTIMATCH: FAILURE: literal of '" << regexes[i][0] << "' is '" << literal << "', expected '" << regexes[i][1] << "'\n";
+			passed = false;
+		}
+	}
+	if (insp::MultiMatcher::GetGlobLiteral("*buy?cheap*pills*") != "cheap")
+	{
+		std::cout << "MULTIMATCH: FAILURE: wrong glob literal\n";
+		passed = false;
+	}
+
+	// Overlapping strings are all found, case insensitively, and every id is reported once in ascending order
+	insp::MultiMatcher matcher;
+	matcher.Add("he", 0);
+	matcher.Add("she", 1);
+	matcher.Add("his", 2);
+	matcher.Add("hers", 3);
+	matcher.Add("", 4);
+	matcher.Add("SHE", 5);
+	matcher.Add("ers", 5);
+	static const int ushers[] = { 0, 1, 3, 5, -1 };
+	static const int his[] = { 2, -1 };
+	static const int none[] = { -1 };
+	passed &= CheckFind(matcher, "USHERS", ushers);
+	passed &= CheckFind(matcher, "this", his);
+	passed &= CheckFind(matcher, "nothing to see", none);
+	passed &= CheckFind(matcher, "", none);
+
+	// Strings added after a search are found by the next one
+	matcher.Add("ush", 6);
+	static const int ushers2[] = { 0, 1, 3, 5, 6, -1 };
+	passed &= CheckFind(matcher, "ushers", ushers2);
+
+	// A cleared matcher finds nothing until strings are added again
+	matcher.Clear();
+	if (!matcher.empty())
+	{
+		std::cout << "MULTIMATCH: FAILURE: matcher not empty after Clear()\n";
+		passed = false;
+	}
+	passed &= CheckFind(matcher, "ushers", none);
+	matcher.Add("his", 7);
+	static const int his2[] = { 7, -1 };
+	passed &= CheckFind(matcher, "this", his2);
+	passed &= CheckFind(matcher, "ushers", none);
+
+	// Many strings, the matcher must agree with a substring search after strings are added and the set is rebuilt
+	const std::vector<std::string> masks = CreateFilterMasks(1000);
+	const std::vector<std::string> messages = CreateFilterMessages(500, 1000);
+	std::vector<std::string> literals;
+	matcher.Clear();
+	for (size_t i = 0; i < masks.size() / 2; i++)
+	{
+		literals.push_back(insp::MultiMatcher::GetGlobLiteral(masks[i]));
+		matcher.Add(literals.back(), i);
+	}
+	passed &= CheckFindAll(matcher, literals, messages, "after adding");
+
+	for (size_t i = masks.size() / 2; i < masks.size(); i++)
+	{
+		literals.push_back(insp::MultiMatcher::GetGlobLiteral(masks[i]));
+		matcher.Add(literals.back(), i);
+	}
+	passed &= CheckFindAll(matcher, literals, messages, "after adding more");
+
+	// Removing strings is done by rebuilding the set without them
+	matcher.Clear();
+	for (size_t i = 0; i < literals.size(); i++)
+	{
+		if (i % 3)
+			matcher.Add(literals[i], i);
+		else
+			literals[i].clear();
+	}
+	passed &= CheckFindAll(matcher, literals, messages, "after removing");
+
+	// Checking only the masks whose literal was found gives the same result as checking all masks
+	std::vector<std::string> remaining;
+	matcher.Clear();
+	for (size_t i = 0; i < masks.size(); i++)
+	{
+		if (literals[i].empty())
+			continue;
+		matcher.Add(literals[i], remaining.size());
+		remaining.push_back(masks[i]);
+	}
+	for (std::vector<std::string>::const_iterator m = messages.begin(); m != messages.end(); ++m)
+	{
+		const size_t expected = LinearMatch(remaining, *m);
+		const size_t result = IndexedMatch(matcher, remaining, *m);
+		if (result != expected)
+		{
+			std::cout << "MULTIMATCH: FAILURE: '" << *m << "' matched filter " << result << ", expected " << expected << std::endl;
+			passed = false;
+		}
+	}
+	return passed;
+}
+
+namespace
+{
+	/** A workload timed by RunBenchmark(), done once by the current implementation
+	 * and once by the implementation it replaced
+	 */
+	class Benchmark
+	{
+	 public:
+		/** Name of the workload
+		 */
+		const std::string name;
+
+		Benchmark(const std::string& Name) : name(Name) { }
+		virtual ~Benchmark() { }
+
+		/** Do the workload with the current implementation
+		 */
+		virtual void RunCurrent() = 0;
+
+		/** Do the workload with the previous implementation
+		 */
+		virtual void RunPrevious() = 0;
+	};
+
+	double TimeRun(Benchmark& bench, void (Benchmark::*run)())
+	{
+		const clock_t begin = clock();
+		(bench.*run)();
+		return double(clock() - begin) / CLOCKS_PER_SEC;
+	}
+
+	void RunBenchmark(Benchmark& bench)
+	{
+		const double current = TimeRun(bench, &Benchmark::RunCurrent);
+		const double previous = TimeRun(bench, &Benchmark::RunPrevious);
+		std::cout << bench.name << ": " << current << "s, previously " << previous << "s\n";
+	}
+
+	const unsigned int TIMER_COUNT = 200000;
+	const unsigned int TIMER_SPREAD = 7200;
+
+	class TimerBenchmark : public Benchmark
+	{
+		class NullTimer : public Timer
+		{
+		 public:
+			NullTimer(time_t when) : Timer(0) { SetTrigger(when); }
+			bool Tick(time_t TIME) CXX11_OVERRIDE { return true; }
+		};
+
+		const time_t start;
+		std::vector<NullTimer*> timers;
+
+	 public:
+		TimerBenchmark()
+			: Benchmark("Add " + ConvToStr(TIMER_COUNT) + " timers, remove half of them, tick through " + ConvToStr(TIMER_SPREAD) + " seconds")
+			, start(1000000)
+		{
+			for (unsigned int i = 0; i < TIMER_COUNT; i++)
+				timers.push_back(new NullTimer(start + (i * 7919) % TIMER_SPREAD + 1));
+		}
+
+		~TimerBenchmark()
+		{
+			stdalgo::delete_all(timers);
+		}
+
+		void RunCurrent() CXX11_OVERRIDE
+		{
+			TimerManager manager;
+			manager.TickTimers(start);
+			for (unsigned int i = 0; i < TIMER_COUNT; i++)
+				manager.AddTimer(timers[i]);
+			for (unsigned int i = 0; i < TIMER_COUNT; i += 2)
+				manager.DelTimer(timers[i]);
+			for (time_t now = start; now <= start + TIMER_SPREAD; now++)
+				manager.TickTimers(now);
+		}
+
+		void RunPrevious() CXX11_OVERRIDE
+		{
+			// Timers used to be stored in a std::multimap keyed by trigger time
+			typedef std::multimap<time_t, Timer*> TimerMap;
+			TimerMap map;
+			for (unsigned int i = 0; i < TIMER_COUNT; i++)
+				map.insert(std::make_pair(timers[i]->GetTrigger(), timers[i]));
+			for (unsigned int i = 0; i < TIMER_COUNT; i += 2)
+			{
+				std::pair<TimerMap::iterator, TimerMap::iterator> itpair = map.equal_range(timers[i]->GetTrigger());
+				for (TimerMap::iterator it = itpair.first; it != itpair.second; ++it)
+				{
+					if (it->second == timers[i])
+					{
+						map.erase(it);
+						break;
+					}
+				}
+			}
+			for (time_t now = start; now <= start + TIMER_SPREAD; now++)
+			{
+				for (TimerMap::iterator it = map.begin(); it != map.end(); )
+				{
+					Timer* t = it->second;
+					if (t->GetTrigger() > now)
+						break;
+					map.erase(it++);
+					t->Tick(now);
+				}
+			}
+		}
+	};
+
+	/** Looks up the Z and G-lines of connecting users among many lines
+	 */
+	class XLineBenchmark : public Benchmark
+	{
+		XLineManager manager;
+		std::vector<FakeUser*> users;
+
+		void Lookup(XLine* (*lookup)(XLineManager&, const std::string&, User*))
+		{
+			for (std::vector<FakeUser*>::const_iterator i = users.begin(); i != users.end(); ++i)
+			{
+				lookup(manager, "Z", *i);
+				lookup(manager, "G", *i);
+			}
+		}
+
+		static XLine* IndexLookup(XLineManager& xlines, const std::string& type, User* user)
+		{
+			return xlines.MatchesLine(type, user);
+		}
+
+		static XLine* LinearLookup(XLineManager& xlines, const std::string& type, User* user)
+		{
+			return LinearMatchesLine(xlines.GetAll(type), user);
+		}
+
+	 public:
+		XLineBenchmark()
+			: Benchmark("Look up the Z and G-lines of 500 users among 40000 lines")
+		{
+			XLineFactory* zfactory = manager.GetFactory("Z");
+			XLineFactory* gfactory = manager.GetFactory("G");
+			const time_t now = ServerInstance->Time();
+
+			// Single IPs as fed by DNSBLs, a few ranges and some wildcard masks
+			for (unsigned int i = 0; i < 20000; i++)
+			{
+				const std::string ip = "10." + ConvToStr(i % 256) + "." + ConvToStr((i / 256) % 256) + "." + ConvToStr(i % 7);
+				manager.AddLine(zfactory->Generate(now, 0, "testsuite", "single ip", ip), NULL);
+				manager.AddLine(gfactory->Generate(now, 0, "testsuite", "host", "*@host" + ConvToStr(i) + ".example.com"), NULL);
+			}
+			for (unsigned int i = 0; i < 256; i++)
+			{
+				manager.AddLine(zfactory->Generate(now, 0, "testsuite", "range", "172." + ConvToStr(i) + ".0.0/16"), NULL);
+				manager.AddLine(gfactory->Generate(now, 0, "testsuite", "wildcard", "*@*.isp" + ConvToStr(i) + ".example.net"), NULL);
+			}
+
+			for (unsigned int i = 0; i < 500; i++)
+			{
+				const unsigned int n = i * 7919;
+				const std::string ip = (i % 2 ? "10." + ConvToStr(n % 256) + "." + ConvToStr((n / 256) % 256) + "." + ConvToStr(n % 11) : "172." + ConvToStr(n % 300) + ".1.2");
+				const std::string host = (i % 3 ? "dsl" + ConvToStr(n) + ".isp" + ConvToStr(n % 300) + ".example.net" : "host" + ConvToStr(n % 40000) + ".example.com");
+				users.push_back(CreateXLineUser("0TSXB" + ConvToStr(1000 + i), "user", host, ip));
+			}
+		}
+
+		~XLineBenchmark()
+		{
+			for (std::vector<FakeUser*>::const_iterator i = users.begin(); i != users.end(); ++i)
+				ServerInstance->GlobalCulls.AddItem(*i);
+		}
+
+		void RunCurrent() CXX11_OVERRIDE { Lookup(IndexLookup); }
+		void RunPrevious() CXX11_OVERRIDE { Lookup(LinearLookup); }
+	};
+
+	/** Checks messages against many spam filters
+	 */
+	class MultiMatchBenchmark : public Benchmark
+	{
+		const std::vector<std::string> masks;
+		const std::vector<std::string> messages;
+		insp::MultiMatcher matcher;
+
+		/** Number of matches of the last run, stored so the runs can't be optimized away
+		 */
+		size_t matched;
+
+	 public:
+		MultiMatchBenchmark()
+			: Benchmark("Check 2000 messages against 3000 spam filters")
+			, masks(CreateFilterMasks(3000))
+			, messages(CreateFilterMessages(2000, 3000))
+			, matched(0)
+		{
+			for (size_t i = 0; i < masks.size(); i++)
+				matcher.Add(insp::MultiMatcher::GetGlobLiteral(masks[i]), i);
+		}
+
+		void RunCurrent() CXX11_OVERRIDE
+		{
+			matched = 0;
+			for (std::vector<std::string>::const_iterator m = messages.begin(); m != messages.end(); ++m)
+				matched += (IndexedMatch(matcher, masks, *m) != masks.size());
+		}
+
+		void RunPrevious() CXX11_OVERRIDE
+		{
+			matched = 0;
+			for (std::vector<std::string>::const_iterator m = messages.begin(); m != messages.end(); ++m)
+				matched += (LinearMatch(masks, *m) != masks.size());
+		}
+	};
+
+	const unsigned int TOKENIZE_COUNT = 500000;
+
+	/** Splits command lines like CommandParser does for every line a client sends
+	 */
+	class TokenizerBenchmark : public Benchmark
+	{
+		std::vector<std::string> lines;
+
+		/** Number of tokens seen by the last run, stored so the runs can't be optimized away
+		 */
+		size_t total;
+
+	 public:
+		TokenizerBenchmark()
+			: Benchmark("Split " + ConvToStr(TOKENIZE_COUNT) + " command lines into parameters")
+			, total(0)
+		{
+			for (unsigned int i = 0; i < 1000; i++)
+			{
+				const std::string n = ConvToStr(i);
+				switch (i % 4)
+				{
+					case 0:
+						lines.push_back("PRIVMSG #channel" + n + " :Hello everyone, this is message number " + n + " of the benchmark");
+						break;
+					case 1:
+						lines.push_back(":nick" + n + " PRIVMSG target" + n + " :short");
+						break;
+					case 2:
+						lines.push_back("MODE #channel" + n + " +ov-b nick" + n + " nick" + n + " *!*@host" + n + ".example.com");
+						break;
+					default:
+						lines.push_back("PING :irc" + n + ".example.net");
+						break;
+				}
+			}
+		}
+
+		void RunCurrent() CXX11_OVERRIDE
+		{
+			// CommandParser reuses one vector for all lines
+			total = 0;
+			std::vector<std::string> params;
+			for (unsigned int i = 0; i < TOKENIZE_COUNT; i++)
+			{
+				irc::linetokenizer tokens(lines[i % lines.size()]);
+				tokens.GetTokens(params);
+				total += params.size();
+			}
+		}
+
+		void RunPrevious() CXX11_OVERRIDE
+		{
+			total = 0;
+			for (unsigned int i = 0; i < TOKENIZE_COUNT; i++)
+			{
+				std::vector<std::string> params;
+				irc::tokenstream tokens(lines[i % lines.size()]);
+				std::string token;
+				while (tokens.GetToken(token))
+					params.push_back(token);
+				total += params.size();
+			}
+		}
+	};
+}
+
+bool TestSuite::DoBenchmarks()
+{
+	std::cout << "\nTime taken by the current implementation and by the one it replaced\n\n";
+
+	TimerBenchmark timers;
+	RunBenchmark(timers);
+
+	XLineBenchmark xlines;
+	RunBenchmark(xlines);
+
+	TokenizerBenchmark tokenizer;
+	RunBenchmark(tokenizer);
+
+	MultiMatchBenchmark filters;
+	RunBenchmark(filters);
+	return true;
+}
+
 TestSuite::~TestSuite()
 {
 	std::cout << "\n\n*** END OF TEST SUITE ***\n";
@@ -28,3 +28,179 @@ void Thread::join()
 {
 	ServerInstance->Threads.Stop(this);
 }
+
+ThreadPool::ThreadPool()
+{
+}
+
+void ThreadPool::Start(unsigned int threadcount)
+{
+	ServerInstance->Threads.Start(this);
+	for (unsigned int i = 1; i < threadcount; i++)
+	{
+		Worker* worker = new Worker(this);
+		ServerInstance->Threads.Start(worker);
+		workers.push_back(worker);
+	}
+}
+
+void ThreadPool::Stop()
+{
+	// Workers wake each other up when they exit
+	ServerInstance->Threads.Stop(this);
+	for (std::vector<Worker*>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+	{
+		ServerInstance->Threads.Stop(*i);
+		delete *i;
+	}
+	workers.clear();
+
+	// The modules the tasks would report to may be gone already
+	for (std::deque<Task*>::const_iterator i = pending.begin(); i != pending.end(); ++i)
+		delete *i;
+	pending.clear();
+	for (std::vector<Task*>::const_iterator i = done.begin(); i != done.end(); ++i)
+		delete *i;
+	done.clear();
+}
+
+void ThreadPool::Work()
+{
+	LockQueue();
+	while (!GetExitFlag())
+	{
+		if (pending.empty())
+		{
+			WaitForQueue();
+			continue;
+		}
+
+		Task* task = pending.front();
+		pending.pop_front();
+		running.push_back(task);
+		UnlockQueue();
+
+		task->Run();
+
+		LockQueue();
+		stdalgo::erase(running, task);
+		done.push_back(task);
+		NotifyParent();
+		UnlockQueue();
+
+		finished.Lock();
+		finished.Wakeup();
+		finished.Unlock();
+
+		LockQueue();
+	}
+	UnlockQueueWakeup();
+}
+
+void ThreadPool::Run()
+{
+	Work();
+}
+
+void ThreadPool::Submit(Task* task)
+{
+	LockQueue();
+	pending.push_back(task);
+	UnlockQueueWakeup();
+}
+
+void ThreadPool::OnNotify()
+{
+	std::vector<Task*> ready;
+	LockQueue();
+	ready.swap(done);
+	UnlockQueue();
+
+	for (std::vector<Task*>::const_iterator i = ready.begin(); i != ready.end(); ++i)
+	{
+		Task* task = *i;
+		task->Finish();
+		delete task;
+	}
+}
+
+bool ThreadPool::HasTasks(Module* mod) const
+{
+	for (std::deque<Task*>::const_iterator i = pending.begin(); i != pending.end(); ++i)
+	{
+		if ((*i)->UsesModule(mod))
+			return true;
+	}
+
+	for (std::vector<Task*>::const_iterator i = running.begin(); i != running.end(); ++i)
+	{
+		if ((*i)->UsesModule(mod))
+			return true;
+	}
+	return false;
+}
+
+void ThreadPool::Flush(Module* mod)
+{
+	finished.Lock();
+	while (true)
+	{
+		LockQueue();
+		const bool idle = !HasTasks(mod);
+		UnlockQueue();
+		if (idle)
+			break;
+
+		// Workers take the lock before signalling so the signal can't be missed
+		finished.Wait();
+	}
+	finished.Unlock();
+
+	// Only finish the tasks using the module, the others are finished by OnNotify() as usual
+	std::vector<Task*> ready;
+	LockQueue();
+	for (std::vector<Task*>::iterator i = done.begin(); i != done.end(); )
+	{
+		if ((*i)->UsesModule(mod))
+		{
+			ready.push_back(*i);
+			i = done.erase(i);
+		}
+		else
+			++i;
+	}
+	UnlockQueue();
+
+	for (std::vector<Task*>::const_iterator i = ready.begin(); i != ready.end(); ++i)
+	{
+		Task* task = *i;
+		task->Finish();
+		delete task;
+	}
+}
+
+ThreadPool& ThreadEngine::GetPool()
+{
+	if (!pool)
+	{
+		pool = new ThreadPool;
+		pool->Start(ServerInstance->Config->WorkerThreads);
+	}
+	return *pool;
+}
+
+void ThreadEngine::FlushPool(Module* mod)
+{
+	if (pool)
+		pool->Flush(mod);
+}
+
+void ThreadEngine::StopPool()
+{
+	if (!pool)
+		return;
+
+	pool->Stop();
+	delete pool;
+	pool = NULL;
+}
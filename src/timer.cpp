@@ -32,6 +32,7 @@ void Timer::SetInterval(time_t newinterval)
 
 Timer::Timer(unsigned int secs_from_now, bool repeating)
 	: trigger(ServerInstance->Time() + secs_from_now)
+	, slot(NULL)
 	, secs(secs_from_now)
 	, repeat(repeating)
 {
@@ -42,15 +43,48 @@ Timer::~Timer()
 	ServerInstance->Timers.DelTimer(this);
 }
 
+TimerManager::TimerManager()
+	: current(0)
+{
+}
+
 void TimerManager::TickTimers(time_t TIME)
 {
-	for (TimerMap::iterator i = Timers.begin(); i != Timers.end(); )
+	// If the clock went backwards or jumped far ahead (or this is the first tick) don't
+	// walk the wheel second by second, redistribute all timers relative to the new time
+	if ((TIME < current) || (TIME - current > time_t(WHEEL_SIZE * WHEEL_SIZE)))
+		Rebase(TIME);
+
+	while (current < TIME)
 	{
-		Timer* t = i->second;
-		if (t->GetTrigger() > TIME)
-			break;
+		current++;
+
+		// Redistribute the higher level slots that start at this second, highest level first
+		// as the timers in those may end up in a lower level slot that also starts now
+		for (unsigned int level = WHEEL_LEVELS; level > 0; level--)
+		{
+			const unsigned int shift = WHEEL_BITS * level;
+			if (current & ((time_t(1) << shift) - 1))
+				continue;
+
+			if (level == WHEEL_LEVELS)
+				Cascade(overflow);
+			else
+				Cascade(wheel[level][(current >> shift) & (WHEEL_SIZE - 1)]);
+		}
+
+		Expire(TIME);
+	}
+}
 
-		Timers.erase(i++);
+void TimerManager::Expire(time_t TIME)
+{
+	TimerList& list = wheel[0][current & (WHEEL_SIZE - 1)];
+	while (!list.empty())
+	{
+		Timer* t = list.front();
+		list.pop_front();
+		t->slot = NULL;
 
 		if (!t->Tick(TIME))
 			continue;
@@ -63,21 +97,84 @@ void TimerManager::TickTimers(time_t TIME)
 	}
 }
 
-void TimerManager::DelTimer(Timer* t)
+void TimerManager::Cascade(TimerList& list)
 {
-	std::pair<TimerMap::iterator, TimerMap::iterator> itpair = Timers.equal_range(t->GetTrigger());
+	// Only look at the timers that were in the list when we started, timers in the
+	// overflow list which are still too far in the future are appended to it again
+	for (size_t n = list.size(); n; n--)
+	{
+		Timer* t = list.front();
+		list.pop_front();
+		Schedule(t, std::max(t->GetTrigger(), current));
+	}
+}
 
-	for (TimerMap::iterator i = itpair.first; i != itpair.second; ++i)
+void TimerManager::Rebase(time_t TIME)
+{
+	TimerList pending;
+	for (unsigned int level = 0; level < WHEEL_LEVELS; level++)
 	{
-		if (i->second == t)
+		for (unsigned int i = 0; i < WHEEL_SIZE; i++)
 		{
-			Timers.erase(i);
+			TimerList& list = wheel[level][i];
+			while (!list.empty())
+			{
+				Timer* t = list.front();
+				list.pop_front();
+				pending.push_back(t);
+			}
+		}
+	}
+
+	while (!overflow.empty())
+	{
+		Timer* t = overflow.front();
+		overflow.pop_front();
+		pending.push_back(t);
+	}
+
+	// Timers that are already due will tick when the wheel is advanced to TIME
+	current = TIME - 1;
+	while (!pending.empty())
+	{
+		Timer* t = pending.front();
+		pending.pop_front();
+		Schedule(t, std::max(t->GetTrigger(), TIME));
+	}
+}
+
+void TimerManager::Schedule(Timer* t, time_t when)
+{
+	const time_t delta = when - current;
+	TimerList* list = &overflow;
+	for (unsigned int level = 0; level < WHEEL_LEVELS; level++)
+	{
+		const unsigned int shift = WHEEL_BITS * level;
+		if (delta < (time_t(1) << (shift + WHEEL_BITS)))
+		{
+			list = &wheel[level][(when >> shift) & (WHEEL_SIZE - 1)];
 			break;
 		}
 	}
+
+	list->push_back(t);
+	t->slot = list;
+}
+
+void TimerManager::DelTimer(Timer* t)
+{
+	if (!t->slot)
+		return;
+
+	t->slot->erase(t);
+	t->slot = NULL;
 }
 
 void TimerManager::AddTimer(Timer* t)
 {
-	Timers.insert(std::make_pair(t->GetTrigger(), t));
+	// Adding a timer that is already pending moves it
+	DelTimer(t);
+
+	// Timers that are already due tick on the next call to TickTimers()
+	Schedule(t, std::max(t->GetTrigger(), current + 1));
 }
@@ -74,6 +74,7 @@ void UserManager::AddUser(int socket, ListenSocket* via, irc::sockets::sockaddrs
 	this->clientlist[New->nick] = New;
 	this->AddClone(New);
 	this->local_users.push_front(New);
+	ServerInstance->XLines->AddLocalUser(New);
 
 	if (!SocketEngine::AddFd(eh, FD_WANT_FAST_READ | FD_WANT_EDGE_WRITE))
 	{
@@ -203,6 +204,7 @@ void UserManager::QuitUser(User* user, const std::string& quitreason, const std:
 		if (lu->registered == REG_ALL)
 			ServerInstance->SNO->WriteToSnoMask('q',"Client exiting: %s (%s) [%s]", user->GetFullRealHost().c_str(), user->GetIPString().c_str(), operreason->c_str());
 		local_users.erase(lu);
+		ServerInstance->XLines->DelLocalUser(lu);
 	}
 
 	if (!clientlist.erase(user->nick))
@@ -284,73 +286,96 @@ bool UserManager::AllModulesReportReady(LocalUser* user)
 	return (res == MOD_RES_PASSTHRU);
 }
 
+LocalUserTimer::LocalUserTimer(LocalUser* me)
+	: Timer(1)
+	, user(me)
+{
+}
+
 /**
- * This function is called once a second from the mainloop.
- * It is intended to do background checking on all the users, e.g. do
- * ping checks, registration timeouts, etc.
+ * This function is called when the next check of a local user is due.
+ * It does the ping checks, registration timeouts, etc. of the user and
+ * then reschedules itself for when the next check is needed.
  */
-void UserManager::DoBackgroundUserStuff()
+bool LocalUserTimer::Tick(time_t currtime)
 {
-	for (LocalList::iterator i = local_users.begin(); i != local_users.end(); )
-	{
-		// It's possible that we quit the user below due to ping timeout etc. and QuitUser() removes it from the list
-		LocalUser* curr = *i;
-		++i;
+	// The user will be culled soon, there is nothing more to check
+	if (user->quitting)
+		return false;
 
-		if (curr->CommandFloodPenalty || curr->eh.getSendQSize())
-		{
-			unsigned int rate = curr->MyClass->GetCommandRate();
-			if (curr->CommandFloodPenalty > rate)
-				curr->CommandFloodPenalty -= rate;
-			else
-				curr->CommandFloodPenalty = 0;
-			curr->eh.OnDataReady();
-		}
+	// Process the data in the recvq of users who were held back due to throttling
+	if (user->CommandFloodPenalty || user->eh.getSendQSize())
+	{
+		user->eh.OnDataReady();
+		if (user->quitting)
+			return false;
+	}
 
-		switch (curr->registered)
-		{
-			case REG_ALL:
-				if (ServerInstance->Time() >= curr->nping)
-				{
-					// This user didn't answer the last ping, remove them
-					if (!curr->lastping)
-					{
-						time_t time = ServerInstance->Time() - (curr->nping - curr->MyClass->GetPingTime());
-						const std::string message = "Ping timeout: " + ConvToStr(time) + (time != 1 ? " seconds" : " second");
-						this->QuitUser(curr, message);
-						continue;
-					}
-
-					curr->Write("PING :" + ServerInstance->Config->ServerName);
-					curr->lastping = 0;
-					curr->nping = ServerInstance->Time() + curr->MyClass->GetPingTime();
-				}
-				break;
-			case REG_NICKUSER:
-				if (AllModulesReportReady(curr))
+	switch (user->registered)
+	{
+		case REG_ALL:
+			if (currtime >= user->nping)
+			{
+				// This user didn't answer the last ping, remove them
+				if (!user->lastping)
 				{
-					/* User has sent NICK/USER, modules are okay, DNS finished. */
-					curr->FullConnect();
-					continue;
+					time_t time = currtime - (user->nping - user->MyClass->GetPingTime());
+					const std::string message = "Ping timeout: " + ConvToStr(time) + (time != 1 ? " seconds" : " second");
+					ServerInstance->Users->QuitUser(user, message);
+					return false;
 				}
 
-				// If the user has been quit in OnCheckReady then we shouldn't
-				// quit them again for having a registration timeout.
-				if (curr->quitting)
-					continue;
+				user->Write("PING :" + ServerInstance->Config->ServerName);
+				user->lastping = 0;
+				user->nping = currtime + user->MyClass->GetPingTime();
+			}
+			break;
+		case REG_NICKUSER:
+			if (ServerInstance->Users->AllModulesReportReady(user))
+			{
+				/* User has sent NICK/USER, modules are okay, DNS finished. */
+				user->FullConnect();
+				if (user->quitting)
+					return false;
 				break;
-		}
+			}
 
-		if (curr->registered != REG_ALL && curr->MyClass && (ServerInstance->Time() > (curr->signon + curr->MyClass->GetRegTimeout())))
-		{
-			/*
-			 * registration timeout -- didnt send USER/NICK/HOST
-			 * in the time specified in their connection class.
-			 */
-			this->QuitUser(curr, "Registration timeout");
-			continue;
-		}
+			// If the user has been quit in OnCheckReady then we shouldn't
+			// quit them again for having a registration timeout.
+			if (user->quitting)
+				return false;
+			break;
+	}
+
+	if (user->registered != REG_ALL && user->MyClass && (currtime > (user->signon + user->MyClass->GetRegTimeout())))
+	{
+		/*
+		 * registration timeout -- didnt send USER/NICK/HOST
+		 * in the time specified in their connection class.
+		 */
+		ServerInstance->Users->QuitUser(user, "Registration timeout");
+		return false;
 	}
+
+	// Unregistered users are checked every second as modules may become ready for them at any
+	// time, registered users only need to be checked when their next ping is due. Activity pushes
+	// nping further into the future, in that case we reschedule ourselves when we tick at the old time.
+	time_t next = (user->registered == REG_ALL ? user->nping : currtime + 1);
+	if (user->CommandFloodPenalty || user->eh.getSendQSize())
+		next = std::min(next, currtime + 1);
+
+	SetTrigger(next);
+	ServerInstance->Timers.AddTimer(this);
+	return false;
+}
+
+void LocalUserTimer::Wakeup(time_t when)
+{
+	if (GetTrigger() <= when)
+		return;
+
+	SetTrigger(when);
+	ServerInstance->Timers.AddTimer(this);
 }
 
 already_sent_t UserManager::NextAlreadySentId()
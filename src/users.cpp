@@ -26,6 +26,64 @@
 #include "inspircd.h"
 #include "xline.h"
 
+namespace
+{
+	insp::MemoryPool localuserpool("LocalUser", sizeof(LocalUser));
+	insp::MemoryPool remoteuserpool("RemoteUser", sizeof(RemoteUser));
+
+	/** Compares the password of an unregistered user to the password of a connect class
+	 */
+	class ClassPasswordRequest : public PassCompareRequest
+	{
+	 public:
+		ClassPasswordRequest(LocalUser* user, const LocalUser::ClassPassword& entry)
+			: PassCompareRequest(NULL, user, entry.password, entry.input, entry.hashtype)
+		{
+		}
+
+		void OnResult(bool match) CXX11_OVERRIDE
+		{
+			LocalUser* const user = IS_LOCAL(ServerInstance->FindUUID(uuid));
+			if ((!user) || (user->quitting))
+				return;
+
+			for (std::vector<LocalUser::ClassPassword>::iterator i = user->classpasswords.begin(); i != user->classpasswords.end(); ++i)
+			{
+				LocalUser::ClassPassword& entry = *i;
+				if ((entry.result < 0) && (entry.password == password) && (entry.hashtype == hashtype) && (entry.input == input))
+				{
+					entry.result = match;
+					break;
+				}
+			}
+
+			// Retry registering the user now instead of on the next second
+			if (user->classpending)
+				user->usertimer.Wakeup(ServerInstance->Time());
+		}
+	};
+}
+
+void* LocalUser::operator new(size_t size)
+{
+	return localuserpool.Allocate(size);
+}
+
+void LocalUser::operator delete(void* ptr, size_t size)
+{
+	localuserpool.Deallocate(ptr, size);
+}
+
+void* RemoteUser::operator new(size_t size)
+{
+	return remoteuserpool.Allocate(size);
+}
+
+void RemoteUser::operator delete(void* ptr, size_t size)
+{
+	remoteuserpool.Deallocate(ptr, size);
+}
+
 bool User::IsNoticeMaskSet(unsigned char sm)
 {
 	if (!isalpha(sm))
@@ -94,12 +152,16 @@ LocalUser::LocalUser(int myfd, irc::sockets::sockaddrs* client, irc::sockets::so
 	, quitting_sendq(false)
 	, lastping(true)
 	, exempt(false)
+	, classpending(false)
 	, nping(0)
 	, idle_lastmsg(0)
 	, CommandFloodPenalty(0)
+	, lastpenaltydecay(ServerInstance->Time())
+	, usertimer(this)
 	, already_sent(0)
 {
 	signon = ServerInstance->Time();
+	ServerInstance->Timers.AddTimer(&usertimer);
 	// The user's default nick is their UUID
 	nick = uuid;
 	ident = "unknown";
@@ -231,11 +293,11 @@ void UserIOHandler::OnDataReady()
 	if (user->quitting)
 		return;
 
-	if (recvq.length() > user->MyClass->GetRecvqMax() && !user->HasPrivPermission("users/flood/increased-buffers"))
+	if (GetRecvQSize() > user->MyClass->GetRecvqMax() && !user->HasPrivPermission("users/flood/increased-buffers"))
 	{
 		ServerInstance->Users->QuitUser(user, "RecvQ exceeded");
 		ServerInstance->SNO->WriteToSnoMask('a', "User %s RecvQ of %lu exceeds connect class maximum of %lu",
-			user->nick.c_str(), (unsigned long)recvq.length(), user->MyClass->GetRecvqMax());
+			user->nick.c_str(), (unsigned long)GetRecvQSize(), user->MyClass->GetRecvqMax());
 		return;
 	}
 	unsigned long sendqmax = ULONG_MAX;
@@ -245,14 +307,29 @@ void UserIOHandler::OnDataReady()
 	if (!user->HasPrivPermission("users/flood/no-fakelag"))
 		penaltymax = user->MyClass->GetPenaltyThreshold() * 1000;
 
+	// The penalty decays by the command rate of the connect class every second,
+	// apply the decay for the time that passed since it was last applied
+	if (user->CommandFloodPenalty)
+	{
+		const unsigned long decay = (ServerInstance->Time() - user->lastpenaltydecay) * user->MyClass->GetCommandRate();
+		user->CommandFloodPenalty = (user->CommandFloodPenalty > decay ? user->CommandFloodPenalty - decay : 0);
+	}
+	user->lastpenaltydecay = ServerInstance->Time();
+
+	std::string line;
+	line.reserve(ServerInstance->Config->Limits.MaxLine);
 	while (user->CommandFloodPenalty < penaltymax && getSendQSize() < sendqmax)
 	{
-		std::string line;
-		line.reserve(ServerInstance->Config->Limits.MaxLine);
-		std::string::size_type qpos = 0;
-		while (qpos < recvq.length())
+		const char* data;
+		size_t length;
+		// if there is no newline in the recvq then wait for more data
+		if (!GetNextLine(data, length))
+			return;
+
+		line.clear();
+		for (const char* end = data + length; data != end; ++data)
 		{
-			char c = recvq[qpos++];
+			char c = *data;
 			switch (c)
 			{
 			case '\0':
@@ -260,21 +337,14 @@ void UserIOHandler::OnDataReady()
 				break;
 			case '\r':
 				continue;
-			case '\n':
-				goto eol_found;
 			}
 			if (line.length() < ServerInstance->Config->Limits.MaxLine - 2)
 				line.push_back(c);
 		}
-		// if we got here, the recvq ran out before we found a newline
-		return;
-eol_found:
-		// just found a newline. Terminate the string, and pull it out of recvq
-		recvq.erase(0, qpos);
 
 		// TODO should this be moved to when it was inserted in recvq?
-		ServerInstance->stats.Recv += qpos;
-		user->bytes_in += qpos;
+		ServerInstance->stats.Recv += length + 1;
+		user->bytes_in += length + 1;
 		user->cmds_in++;
 
 		ServerInstance->Parser.ProcessBuffer(line, user);
@@ -283,24 +353,38 @@ eol_found:
 	}
 	if (user->CommandFloodPenalty >= penaltymax && !user->MyClass->fakelag)
 		ServerInstance->Users->QuitUser(user, "Excess Flood");
+	else
+		// Commands are being held back, try to process them again in a second
+		user->usertimer.Wakeup(ServerInstance->Time() + 1);
 }
 
-void UserIOHandler::AddWriteBuf(const std::string &data)
+bool UserIOHandler::CheckSendQ(size_t len)
 {
 	if (user->quitting_sendq)
-		return;
-	if (!user->quitting && getSendQSize() + data.length() > user->MyClass->GetSendqHardMax() &&
+		return false;
+	if (!user->quitting && getSendQSize() + len > user->MyClass->GetSendqHardMax() &&
 		!user->HasPrivPermission("users/flood/increased-buffers"))
 	{
 		user->quitting_sendq = true;
 		ServerInstance->GlobalCulls.AddSQItem(user);
-		return;
+		return false;
 	}
 
 	// We still want to append data to the sendq of a quitting user,
 	// e.g. their ERROR message that says 'closing link'
+	return true;
+}
 
-	WriteData(data);
+void UserIOHandler::AddWriteBuf(const std::string &data)
+{
+	if (CheckSendQ(data.length()))
+		WriteData(data);
+}
+
+void UserIOHandler::AddWriteBuf(SharedBuffer* data)
+{
+	if (CheckSendQ(data->data.length()))
+		WriteData(data);
 }
 
 void UserIOHandler::OnError(BufferedSocketError)
@@ -520,17 +604,26 @@ bool LocalUser::CheckLines(bool doZline)
 
 void LocalUser::FullConnect()
 {
-	ServerInstance->stats.Connects++;
-	this->idle_lastmsg = ServerInstance->Time();
-
 	/*
 	 * You may be thinking "wtf, we checked this in User::AddClient!" - and yes, we did, BUT.
 	 * At the time AddClient is called, we don't have a resolved host, by here we probably do - which
 	 * may put the user into a totally seperate class with different restrictions! so we *must* check again.
 	 * Don't remove this! -- w00t
 	 */
+	reference<ConnectClass> prevclass = MyClass;
 	MyClass = NULL;
 	SetClass();
+	if (classpending)
+	{
+		// The user timer calls us again once the password check has finished
+		MyClass = prevclass;
+		return;
+	}
+	classpasswords.clear();
+
+	ServerInstance->stats.Connects++;
+	this->idle_lastmsg = ServerInstance->Time();
+
 	CheckClass();
 	CheckLines();
 
@@ -593,6 +686,10 @@ void User::InvalidateCache()
 	cached_hostip.clear();
 	cached_makehost.clear();
 	cached_fullrealhost.clear();
+
+	// Ban matches depend on the nick, ident, host and IP too
+	for (ChanList::iterator i = chans.begin(); i != chans.end(); ++i)
+		(*i)->banserial = 0;
 }
 
 bool User::ChangeNick(const std::string& newnick, time_t newts)
@@ -751,6 +848,7 @@ void LocalUser::SetClientIP(const irc::sockets::sockaddrs& sa, bool recheck_elin
 	if (sa != client_sa)
 	{
 		User::SetClientIP(sa);
+		ServerInstance->XLines->UpdateLocalUser(this);
 		if (recheck_eline)
 			this->exempt = (ServerInstance->XLines->MatchesLine("E", this) != NULL);
 
@@ -791,6 +889,28 @@ void LocalUser::Write(const std::string& text)
 	this->cmds_out++;
 }
 
+reference<SharedBuffer> LocalUser::PrepareSharedLine(const std::string& text)
+{
+	const std::string::size_type maxlen = ServerInstance->Config->Limits.MaxLine - 2;
+	std::string line(text, 0, maxlen);
+	line.append(wide_newline);
+	return new SharedBuffer(line);
+}
+
+void LocalUser::WriteShared(SharedBuffer* line)
+{
+	if (!SocketEngine::BoundsCheckFd(&eh))
+		return;
+
+	ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %.*s", uuid.c_str(), (int)line->data.length() - 2, line->data.c_str());
+
+	eh.AddWriteBuf(line);
+
+	ServerInstance->stats.Sent += line->data.length();
+	this->bytes_out += line->data.length();
+	this->cmds_out++;
+}
+
 /** Write()
  */
 void LocalUser::Write(const char *text, ...)
@@ -880,10 +1000,14 @@ namespace
 	class WriteCommonRawHandler : public User::ForEachNeighborHandler
 	{
 		const std::string& msg;
+		reference<SharedBuffer> line;
 
 		void Execute(LocalUser* user) CXX11_OVERRIDE
 		{
-			user->Write(msg);
+			// Only build the line once there is someone to send it to
+			if (!line)
+				line = LocalUser::PrepareSharedLine(msg);
+			user->WriteShared(line);
 		}
 
 	 public:
@@ -946,12 +1070,12 @@ void User::ForEachNeighbor(ForEachNeighborHandler& handler, bool include_self)
 	for (IncludeChanList::const_iterator i = include_chans.begin(); i != include_chans.end(); ++i)
 	{
 		Channel* chan = (*i)->chan;
-		const Channel::MemberMap& userlist = chan->GetUsers();
-		for (Channel::MemberMap::const_iterator j = userlist.begin(); j != userlist.end(); ++j)
+		const Channel::LocalMemberList& localusers = chan->GetLocalUsers();
+		for (Channel::LocalMemberList::const_iterator j = localusers.begin(); j != localusers.end(); ++j)
 		{
-			LocalUser* curr = IS_LOCAL(j->first);
+			LocalUser* curr = static_cast<LocalUser*>((*j)->user);
 			// User not yet visited?
-			if ((curr) && (curr->already_sent != newid))
+			if (curr->already_sent != newid)
 			{
 				// Mark as visited and execute function
 				curr->already_sent = newid;
@@ -973,7 +1097,7 @@ void User::WriteRemoteNumeric(const Numeric::Numeric& numeric)
  * the first users channels then the second users channels within the outer loop,
  * therefore it was a maximum of x*y iterations (upon returning 0 and checking
  * all possible iterations). However this new function instead checks against the
- * channel's userlist in the inner loop which is a std::map<User*,User*>
+ * channel's userlist in the inner loop which is a map keyed by User*
  * and saves us time as we already know what pointer value we are after.
  * Don't quote me on the maths as i am not a mathematician or computer scientist,
  * but i believe this algorithm is now x+(log y) maximum iterations instead.
@@ -1051,6 +1175,10 @@ void User::ChangeRealHost(const std::string& host, bool resetdisplay)
 
 	realhost = host;
 	this->InvalidateCache();
+
+	LocalUser* const luser = IS_LOCAL(this);
+	if (luser)
+		ServerInstance->XLines->UpdateLocalUser(luser);
 }
 
 bool User::ChangeIdent(const std::string& newident)
@@ -1076,6 +1204,7 @@ bool User::ChangeIdent(const std::string& newident)
 void LocalUser::SetClass(const std::string &explicit_name)
 {
 	ConnectClass *found = NULL;
+	classpending = false;
 
 	ServerInstance->Logs->Log("CONNECTCLASS", LOG_DEBUG, "Setting connect class for UID %s", this->uuid.c_str());
 
@@ -1148,7 +1277,16 @@ void LocalUser::SetClass(const std::string &explicit_name)
 
 			if (regdone && !c->config->getString("password").empty())
 			{
-				if (!ServerInstance->PassCompare(this, c->config->getString("password"), password, c->config->getString("hash")))
+				const int result = CheckClassPassword(c);
+				if (result < 0)
+				{
+					// Don't fall through to a class further down the list, wait for the result instead
+					ServerInstance->Logs->Log("CONNECTCLASS", LOG_DEBUG, "Password check still running, deferring");
+					classpending = true;
+					return;
+				}
+
+				if (!result)
 				{
 					ServerInstance->Logs->Log("CONNECTCLASS", LOG_DEBUG, "Bad password, skipping");
 					continue;
@@ -1170,6 +1308,28 @@ void LocalUser::SetClass(const std::string &explicit_name)
 	}
 }
 
+int LocalUser::CheckClassPassword(ConnectClass* c)
+{
+	ClassPassword entry;
+	entry.password = c->config->getString("password");
+	entry.hashtype = c->config->getString("hash");
+	entry.input = password;
+
+	for (std::vector<ClassPassword>::const_iterator i = classpasswords.begin(); i != classpasswords.end(); ++i)
+	{
+		const ClassPassword& other = *i;
+		if ((other.password == entry.password) && (other.hashtype == entry.hashtype) && (other.input == entry.input))
+			return other.result;
+	}
+
+	entry.result = -1;
+	classpasswords.push_back(entry);
+
+	// If the hash is cheap to compute the result is delivered before this returns
+	ServerInstance->PassCompare(new ClassPasswordRequest(this, entry));
+	return classpasswords.back().result;
+}
+
 void User::PurgeEmptyChannels()
 {
 	// firstly decrement the count on each channel
@@ -135,6 +135,136 @@ class ZLineFactory : public XLineFactory
  *  bans. :)
  */
 
+size_t XLineIndex::CIDRHash::operator()(const irc::sockets::cidr_mask& mask) const
+{
+	size_t t = (mask.type << 8) | mask.length;
+	for (unsigned int i = 0; i < sizeof(mask.bits); i++)
+		t = 5 * t + mask.bits[i];
+	return t;
+}
+
+XLineIndex::XLineIndex()
+{
+	memset(cidrlengths, 0, sizeof(cidrlengths));
+}
+
+bool XLineIndex::ParseCIDR(const std::string& mask, irc::sockets::cidr_mask& out)
+{
+	// Same rules as irc::sockets::MatchCIDR(), it only looks at the part after the last '@'
+	const std::string cidr(mask, mask.rfind('@') + 1);
+	const std::string::size_type per_pos = cidr.rfind('/');
+	if ((per_pos == std::string::npos) || (per_pos == cidr.length()-1)
+		|| (cidr.find_first_not_of("0123456789", per_pos+1) != std::string::npos)
+		|| (cidr.find_first_not_of("0123456789abcdefABCDEF.:") < per_pos))
+		return false;
+
+	out = irc::sockets::cidr_mask(cidr);
+
+	// Masks that do not parse are left to the linear scan, they are matched in odd ways
+	return ((out.type == AF_INET) || (out.type == AF_INET6));
+}
+
+void XLineIndex::Add(XLine* line)
+{
+	const std::string* mask = line->GetIndexMask();
+	irc::sockets::cidr_mask cidr;
+	if (!mask)
+		unindexed.push_back(line);
+	else if (ParseCIDR(*mask, cidr))
+	{
+		cidrs.insert(std::make_pair(cidr, line));
+		cidrlengths[cidr.type == AF_INET6][cidr.length]++;
+	}
+	else if (mask->find_first_of("*?") == std::string::npos)
+		exact.insert(std::make_pair(*mask, line));
+	else
+		unindexed.push_back(line);
+}
+
+void XLineIndex::Remove(XLine* line)
+{
+	const std::string* mask = line->GetIndexMask();
+	irc::sockets::cidr_mask cidr;
+	if (!mask)
+		stdalgo::vector::swaperase(unindexed, line);
+	else if (ParseCIDR(*mask, cidr))
+	{
+		std::pair<CIDRMap::iterator, CIDRMap::iterator> range = cidrs.equal_range(cidr);
+		for (CIDRMap::iterator i = range.first; i != range.second; ++i)
+		{
+			if (i->second == line)
+			{
+				cidrs.erase(i);
+				cidrlengths[cidr.type == AF_INET6][cidr.length]--;
+				break;
+			}
+		}
+	}
+	else if (mask->find_first_of("*?") == std::string::npos)
+	{
+		std::pair<ExactMap::iterator, ExactMap::iterator> range = exact.equal_range(*mask);
+		for (ExactMap::iterator i = range.first; i != range.second; ++i)
+		{
+			if (i->second == line)
+			{
+				exact.erase(i);
+				break;
+			}
+		}
+	}
+	else
+		stdalgo::vector::swaperase(unindexed, line);
+}
+
+void XLineIndex::FindCIDR(const irc::sockets::sockaddrs& sa, std::vector<XLine*>& out)
+{
+	unsigned int maxlength;
+	if (sa.sa.sa_family == AF_INET)
+		maxlength = 32;
+	else if (sa.sa.sa_family == AF_INET6)
+		maxlength = 128;
+	else
+		return;
+
+	const unsigned int* lengths = cidrlengths[sa.sa.sa_family == AF_INET6];
+	for (unsigned int length = 0; length <= maxlength; length++)
+	{
+		if (!lengths[length])
+			continue;
+
+		std::pair<CIDRMap::iterator, CIDRMap::iterator> range = cidrs.equal_range(irc::sockets::cidr_mask(sa, length));
+		for (CIDRMap::iterator i = range.first; i != range.second; ++i)
+			out.push_back(i->second);
+	}
+}
+
+void XLineIndex::Find(User* user, std::vector<XLine*>& out)
+{
+	out.insert(out.end(), unindexed.begin(), unindexed.end());
+
+	const std::string& ip = user->GetIPString();
+	const std::string& host = user->GetRealHost();
+
+	std::pair<ExactMap::iterator, ExactMap::iterator> range = exact.equal_range(ip);
+	for (ExactMap::iterator i = range.first; i != range.second; ++i)
+		out.push_back(i->second);
+
+	if (!cidrs.empty())
+		FindCIDR(user->client_sa, out);
+
+	if (irc::equals(host, ip))
+		return;
+
+	range = exact.equal_range(host);
+	for (ExactMap::iterator i = range.first; i != range.second; ++i)
+		out.push_back(i->second);
+
+	// Lines are matched against the real host too, which may also be an IP
+	irc::sockets::sockaddrs sa;
+	if ((!cidrs.empty()) && (irc::sockets::aptosa(host, 0, sa)))
+		FindCIDR(sa, out);
+}
+
 bool XLine::Matches(User *u)
 {
 	return false;
@@ -284,6 +414,7 @@ bool XLineManager::AddLine(XLine* line, User* user)
 		pending_lines.push_back(line);
 
 	lookup_lines[line->type][line->Displayable()] = line;
+	line_index[line->type].Add(line);
 	line->OnAdd();
 
 	FOREACH_MOD(OnAddLine, (user, line));
@@ -315,6 +446,7 @@ bool XLineManager::DelLine(const char* hostmask, const std::string &type, User*
 	y->second->Unset();
 
 	stdalgo::erase(pending_lines, y->second);
+	line_index[type].Remove(y->second);
 
 	delete y->second;
 	x->second.erase(y);
@@ -339,29 +471,32 @@ XLine* XLineManager::MatchesLine(const std::string &type, User* user)
 
 	const time_t current = ServerInstance->Time();
 
-	LookupIter safei;
+	// Only check the lines that can possibly match the user
+	std::vector<XLine*> candidates;
+	line_index[type].Find(user, candidates);
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
 
-	for (LookupIter i = x->second.begin(); i != x->second.end(); )
+	// Return the same line a scan of the whole list would have found, the first in list order
+	XLine* found = NULL;
+	irc::insensitive_swo less;
+	for (std::vector<XLine*>::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
 	{
-		safei = i;
-		safei++;
-
-		if (i->second->duration && current > i->second->expiry)
+		XLine* line = *i;
+		if (line->duration && current > line->expiry)
 		{
 			/* Expire the line, proceed to next one */
-			ExpireLine(x, i);
-			i = safei;
+			ExpireLine(x, x->second.find(line->Displayable()));
 			continue;
 		}
 
-		if (i->second->Matches(user))
-		{
-			return i->second;
-		}
+		if ((found) && (!less(line->Displayable(), found->Displayable())))
+			continue;
 
-		i = safei;
+		if (line->Matches(user))
+			found = line;
 	}
-	return NULL;
+	return found;
 }
 
 XLine* XLineManager::MatchesLine(const std::string &type, const std::string &pattern)
@@ -412,33 +547,134 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 	 * -- Brain
 	 */
 	stdalgo::erase(pending_lines, item->second);
+	line_index[container->first].Remove(item->second);
 
 	delete item->second;
 	container->second.erase(item);
 }
 
 
+void XLineUserIndex::Add(LocalUser* user)
+{
+	Entry& entry = entries[user];
+	const std::string& ip = user->GetIPString();
+	const std::string& host = user->GetRealHost();
+
+	entry.addrs.push_back(addrs.insert(std::make_pair(irc::sockets::cidr_mask(user->client_sa, 128), user)));
+	entry.hosts.push_back(hosts.insert(std::make_pair(ip, user)));
+	if (irc::equals(host, ip))
+		return;
+
+	// Lines are matched against the real host too, which may also be an IP
+	entry.hosts.push_back(hosts.insert(std::make_pair(host, user)));
+	irc::sockets::sockaddrs sa;
+	if (irc::sockets::aptosa(host, 0, sa))
+		entry.addrs.push_back(addrs.insert(std::make_pair(irc::sockets::cidr_mask(sa, 128), user)));
+}
+
+void XLineUserIndex::Remove(LocalUser* user)
+{
+	TR1NS::unordered_map<LocalUser*, Entry>::iterator it = entries.find(user);
+	if (it == entries.end())
+		return;
+
+	const Entry& entry = it->second;
+	for (std::vector<AddrMap::iterator>::const_iterator i = entry.addrs.begin(); i != entry.addrs.end(); ++i)
+		addrs.erase(*i);
+	for (std::vector<HostMap::iterator>::const_iterator i = entry.hosts.begin(); i != entry.hosts.end(); ++i)
+		hosts.erase(*i);
+	entries.erase(it);
+}
+
+void XLineUserIndex::Update(LocalUser* user)
+{
+	if (!entries.count(user))
+		return;
+
+	Remove(user);
+	Add(user);
+}
+
+bool XLineUserIndex::Find(XLine* line, std::vector<LocalUser*>& out) const
+{
+	const std::string* mask = line->GetIndexMask();
+	if (!mask)
+		return false;
+
+	irc::sockets::cidr_mask cidr;
+	if (XLineIndex::ParseCIDR(*mask, cidr))
+	{
+		// All addresses in the range sort between the range with the host bits cleared and set
+		const unsigned int maxlength = (cidr.type == AF_INET ? 32 : 128);
+		irc::sockets::cidr_mask first(cidr);
+		first.length = maxlength;
+		irc::sockets::cidr_mask last(first);
+		for (unsigned int bit = cidr.length; bit < maxlength; bit++)
+			last.bits[bit / 8] |= (0x80 >> (bit % 8));
+
+		AddrMap::const_iterator end = addrs.upper_bound(last);
+		for (AddrMap::const_iterator i = addrs.lower_bound(first); i != end; ++i)
+			out.push_back(i->second);
+		return true;
+	}
+
+	if (mask->find_first_of("*?") != std::string::npos)
+		return false;
+
+	std::pair<HostMap::const_iterator, HostMap::const_iterator> range = hosts.equal_range(*mask);
+	for (HostMap::const_iterator i = range.first; i != range.second; ++i)
+		out.push_back(i->second);
+	return true;
+}
+
 // applies lines, removing clients and changing nicks etc as applicable
 void XLineManager::ApplyLines()
 {
+	if (pending_lines.empty())
+		return;
+
 	const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
-	for (UserManager::LocalList::const_iterator j = list.begin(); j != list.end(); ++j)
+	std::vector<LocalUser*> candidates;
+	unsigned long checks = 0;
+
+	std::vector<XLine*>::size_type applied = 0;
+	for (; (applied < pending_lines.size()) && (checks < APPLY_BUDGET); applied++)
 	{
-		LocalUser* u = *j;
+		XLine* x = pending_lines[applied];
 
-		// Don't ban people who are exempt.
-		if (u->exempt)
-			continue;
+		candidates.clear();
+		if (!user_index.Find(x, candidates))
+			candidates.assign(list.begin(), list.end());
 
-		for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
+		for (std::vector<LocalUser*>::const_iterator j = candidates.begin(); j != candidates.end(); ++j)
 		{
-			XLine *x = *i;
+			LocalUser* u = *j;
+
+			// Don't ban people who are exempt, or users who are already gone
+			// (possibly because they are in the candidate list twice).
+			if (u->exempt || u->quitting)
+				continue;
+
+			checks++;
 			if (x->Matches(u))
 				x->Apply(u);
 		}
 	}
 
-	pending_lines.clear();
+	pending_lines.erase(pending_lines.begin(), pending_lines.begin() + applied);
+
+	// Don't stall the server for too long, apply the rest of the lines later
+	if (!pending_lines.empty())
+	{
+		applytimer.SetTrigger(ServerInstance->Time() + 1);
+		ServerInstance->Timers.AddTimer(&applytimer);
+	}
+}
+
+bool XLineManager::ApplyTimer::Tick(time_t)
+{
+	manager->ApplyLines();
+	return false;
 }
 
 void XLineManager::InvokeStats(const std::string& type, unsigned int numeric, Stats::Context& stats)
@@ -471,6 +707,7 @@ void XLineManager::InvokeStats(const std::string& type, unsigned int numeric, St
 
 
 XLineManager::XLineManager()
+	: applytimer(this)
 {
 	GLineFactory* GFact;
 	ELineFactory* EFact;